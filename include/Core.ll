@@ -133,7 +133,7 @@
     %TClass*,       ; stringClass
     %TDictionary*,  ; globalsObject
     %TMethod*,      ; initialMethod
-    [3x%TObject*],  ; binaryMessages : [<, <=, +]
+    [15x%TObject*], ; binaryMessages : binaryBuiltIns::Operator order
     %TClass*,       ; integerClass
     %TSymbol*       ; badMethodSymbol
 }
@@ -191,7 +191,9 @@ define i32 @getSlotSize(i32 %fieldsCount) alwaysinline {
 define i32 @getObjectSize(%TObject* %this) alwaysinline {
     %1 = getelementptr %TObject* %this, i32 0, i32 0, i32 0
     %data = load i32* %1
-    %result = lshr i32 %data, 2
+    %shifted = lshr i32 %data, 2
+    ; upper bits of the size field hold status flags (see TSize)
+    %result = and i32 %shifted, 16777215
     ret i32 %result
 }
 
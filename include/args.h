@@ -40,14 +40,24 @@
 
 struct args
 {
+    // Entries of the method lookup cache, see SmalltalkVM
+    enum { MAX_LOOKUP_CACHE_SIZE = 1 << 20 };
+
     std::size_t heapSize;
     std::size_t maxHeapSize;
     std::string imagePath;
     std::string memoryManagerType;
+    std::size_t lookupCacheSize;
+    std::size_t gcThreads;
+    std::size_t nurserySize;
+    std::size_t gcTime;
+    std::size_t maxPause;
+    std::size_t largeObjectThreshold;
+    int         hugePages;
     int         showHelp;
     int         showVersion;
     args() :
-        heapSize(0), maxHeapSize(0), memoryManagerType(), showHelp(false), showVersion(false)
+        heapSize(0), maxHeapSize(0), memoryManagerType(), lookupCacheSize(0), gcThreads(0), nurserySize(0), gcTime(0), maxPause(0), largeObjectThreshold(64 * 1024), hugePages(false), showHelp(false), showVersion(false)
     {
     }
     void parse(int argc, char **argv);
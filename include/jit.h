@@ -116,7 +116,7 @@ struct TJITGlobals {
     llvm::GlobalValue* smallIntClass;
     llvm::GlobalValue* arrayClass;
     llvm::GlobalValue* contextClass;
-    llvm::GlobalValue* binarySelectors[3];
+    llvm::GlobalValue* binarySelectors[binaryBuiltIns::operatorsCount];
 
     void initializeFromModule(llvm::Module* module) {
         nilObject          = module->getGlobalVariable("nilObject");
@@ -125,9 +125,8 @@ struct TJITGlobals {
         smallIntClass      = module->getGlobalVariable("SmallInt");
         arrayClass         = module->getGlobalVariable("Array");
         contextClass       = module->getGlobalVariable("Context");
-        binarySelectors[0] = module->getGlobalVariable("<");
-        binarySelectors[1] = module->getGlobalVariable("<=");
-        binarySelectors[2] = module->getGlobalVariable("+");
+        for (int i = 0; i < binaryBuiltIns::operatorsCount; i++)
+            binarySelectors[i] = module->getGlobalVariable( binaryBuiltIns::getOperatorName(static_cast<binaryBuiltIns::Operator>(i)) );
 
     //badMethodSymbol =
     }
@@ -39,12 +39,28 @@
 #include <stdint.h>
 #include <tr1/memory>
 #include <types.h>
+#include <opcodes.h>
 #include <vector>
 #include <list>
+#include <deque>
+#include <map>
+#include <set>
+#include <pthread.h>
+#include <signal.h>
 #include <fstream>
 #include "Timer.h"
 
+// Memory of the heap spaces. Memory is mapped directly from the system,
+// so it is zero filled and the physical pages are taken only on the first
+// access. Reset memory reads as zeroes and its pages are given back.
+namespace heapMemory {
+    uint8_t* allocate(std::size_t size);
+    void     release(uint8_t* base, std::size_t size);
+    void     reset(uint8_t* base, std::size_t size);
 
+    // Use transparent huge pages for the memory allocated after the call
+    void     setHugePages(bool enabled);
+}
 
 struct TMemoryManagerHeapEvent {
     const std::string eventName;
@@ -123,11 +139,24 @@ struct TMemoryManagerInfo {
     uint32_t leftToRightCollections;
     uint32_t rightToLeftCollections;
     uint64_t rightCollectionDelay;
+
+    // Pauses of the incremental collection in microseconds
+    uint32_t pausesCount;
+    uint64_t longestPause;
     Timer timer;
     std::list<TMemoryManagerEvent> events;
     TMemoryManagerInfo():collectionsCount(0), allocationsCount(0), totalCollectionDelay(0),
     leftToRightCollections(0), rightToLeftCollections(0), rightCollectionDelay(0),
-    timer(), events(){}
+    pausesCount(0), longestPause(0), timer(), events(){}
+};
+
+// Goals of the adaptive heap sizing
+struct THeapSizingGoals {
+    // Percent of the wall time that may be spent in collections, 0 if not set
+    uint32_t gcTimePercent;
+    // Maximal collection pause in microseconds, 0 if not set
+    uint32_t maxPause;
+    THeapSizingGoals() : gcTimePercent(0), maxPause(0) {}
 };
 
 struct object_ptr {
@@ -140,14 +169,77 @@ private:
     object_ptr(const object_ptr& value);
 };
 
+// Stack of the external slots referring to heap objects. GC treats them as
+// roots and scans the stack as a flat array. Slots are pushed and popped in
+// the LIFO order. Slot released out of order is cleared and then is popped
+// together with the slots above it. Slot that was already popped by the scope
+// may be taken by a newer one, so the release checks that the slot is the same.
+class THandleStack {
+    std::vector<TObject**> m_slots;
+public:
+    THandleStack() : m_slots() { m_slots.reserve(1024); }
+
+    std::size_t push(TObject** slot) {
+        m_slots.push_back(slot);
+        return m_slots.size() - 1;
+    }
+
+    void pop(std::size_t index, TObject** slot) {
+        if (index >= m_slots.size() || m_slots[index] != slot)
+            return;
+
+        if (index + 1 < m_slots.size()) {
+            m_slots[index] = 0;
+            return;
+        }
+
+        do {
+            m_slots.pop_back();
+        } while (!m_slots.empty() && !m_slots.back());
+    }
+
+    std::size_t getWatermark() const { return m_slots.size(); }
+    void popTo(std::size_t watermark) { if (watermark < m_slots.size()) m_slots.resize(watermark); }
+
+    std::size_t size() const { return m_slots.size(); }
+    TObject** operator [] (std::size_t index) const { return m_slots[index]; }
+};
+
 // Generic interface to a memory manager.
 // Custom implementations such as BakerMemoryManager
 // implement this interface.
 class IMemoryManager {
 protected:
     std::tr1::shared_ptr<IGCLogger> m_gcLogger;
-    IMemoryManager(): m_gcLogger(new EmptyGCLogger()){}
+
+    // Write barrier state. Stores to the slots in the young range need no
+    // tracking, stores to the carded range only mark the card of the slot.
+    // Other stores are handled by checkRoot(). Both ranges are empty
+    // unless the memory manager sets them up.
+    uintptr_t m_youngBase;
+    uintptr_t m_youngEnd;
+    uintptr_t m_cardedBase;
+    uintptr_t m_cardedEnd;
+    uint8_t*  m_cards;
+
+    // Allocation buffer is a part of the heap pre-filled with nil that is
+    // handed out by bumping the pointer. It stays empty unless the memory
+    // manager refills it. Allocations made in the buffer are counted here.
+    uint8_t*  m_bufferTop;
+    uint8_t*  m_bufferEnd;
+    uint32_t  m_bufferAllocations;
+
+    // Slots of the hptr<> and THandleScope
+    THandleStack m_handles;
+
+    IMemoryManager(): m_gcLogger(new EmptyGCLogger()),
+        m_youngBase(0), m_youngEnd(0), m_cardedBase(0), m_cardedEnd(0), m_cards(0),
+        m_bufferTop(0), m_bufferEnd(0), m_bufferAllocations(0), m_handles() {}
 public:
+    enum { CARD_SHIFT = 9, CARD_SIZE = 1 << CARD_SHIFT };
+    enum { CARD_CLEAN = 0, CARD_DIRTY = 1 };
+    enum { BUFFER_SIZE = 16 * 1024, MAX_BUFFERED_SIZE = BUFFER_SIZE / 8 };
+
     virtual void setLogger(std::tr1::shared_ptr<IGCLogger> logger){
         m_gcLogger = logger;
     }
@@ -156,10 +248,41 @@ public:
     virtual bool initializeStaticHeap(std::size_t staticHeapSize) = 0;
 
     virtual void* allocate(std::size_t size, bool* collectionOccured = 0) = 0;
+
+    // Inlined fast path of allocate() that never collects. Memory is filled
+    // with nil, so fields of ordinary objects need not be initialized while
+    // binary objects should clear their bytes. Returns 0 if the object does
+    // not fit, allocate() should be called then and the buffer gets refilled.
+    void* allocateInBuffer(std::size_t size) {
+        if (size > MAX_BUFFERED_SIZE || size > static_cast<std::size_t>(m_bufferEnd - m_bufferTop))
+            return 0;
+
+        void* const result = m_bufferTop;
+        m_bufferTop += size;
+        m_bufferAllocations++;
+        return result;
+    }
     virtual void* staticAllocate(std::size_t size) = 0;
     virtual void  collectGarbage() = 0;
 
     virtual bool  checkRoot(TObject* value, TObject** objectSlot) = 0;
+
+    // Should be called before the value is stored to the heap object slot.
+    // Inlined fast path of the checkRoot() call.
+    bool writeBarrier(TObject* value, TObject** objectSlot) {
+        const uintptr_t slot = reinterpret_cast<uintptr_t>(objectSlot);
+
+        if (slot - m_youngBase < m_youngEnd - m_youngBase)
+            return false;
+
+        if (slot - m_cardedBase < m_cardedEnd - m_cardedBase) {
+            m_cards[(slot - m_cardedBase) >> CARD_SHIFT] = CARD_DIRTY;
+            return true;
+        }
+
+        return checkRoot(value, objectSlot);
+    }
+
     virtual void  addStaticRoot(TObject** pointer) = 0;
     virtual void  removeStaticRoot(TObject** pointer) = 0;
     virtual bool  isInStaticHeap(void* location) = 0;
@@ -168,9 +291,38 @@ public:
     virtual void  registerExternalHeapPointer(object_ptr& pointer) = 0;
     virtual void  releaseExternalHeapPointer(object_ptr& pointer) = 0;
 
+    // Short living external pointers are kept in the handle stack
+    THandleStack& getHandles() { return m_handles; }
+
     virtual uint32_t allocsBeyondCollection() = 0;
     virtual TMemoryManagerInfo getStat() = 0;
 
+    // Memory managers that do not resize the heap ignore the goals
+    virtual void setSizingGoals(const THeapSizingGoals& /*goals*/) { }
+
+    // Objects of the given size and larger are not moved by the collector.
+    // Zero disables the large object space. Ignored if not supported.
+    virtual void setLargeObjectThreshold(std::size_t /*threshold*/) { }
+
+    // Objects allocated after pushRegion() are discarded by the matching
+    // popRegion() unless they are referred from outside of the region.
+    // Both return false if the memory manager does not support regions.
+    virtual bool pushRegion() { return false; }
+    virtual bool popRegion() { return false; }
+
+    // Pinned object is neither moved nor reclaimed until it is unpinned as
+    // many times as it was pinned, so its address may be handed to the system
+    // (e.g. as the buffer of the asynchronous I/O). Only the objects that are
+    // never moved by the collector may be pinned, allocateNonMoving() provides
+    // such objects. All of them fail if the memory manager does not support it.
+    virtual void* allocateNonMoving(std::size_t /*size*/, bool* collectionOccured = 0) {
+        if (collectionOccured)
+            *collectionOccured = false;
+        return 0;
+    }
+    virtual bool pinObject(TObject* /*object*/) { return false; }
+    virtual bool unpinObject(TObject* /*object*/) { return false; }
+
     virtual ~IMemoryManager() {};
 };
 
@@ -180,8 +332,8 @@ public:
 // registered in GC so it will use this pointers as roots for the
 // object traversing. GC will update the pointer data with the
 // actual object location. hptr<> helps to organize external pointers
-// by automatically calling registerExternalPointer() in constructor
-// and releaseExternalPointer() in desctructor.
+// by automatically pushing the pointer to the handle stack in constructor
+// and popping it in desctructor.
 //
 // External pointers are widely used in the VM execution code.
 // VM provide helper functions newPointer() and newObject() which
@@ -193,33 +345,50 @@ public:
     typedef O Object;
 
 protected:
-    object_ptr target;  // TODO static heap optimization && volatility
+    enum { NOT_REGISTERED = ~0u };
+
+    TObject* target;    // TODO static heap optimization && volatility
     IMemoryManager* mm; // TODO assign on copy operators
-    bool isRegistered;  // TODO Pack flag into address
+    uint32_t handle;    // Index in the handle stack
 public:
     hptr_base(Object* object, IMemoryManager* mm, bool registerPointer = true)
-    : target(object), mm(mm), isRegistered(registerPointer)
+    : target(object), mm(mm), handle(NOT_REGISTERED)
     {
-        if (mm && registerPointer) mm->registerExternalHeapPointer(target);
-            //mm->registerExternalPointer((TObject**) &target);
+        if (mm && registerPointer) handle = mm->getHandles().push(&target);
     }
 
-    hptr_base(const hptr_base<Object>& pointer) : target(pointer.target.data), mm(pointer.mm), isRegistered(true)
+    hptr_base(const hptr_base<Object>& pointer) : target(pointer.target), mm(pointer.mm), handle(NOT_REGISTERED)
     {
-        if (mm) mm->registerExternalHeapPointer(target);
+        if (mm) handle = mm->getHandles().push(&target);
     }
 
-    ~hptr_base() { if (mm && isRegistered) mm->releaseExternalHeapPointer(target); }
+    ~hptr_base() { if (handle != NOT_REGISTERED) mm->getHandles().pop(handle, &target); }
 
-    //hptr_base<Object>& operator = (hptr_base<Object>& pointer) { target = pointer.target; return *this; }
-    //hptr_base<Object>& operator = (Object* object) { target = object; return *this; }
+    // Only the pointer is copied, the slot stays registered at its place
+    hptr_base<Object>& operator = (const hptr_base<Object>& pointer) { target = pointer.target; return *this; }
 
-    Object* rawptr() const { return static_cast<Object*>(target.data); }
-    Object* operator -> () const { return static_cast<Object*>(target.data); }
+    Object* rawptr() const { return static_cast<Object*>(target); }
+    Object* operator -> () const { return static_cast<Object*>(target); }
     //Object& (operator*)() const { return *target; }
-    operator Object*() const { return static_cast<Object*>(target.data); }
+    operator Object*() const { return static_cast<Object*>(target); }
+
+    template<typename C> C* cast() const { return static_cast<C*>(target); }
+};
 
-    template<typename C> C* cast() const { return static_cast<C*>(target.data); }
+// Registers raw external pointers for the lifetime of the scope.
+// All slots pushed after the scope was created are popped on exit,
+// so hptr<> created inside of the scope should not outlive it.
+class THandleScope {
+    THandleStack& m_handles;
+    const std::size_t m_watermark;
+
+    THandleScope(const THandleScope&);
+    THandleScope& operator = (const THandleScope&);
+public:
+    explicit THandleScope(IMemoryManager* mm) : m_handles(mm->getHandles()), m_watermark(m_handles.getWatermark()) { }
+    ~THandleScope() { m_handles.popTo(m_watermark); }
+
+    template<typename T> void protect(T*& pointer) { m_handles.push(reinterpret_cast<TObject**>(&pointer)); }
 };
 
 template <typename O> class hptr : public hptr_base<O> {
@@ -228,7 +397,7 @@ public:
 public:
     hptr(Object* object, IMemoryManager* mm, bool registerPointer = true) : hptr_base<Object>(object, mm, registerPointer) {}
     hptr(const hptr<Object>& pointer) : hptr_base<Object>(pointer) { }
-    hptr<Object>& operator = (Object* object) { hptr_base<Object>::target.data = object; return *this; }
+    hptr<Object>& operator = (Object* object) { hptr_base<Object>::target = object; return *this; }
 
 //     template<typename I>
 //     Object& operator [] (I index) const { return hptr_base<Object>::target->operator[](index); }
@@ -243,9 +412,9 @@ public:
 public:
     hptr(Object* object, IMemoryManager* mm, bool registerPointer = true) : hptr_base<Object>(object, mm, registerPointer) {}
     hptr(const hptr<Object>& pointer) : hptr_base<Object>(pointer) { }
-    hptr<Object>& operator = (Object* object) { hptr_base<Object>::target.data = object; return *this; }
+    hptr<Object>& operator = (Object* object) { hptr_base<Object>::target = object; return *this; }
 
-    template<typename I> T*& operator [] (I index) const { return hptr_base<Object>::target.data->operator[](index); }
+    template<typename I> T*& operator [] (I index) const { return static_cast<Object*>(hptr_base<Object>::target)->operator[](index); }
 };
 
 // Hptr specialization for TByteObject.
@@ -258,7 +427,213 @@ public:
     hptr(Object* object, IMemoryManager* mm, bool registerPointer = true) : hptr_base<Object>(object, mm, registerPointer) {}
     hptr(const hptr<Object>& pointer) : hptr_base<Object>(pointer) { }
 
-    uint8_t& operator [] (uint32_t index) const { return static_cast<Object*>(target.data)->operator[](index); }
+    uint8_t& operator [] (uint32_t index) const { return static_cast<Object*>(target)->operator[](index); }
+};
+
+// Set of pointers implemented as the open addressing hash table with linear
+// probing. Null pointer marks the empty cell. Erased entry is filled by shifting
+// the following entries back, so lookup never has to skip deleted cells.
+// Iteration walks the cell array sequentially skipping the empty cells.
+template <typename P> class TPointerSet
+{
+    std::vector<P> m_cells;
+    std::size_t    m_size;
+    uint32_t       m_bits;
+
+    std::size_t getMask() const { return m_cells.size() - 1; }
+
+    // Fibonacci hashing. Pointers are aligned, so lower bits carry no information.
+    std::size_t getHome(P pointer) const {
+        const uint32_t key = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pointer) >> 2);
+        return (key * 2654435769u) >> (32 - m_bits);
+    }
+
+    std::size_t find(P pointer) const {
+        std::size_t index = getHome(pointer);
+        while (m_cells[index] && m_cells[index] != pointer)
+            index = (index + 1) & getMask();
+        return index;
+    }
+
+    void grow() {
+        std::vector<P> cells(m_cells.size() * 2, P());
+        cells.swap(m_cells);
+        m_bits++;
+
+        for (std::size_t index = 0; index < cells.size(); index++) {
+            if (cells[index])
+                m_cells[find(cells[index])] = cells[index];
+        }
+    }
+public:
+    TPointerSet() : m_cells(16, P()), m_size(0), m_bits(4) { }
+
+    class iterator {
+        P* m_cell;
+        P* m_end;
+        void skipEmpty() { while (m_cell != m_end && !*m_cell) ++m_cell; }
+    public:
+        iterator(P* cell, P* end) : m_cell(cell), m_end(end) { skipEmpty(); }
+        P& operator*() const { return *m_cell; }
+        iterator& operator++() { ++m_cell; skipEmpty(); return *this; }
+        bool operator==(const iterator& other) const { return m_cell == other.m_cell; }
+        bool operator!=(const iterator& other) const { return m_cell != other.m_cell; }
+    };
+
+    iterator begin() { return iterator(&m_cells[0], &m_cells[0] + m_cells.size()); }
+    iterator end() { return iterator(&m_cells[0] + m_cells.size(), &m_cells[0] + m_cells.size()); }
+    std::size_t size() const { return m_size; }
+
+    bool contains(P pointer) const { return m_cells[find(pointer)] != 0; }
+
+    // Returns false if pointer is already in the set
+    bool insert(P pointer) {
+        // Keeping the load factor below 3/4
+        if ((m_size + 1) * 4 > m_cells.size() * 3)
+            grow();
+
+        const std::size_t index = find(pointer);
+        if (m_cells[index])
+            return false;
+
+        m_cells[index] = pointer;
+        m_size++;
+        return true;
+    }
+
+    // Returns false if pointer is not in the set
+    bool erase(P pointer) {
+        std::size_t hole = find(pointer);
+        if (!m_cells[hole])
+            return false;
+
+        m_cells[hole] = P();
+        m_size--;
+
+        // Entries that may not be found across the hole are moved into it
+        for (std::size_t index = (hole + 1) & getMask(); m_cells[index]; index = (index + 1) & getMask()) {
+            const std::size_t home = getHome(m_cells[index]);
+            const bool reachable = (hole < index) ? (home > hole && home <= index) : (home > hole || home <= index);
+
+            if (!reachable) {
+                m_cells[hole]  = m_cells[index];
+                m_cells[index] = P();
+                hole = index;
+            }
+        }
+        return true;
+    }
+};
+
+// Space for the objects that are never moved by the collector. Memory for the
+// whole space is reserved at once, so the space is recognized by the address
+// range. Each object takes whole pages with the block header in front of the
+// object. Free blocks are kept sorted by address, so the neighbours merge on
+// release. Pages of the released block are given back to the system.
+//
+// Objects are reclaimed by mark-sweep: collector marks reachable objects
+// and sweep() releases the rest.
+class TLargeObjectSpace
+{
+public:
+    enum { PAGE_SIZE = 4096 };
+
+    TLargeObjectSpace() : m_base(0), m_end(0), m_usedSize(0) {}
+    ~TLargeObjectSpace();
+
+    bool initialize(std::size_t size);
+
+    // Returns zero filled memory or 0 if there is no free block large enough
+    void* allocate(std::size_t size);
+
+    bool contains(const void* object) const {
+        const uint8_t* const location = static_cast<const uint8_t*>(object);
+        return (location >= m_base) && (location < m_end);
+    }
+
+    // Returns true if the object was not marked yet. May be called concurrently.
+    bool mark(const void* object) {
+        TBlock* const block = getBlock(object);
+        return block->marked == 0 && __sync_bool_compare_and_swap(&block->marked, 0, 1);
+    }
+
+    // Releases unmarked objects and clears the marks
+    void sweep();
+
+    std::size_t getUsedSize() const { return m_usedSize; }
+    std::size_t getTotalSize() const { return m_end - m_base; }
+private:
+    struct TBlock {
+        std::size_t size;
+        volatile uint32_t marked;
+    };
+
+    static TBlock* getBlock(const void* object) {
+        return reinterpret_cast<TBlock*>(const_cast<uint8_t*>(static_cast<const uint8_t*>(object)) - sizeof(TBlock));
+    }
+
+    void release(TBlock* block);
+
+    uint8_t* m_base;
+    uint8_t* m_end;
+    std::size_t m_usedSize;
+
+    typedef std::map<uint8_t*, std::size_t> TFreeBlocks;
+    TFreeBlocks m_freeBlocks;
+    std::vector<TBlock*> m_blocks;
+};
+
+// Heap sizing policy of the copying collectors. Policy is consulted after each
+// collection and chooses the heap size for the next one.
+//
+// Without the GC time goal the heap grows by half when less than a sixteenth
+// of it is left free and shrinks by half when it stays less than an eighth
+// occupied for SHRINK_COLLECTIONS collections in a row.
+//
+// With the GC time goal free space of the heap is made large enough to hold
+// the objects allocated at the measured rate during the interval for which
+// the last pause takes the given percent of the time. So the heap grows when
+// collections take too long and shrinks when they are cheap. Pause of the
+// copying collector depends on the live objects rather than on the heap size,
+// so the pause goal just prevents the growth while pauses exceed it.
+//
+// Heap size changes at most twice per collection, changes less than an
+// eighth are ignored. Live objects and the pending allocation always fit.
+class THeapSizingPolicy
+{
+public:
+    enum { SHRINK_COLLECTIONS = 8 };
+
+    // Measurements of the collection, times are in microseconds
+    struct TSample {
+        std::size_t heapSize;
+        std::size_t usedBefore;
+        std::size_t usedAfter;
+        std::size_t requestedSize;
+        double      pause;
+        double      mutatorTime;
+        TSample() : heapSize(0), usedBefore(0), usedAfter(0), requestedSize(0), pause(0), mutatorTime(0) {}
+    };
+
+    THeapSizingPolicy() : m_goals(), m_minHeapSize(0), m_maxHeapSize(0), m_sparseCollections(0), m_lastUsed(0) {}
+
+    void setGoals(const THeapSizingGoals& goals) { m_goals = goals; }
+    const THeapSizingGoals& getGoals() const { return m_goals; }
+
+    void setLimits(std::size_t minHeapSize, std::size_t maxHeapSize) {
+        m_minHeapSize = minHeapSize;
+        m_maxHeapSize = maxHeapSize;
+    }
+
+    // Returns the heap size for the next collection
+    std::size_t getNextHeapSize(const TSample& sample);
+private:
+    THeapSizingGoals m_goals;
+    std::size_t m_minHeapSize;
+    std::size_t m_maxHeapSize;
+    uint32_t    m_sparseCollections;
+    // Heap occupation after the previous collection
+    std::size_t m_lastUsed;
 };
 
 // Simple memory manager implementing classic baker two space algorithm.
@@ -273,17 +648,47 @@ public:
 // All objects that were not moved during the collection are said to be disposed,
 // so thier space may be reused by newly allocated ones.
 //
+// Both heaps are reserved for the maximal heap size. Heap in use occupies the
+// upper part of the reservation, so the heap is resized by moving its base when
+// objects are moved to the other heap. Size of the heap for the next collection
+// is chosen by the THeapSizingPolicy. Inactive heap is reset after the
+// collection, so its memory is given back to the system.
+//
+// Each allocate() that does not fit in the allocation buffer retires it and
+// fills a new one below the allocated object. Small objects are then placed
+// into the buffer by the inlined allocateInBuffer() without a virtual call.
+//
+// Objects larger than the threshold are allocated in the TLargeObjectSpace.
+// Collector does not move them. Reached large objects are marked and pushed
+// to the stack, so their fields are processed after the roots. Unmarked ones
+// are swept when the collection is over. Large objects may be pinned, since
+// they stay in place anyway; pinned ones are kept alive as the static roots.
 class BakerMemoryManager : public IMemoryManager
 {
 protected:
+    enum { DEFAULT_LARGE_OBJECT_THRESHOLD = 64 * 1024 };
+
     TMemoryManagerInfo m_memoryInfo;
     std::size_t m_heapSize;
     std::size_t m_maxHeapSize;
+    std::size_t m_initialHeapSize;
+    // Heap size to be set on the next collection
+    std::size_t m_targetHeapSize;
 
+    THeapSizingPolicy m_sizingPolicy;
+    // Size of the allocation that caused the collection
+    std::size_t m_pendingAllocation;
+    TDuration<TSec> m_lastCollectionEnd;
+
+    // Size of the memory reserved for each heap
+    std::size_t m_reservedSize;
     uint8_t*  m_heapOne;
     uint8_t*  m_heapTwo;
     bool      m_activeHeapOne;
 
+    uint8_t* getHeapBase(uint8_t* heap, std::size_t heapSize) const { return heap + m_reservedSize - heapSize / 2; }
+    uint8_t* getHeapEnd(uint8_t* heap) const { return heap + m_reservedSize; }
+
     uint8_t*  m_inactiveHeapBase;
     uint8_t*  m_inactiveHeapPointer;
     uint8_t*  m_activeHeapBase;
@@ -310,18 +715,56 @@ protected:
         TMovableObject(uint32_t dataSize, bool isBinary = false) : size(dataSize, isBinary) { }
     };
 
-    /*virtual*/ TMovableObject* moveObject(TMovableObject* object);
+    virtual TMovableObject* moveObject(TMovableObject* object);
     virtual void moveObjects();
     virtual void growHeap(uint32_t requestedSize);
 
+    // Size of the object in the heap including its identity hash slot
+    static std::size_t getSlotSize(const TMovableObject* object);
+    // Hashed object gets the identity hash slot when it is moved
+    static std::size_t getCopySize(const TMovableObject* object);
+    // Copies the object to the getCopySize() bytes at the location
+    static TMovableObject* copyObjectTo(uint8_t* location, const TMovableObject* object);
+    // Takes the count of the objects hashed since the previous call
+    static std::size_t takeHashedObjects();
+    // Space for the copy is taken from the top of the new space
+    uint8_t* reserveCopySpace(std::size_t copySize);
+    // Space of the new heap that may be left unused by the copying
+    virtual std::size_t getCopyOverhead() const { return 0; }
+    static void copyIdentityHash(TMovableObject* copy, const TMovableObject* object);
+
+    std::size_t m_largeObjectThreshold;
+    TLargeObjectSpace m_largeObjects;
+    std::vector<TMovableObject*> m_largeObjectStack;
+
+    void* allocateLarge(std::size_t requestedSize, bool* gcOccured);
+
+    // Buffer is the part of the active heap that was allocated last
+    void  fillBuffer(uint8_t* base, std::size_t size);
+    void* allocateFromBuffer(std::size_t requestedSize);
+    virtual void refillBuffer();
+    virtual void retireBuffer();
+
+    void markLargeObject(TMovableObject* object) {
+        if (m_largeObjects.contains(object) && m_largeObjects.mark(object))
+            m_largeObjectStack.push_back(object);
+    }
+
+    // Moves objects referred by the marked large objects
+    void scanLargeObjects();
+
+    // Steps of the collection shared by the collectors
+    std::size_t getNewHeapSize(std::size_t usedSize) const;
+    void swapSpaces(std::size_t newHeapSize);
+    void releaseInactiveSpace(std::size_t newHeapSize);
+    void updateTargetHeapSize(TMemoryManagerEvent& event);
+
     // These variables contain an array of pointers to objects from the
     // static heap to the dynamic one. Ihey are used during the GC
     // as a root for pointer iteration.
 
-    // FIXME Temporary solution before GC will prove it's working
-    //       Think about better memory organization
-    typedef std::list<TMovableObject**> TStaticRoots;
-    typedef std::list<TMovableObject**>::iterator TStaticRootsIterator;
+    typedef TPointerSet<TMovableObject**> TStaticRoots;
+    typedef TStaticRoots::iterator TStaticRootsIterator;
     TStaticRoots m_staticRoots;
 
     // External pointers are typically managed by hptr<> template.
@@ -331,6 +774,16 @@ protected:
     // pointers so they will point to correct location even after
     // garbage collection.
     object_ptr* m_externalPointersHead;
+
+    // Slot of every pinned object is registered as a static root, so the
+    // object is kept alive. Nodes of the map are never moved.
+    struct TPin {
+        TObject* object;
+        uint32_t count;
+        TPin() : object(0), count(0) { }
+    };
+    typedef std::map<TObject*, TPin> TPins;
+    TPins m_pins;
 public:
     BakerMemoryManager();
     virtual ~BakerMemoryManager();
@@ -355,34 +808,373 @@ public:
     virtual uint32_t allocsBeyondCollection() { return m_memoryInfo.allocationsCount; }
 
     virtual TMemoryManagerInfo getStat();
+
+    virtual void setSizingGoals(const THeapSizingGoals& goals) { m_sizingPolicy.setGoals(goals); }
+    virtual void setLargeObjectThreshold(std::size_t threshold) { m_largeObjectThreshold = threshold; }
+
+    // Objects of the large object space and of the static heap may be pinned
+    virtual void* allocateNonMoving(std::size_t requestedSize, bool* gcOccured = 0);
+    virtual bool  pinObject(TObject* object);
+    virtual bool  unpinObject(TObject* object);
+};
+
+// Copying collector that uses the Cheney algorithm instead of the pointer
+// reversal. Objects are copied to the bottom of the new space in the breadth
+// first order. Copied objects are then scanned one by one from the bottom
+// and the objects they refer to are copied after them. Collection completes
+// when the scan pointer reaches the last copied object.
+//
+// Original object is not altered except for the first pointer slot which holds
+// the forwarding address. Each object is touched only once and the scan
+// order is linear, so the fields of the objects ahead may be prefetched.
+//
+// When the collection is done, active heap base is set right above the
+// copied objects, so new objects are allocated downwards just as in the
+// BakerMemoryManager.
+class CheneyMemoryManager : public BakerMemoryManager
+{
+protected:
+    uint8_t* m_scanPointer;
+    uint8_t* m_copyPointer;
+
+    // Copies the object to the new space without processing its fields
+    virtual TMovableObject* moveObject(TMovableObject* object);
+    virtual void moveObjects();
+
+    bool isInOldSpace(TMovableObject* object) const {
+        const uint8_t* const location = reinterpret_cast<const uint8_t*>(object);
+        return (location >= m_inactiveHeapBase) && (location < m_inactiveHeapBase + m_heapSize / 2);
+    }
+public:
+    CheneyMemoryManager() : BakerMemoryManager(), m_scanPointer(0), m_copyPointer(0) { }
+    virtual ~CheneyMemoryManager() { }
+};
+
+// Parallel version of the CheneyMemoryManager. Collection is performed by
+// the pool of worker threads; the thread that triggered the collection works
+// as the first one. Root slots are split between the workers evenly.
+//
+// Every worker copies objects into its own allocation buffer that is taken
+// from the new space in chunks, so threads do not contend on every copy.
+// Object is copied speculatively and then the forwarding pointer is installed
+// into the class slot of the original with compare-and-swap. The loser of the
+// race gives its copy back and uses the winner's one.
+//
+// Copied objects are pushed to the deque of the worker that copied them.
+// Owner takes objects for scanning from the back of its deque, idle workers
+// steal them from the front of the others' deques. Collection is finished
+// when all workers are idle and have nothing to steal.
+class ParallelMemoryManager : public CheneyMemoryManager
+{
+protected:
+    enum { BUFFER_SIZE = 32 * 1024 };
+
+    struct TWorker {
+        ParallelMemoryManager* manager;
+        uint32_t  index;
+        pthread_t thread;
+
+        pthread_mutex_t dequeLock;
+        std::deque<TMovableObject*> deque;
+
+        // Allocation buffer in the new space
+        uint8_t* bufferPointer;
+        uint8_t* bufferEnd;
+
+        TWorker(ParallelMemoryManager* manager, uint32_t index);
+        ~TWorker();
+
+        void push(TMovableObject* object);
+        TMovableObject* pop();
+        TMovableObject* steal();
+        bool isEmpty();
+    };
+
+    uint32_t m_threadsCount;
+    std::vector<TWorker*> m_workers;
+
+    // Root slots of the current collection
+    std::vector<TMovableObject**> m_rootSlots;
+    volatile uint32_t m_idleWorkers;
+
+    pthread_mutex_t m_poolLock;
+    pthread_cond_t  m_startCondition;
+    pthread_cond_t  m_finishCondition;
+    uint32_t m_collectionEpoch;
+    uint32_t m_finishedWorkers;
+    bool     m_shutdown;
+
+    virtual void moveObjects();
+    // Tails of the worker buffers are left unused
+    virtual std::size_t getCopyOverhead() const { return m_threadsCount * BUFFER_SIZE; }
+
+    void startWorkers();
+    static void* workerThread(void* argument);
+    void collect(TWorker& worker);
+
+    TMovableObject* copyObject(TWorker& worker, TMovableObject* object);
+    void scanObject(TWorker& worker, TMovableObject* object);
+    TMovableObject* findWork(TWorker& worker);
+    uint8_t* allocateCopy(TWorker& worker, std::size_t size);
+public:
+    // threadsCount = 0 means the number of online processors
+    explicit ParallelMemoryManager(uint32_t threadsCount = 0);
+    virtual ~ParallelMemoryManager();
 };
 
+// Incremental version of the CheneyMemoryManager. When the active space is
+// exhausted, the spaces are swapped and only the objects referred by the roots
+// are copied. The rest of the work is done in slices after every SLICE_SIZE
+// bytes allocated. Slice takes no longer than the pause target, but it scans
+// enough objects to finish before the allocations reach the copied objects.
+// New objects are allocated downwards from the top of the space and
+// refer only to the copied objects, so they are never scanned.
+//
+// Mutator should never see pointers to the old space. Pages of the copied
+// objects that were not scanned yet are protected, so the first access to such
+// a page traps. The fault handler scans all objects on the page and opens it.
+// So the check is done by the hardware instead of the barrier on every load.
+// Page table holds the first object of every page. Page that still receives
+// copies is padded up to its end by the filler object before it is opened.
+// Fault handler touches only the plain memory of the tables and the objects
+// and calls mprotect(), faults that are not caused by the barrier are passed
+// to the previously installed handler.
+//
+// If the allocations reach the copied objects before the scan is finished,
+// the rest of the work is done at once. Every pause is accounted in the stats.
+// Large objects are copied as the others.
+class IncrementalMemoryManager : public CheneyMemoryManager
+{
+protected:
+    enum { PAGE_SHIFT = 12, PAGE_SIZE = 1 << PAGE_SHIFT };
+    enum { SLICE_SIZE = 32 * 1024 };
+    enum { DEFAULT_PAUSE_TARGET = 1000 };
+    enum { PAGE_UNSCANNED = 0, PAGE_OPEN, PAGE_SCANNED };
+
+    bool        m_collecting;
+    bool        m_inCollector;
+    uint32_t    m_pauseTarget;
+    std::size_t m_newHeapSize;
+    std::size_t m_usedBeforeCollect;
+    std::size_t m_allocatedSinceSlice;
+
+    // Pages of the active heap reservation. Tables are allocated once,
+    // fault handler accesses them only through the plain pointers.
+    uint8_t*  m_pagesBase;
+    std::vector<uint8_t>  m_pageTable;
+    std::vector<uint8_t*> m_firstObjectTable;
+    std::vector<uint32_t> m_openPageTable;
+    uint8_t*  m_pageStates;
+    uint8_t** m_firstObjects;
+    uint32_t* m_openPages;
+    uint32_t  m_openPagesCount;
+    // Pages below are protected unless scanned or opened
+    uint32_t  m_protectedPages;
+    // Pages below are scanned by the slices
+    uint32_t  m_scannedPages;
+    // Copies never reach this address, so the allocations stop here
+    uint8_t*  m_copyLimit;
+    std::size_t m_fillerSize;
+    std::size_t m_fillerLimit;
+
+    // Pauses of the current collection in microseconds
+    TDuration<TSec> m_collectionBegin;
+    double    m_collectionPauses;
+    double    m_collectionLongestPause;
+    double    m_pauseBegin;
+
+    static IncrementalMemoryManager* s_activeManager;
+    static struct sigaction s_previousAction;
+    static void faultHandler(int signal, siginfo_t* info, void* context);
+
+    virtual TMovableObject* moveObject(TMovableObject* object);
+
+    uint32_t getPage(const uint8_t* location) const { return (location - m_pagesBase) >> PAGE_SHIFT; }
+    uint8_t* getPageBase(uint32_t page) const { return m_pagesBase + (static_cast<std::size_t>(page) << PAGE_SHIFT); }
+    static std::size_t getFillerLimit(std::size_t usedSize);
+
+    void startCollection();
+    void finishCollection();
+    void completeCollection();
+    void runSlice();
+    bool scanSlice(std::size_t workSize, double deadline);
+    void scanObject(TMovableObject* object);
+    bool handleFault(uint8_t* location);
+    bool padCopyPage();
+    void recordObject(uint8_t* location, std::size_t size);
+
+    void openRange(uint8_t* begin, uint8_t* end);
+    void markScanned(uint32_t page);
+    void protectPages();
+    void openProtectedPages();
+
+    void beginPause();
+    void endPause();
+    double getTime() const { return m_memoryInfo.timer.get<TMicrosec>().toDouble(); }
+public:
+    IncrementalMemoryManager();
+    virtual ~IncrementalMemoryManager();
+
+    virtual bool  initializeHeap(std::size_t heapSize, std::size_t maxHeapSize = 0);
+    virtual void* allocate(std::size_t requestedSize, bool* gcOccured = 0);
+    virtual void  collectGarbage();
+
+    virtual void setSizingGoals(const THeapSizingGoals& goals);
+    virtual void setLargeObjectThreshold(std::size_t /*threshold*/) { }
+};
+
+// Generational memory manager. New objects are allocated in the nursery.
+// Young collection (left to right) copies live young objects to one of the two
+// survivor spaces. Every survived collection increments the object's age that
+// is kept in the TSize. Objects reaching the tenuring age, as well as objects that
+// do not fit into the survivor space, are promoted to the old space.
+//
+// Roots of the young collection are the static roots, external pointers,
+// dirty cards of the old space and the remembered objects. Write barrier marks
+// the card of every old slot being written. Crossing map holds the offset of the
+// object that covers the start of the card, so objects of the dirty card may be
+// found without walking the whole old space. VM writes to contexts and to their
+// argument, temporary and stack arrays without the write barrier, so all old
+// contexts and their arrays are remembered as a whole and scanned on every
+// young collection.
+//
+// Young collection is performed only if the old space is able to hold all young
+// objects. Otherwise full collection (right to left) takes place. It marks live
+// objects in side bitmaps, slides live old objects towards the base of the old
+// space (LISP2 style) and then promotes all young objects. Long-lived data is
+// not copied to another space, so the old space is reserved once and grows in
+// place when live objects take more than a half of it. Objects that are too
+// large for the nursery are allocated directly in the old space. Compaction
+// moves every heap object, so only the static ones may be pinned.
 class GenerationalMemoryManager : public BakerMemoryManager
 {
 protected:
+    enum { DEFAULT_TENURING_AGE = 3 };
+
+    // Contiguous memory area filled from the bottom
+    struct TSpace {
+        uint8_t*    base;
+        uint8_t*    top;
+        std::size_t size;
+
+        TSpace() : base(0), top(0), size(0) { }
+        void assign(uint8_t* spaceBase, std::size_t spaceSize) { base = spaceBase; top = spaceBase; size = spaceSize; }
+        bool contains(const void* location) const { return (location >= base) && (location < base + size); }
+        std::size_t getUsed() const { return top - base; }
+        std::size_t getFree() const { return base + size - top; }
+    };
+
+    TSpace   m_nursery;
+    TSpace   m_survivors[2];
+    uint32_t m_activeSurvivor;
+    TSpace   m_oldSpace;
+
+    std::size_t m_nurserySize;
+    std::size_t m_oldSpaceReserved;
+    uint32_t    m_tenuringAge;
+    // Bound on the count of the hashed objects without the hash slot
+    std::size_t m_unslottedHashes;
+
+    // Cards of the old space that may refer to young objects
+    std::vector<uint8_t>  m_cardTable;
+    // Offset of the object covering the start of the card
+    std::vector<uint32_t> m_crossingMap;
+    // Old objects that are scanned entirely
+    std::vector<TMovableObject*> m_rememberedObjects;
+
+    // One bit per word marks the start of a live object. Rank of the
+    // object is the number of live objects below it in the same space.
+    struct TMarkBitmap {
+        uint8_t* base;
+        std::vector<uint32_t> bits;
+        std::vector<uint32_t> ranks;
+
+        TMarkBitmap() : base(0), bits(), ranks() { }
+        void reset(uint8_t* spaceBase, std::size_t size);
+        bool mark(const void* object);
+        bool isMarked(const void* object) const;
+        void computeRanks();
+        uint32_t getRank(const void* object) const;
+    };
+
+    // Phase of the full collection that defines what moveObject() does
+    enum TCollectionPhase {
+        PHASE_COPY,   // young objects are copied
+        PHASE_MARK,   // objects are marked and pushed to the mark stack
+        PHASE_UPDATE  // old objects are replaced by their new addresses
+    };
+
+    TMarkBitmap m_oldMarks;
+    TMarkBitmap m_youngMarks;
+    std::vector<TMovableObject*> m_markStack;
+    // New addresses of live old objects indexed by their rank
+    std::vector<uint8_t*> m_forwards;
+
+    // Collection state. Young collection copies objects to the survivor
+    // space and promotes them to the old space. Full collection compacts
+    // the old space and then promotes all young objects.
+    TCollectionPhase m_phase;
+    TSpace*   m_survivorSpace;
+    TSpace*   m_promotionSpace;
+    uint8_t*  m_survivorScan;
+    uint8_t*  m_promotionScan;
+
     uint32_t m_leftToRightCollections;
     uint32_t m_rightToLeftCollections;
-    uint32_t m_rightCollectionDelay;
-
-    void collectLeftToRight(bool fullCollect = false);
-    void collectRightToLeft();
+    uint64_t m_rightCollectionDelay;
+
+    virtual TMovableObject* moveObject(TMovableObject* object);
+
+    void collectLeftToRight();
+    void collectRightToLeft(std::size_t requestedSize = 0);
+    void evacuateYoungObjects();
+    void markLiveObjects();
+    void markObject(TMovableObject* object);
+    void computeForwards();
+    TMovableObject* getForward(TMovableObject* object) const;
+    void updateFields(TMovableObject* object, TMovableObject* newAddress);
+    void updatePointers();
+    // Returns the count of the hashed objects left without the hash slot
+    std::size_t compactOldSpace();
+    void growOldSpace(std::size_t requiredSize);
+    // Size of the young objects with the hash slots they may get when copied
+    std::size_t getYoungCopySize();
     bool checkThreshold();
-    void moveYoungObjects();
 
-    bool isInYoungHeap(void* location);
-    void addCrossgenReference(TObject** pointer);
-    void removeCrossgenReference(TObject** pointer);
-
-    typedef std::list<TMovableObject**> TPointerList;
-    typedef std::list<TMovableObject**>::iterator TPointerIterator;
-    TPointerList m_crossGenerationalReferences;
+    TMovableObject* copyTo(TSpace& space, TMovableObject* object);
+    void scanObject(TMovableObject* object, bool isPromoted);
+    void scanContextArrays(TMovableObject* context);
+    void scanCopiedObjects();
+    void remember(TMovableObject* object);
+    void markCard(void* slot);
+    void scanDirtyCards(uint8_t* scanLimit);
+    void updateCrossingMap(const TSpace& space, uint8_t* object, std::size_t size);
+    void resetCardTable();
+    void* allocateOld(std::size_t requestedSize, bool* gcOccured);
+    void resetYoungSpaces();
+    virtual void refillBuffer();
+    virtual void retireBuffer();
+
+    std::size_t getUsedSize() const;
+    std::size_t getTotalSize() const;
+    void beginEvent(TMemoryManagerEvent& event);
+    void endEvent(TMemoryManagerEvent& event);
+
+    static bool initializeSpace(TSpace& space, std::size_t size);
+    static bool isContext(TMovableObject* object);
+
+    bool isInYoungHeap(const void* location) const {
+        return m_nursery.contains(location) || m_survivors[m_activeSurvivor].contains(location);
+    }
 public:
-    GenerationalMemoryManager() : BakerMemoryManager(),
-        m_leftToRightCollections(0), m_rightToLeftCollections(0), m_rightCollectionDelay(0) { }
+    // nurserySize = 0 means the quarter of the heap size
+    explicit GenerationalMemoryManager(std::size_t nurserySize = 0, uint32_t tenuringAge = DEFAULT_TENURING_AGE);
     virtual ~GenerationalMemoryManager();
 
-    virtual bool checkRoot(TObject* value, TObject** objectSlot);
-    virtual void collectGarbage();
+    virtual bool  initializeHeap(std::size_t heapSize, std::size_t maxHeapSize = 0);
+    virtual void* allocate(std::size_t requestedSize, bool* gcOccured = 0);
+    virtual bool  checkRoot(TObject* value, TObject** objectSlot);
+    virtual void  collectGarbage();
     virtual TMemoryManagerInfo getStat();
 };
 
@@ -398,6 +1190,9 @@ protected:
 
     std::vector<void*> m_usedHeaps;
 
+    // Objects are never moved, so pinning only counts
+    std::map<TObject*, uint32_t> m_pinCounts;
+
     size_t    m_staticHeapSize;
     uint8_t*  m_staticHeapBase;
     uint8_t*  m_staticHeapPointer;
@@ -423,6 +1218,85 @@ public:
     virtual bool  checkRoot(TObject* /*value*/, TObject** /*objectSlot*/) { return false; }
     virtual uint32_t allocsBeyondCollection() { return 0; }
     virtual TMemoryManagerInfo getStat();
+
+    virtual void* allocateNonMoving(size_t requestedSize, bool* gcOccured = 0) { return allocate(requestedSize, gcOccured); }
+    virtual bool  pinObject(TObject* object);
+    virtual bool  unpinObject(TObject* object);
+};
+
+// Region memory manager is the non collecting one with the stack of regions.
+// Objects are allocated by bumping the pointer in a single reservation, so
+// the region is the part of the heap above the pointer saved when it was
+// pushed. Popping the region discards all of its objects by moving the
+// pointer back. Regions may be nested.
+//
+// Objects of the region that are referred from outside are promoted to the
+// parent region on pop. Older slots written with the region objects are
+// caught by the write barrier and kept in the remembered list of the region.
+// VM writes to contexts and to their arrays without the write barrier, so
+// contexts outside of the region that are reached from the roots are scanned
+// entirely. Promoted objects are copied to the scratch space and then back
+// to the base of the popped region, so the parent stays contiguous.
+class RegionMemoryManager : public NonCollectMemoryManager
+{
+protected:
+    enum { MIN_REMEMBERED_LIMIT = 1024 };
+
+    struct TRegion {
+        uint8_t* base;
+        // Older slots that may refer to the objects of the region
+        std::vector<TObject**> rememberedSlots;
+        // Duplicates are removed when the list grows to the limit
+        std::size_t rememberedLimit;
+
+        TRegion(uint8_t* regionBase) : base(regionBase), rememberedSlots(), rememberedLimit(MIN_REMEMBERED_LIMIT) { }
+    };
+
+    // Same as BakerMemoryManager::TMovableObject
+    struct TMovableObject {
+        TSize size;
+        TMovableObject* data[0];
+    };
+
+    std::size_t m_reservedSize;
+    uint8_t*    m_base;
+    uint8_t*    m_top;
+    std::vector<TRegion> m_regions;
+    object_ptr* m_externalPointersHead;
+
+    // Promotion state of the region being popped
+    uint8_t* m_popBase;
+    uint8_t* m_popTop;
+    uint8_t* m_scratchBase;
+    uint8_t* m_scratchTop;
+    std::vector<TObject*> m_contextStack;
+    std::set<TObject*>    m_scannedContexts;
+
+    TObject* promoteObject(TObject* object);
+    void promoteSlot(TObject** slot);
+    void scanPromotedObjects();
+    void scanOutsideContext(TObject* context);
+    void remember(TRegion& region, TObject** slot);
+    void updateYoungRange();
+
+    static bool isContext(TObject* object);
+public:
+    RegionMemoryManager();
+    virtual ~RegionMemoryManager();
+
+    virtual bool  initializeHeap(size_t heapSize, size_t maxHeapSize = 0);
+    virtual void* allocate(size_t requestedSize, bool* gcOccured = 0);
+    virtual bool  checkRoot(TObject* value, TObject** objectSlot);
+
+    virtual void  registerExternalHeapPointer(object_ptr& pointer);
+    virtual void  releaseExternalHeapPointer(object_ptr& pointer);
+
+    virtual bool  pushRegion();
+    virtual bool  popRegion();
+
+    // Objects of the regions are moved when promoted, so they may not be pinned
+    virtual void* allocateNonMoving(size_t requestedSize, bool* gcOccured = 0);
+    virtual bool  pinObject(TObject* object);
 };
 
 class LLVMMemoryManager : public BakerMemoryManager {
@@ -472,6 +1346,9 @@ private:
     template<typename ResultType>
     ResultType* readObject() { return static_cast<ResultType*>(readObject()); }
 
+    // Looks up the symbol in the Symbol class' symbol table
+    TSymbol* findSymbol(const char* name) const;
+
     IMemoryManager* m_memoryManager;
 public:
     Image(IMemoryManager* manager)
@@ -499,7 +1376,7 @@ struct TGlobals {
     TClass*  stringClass;
     TDictionary* globalsObject;
     TMethod* initialMethod;
-    TObject* binaryMessages[3];
+    TObject* binaryMessages[binaryBuiltIns::operatorsCount];
     TClass*  integerClass;
     TSymbol* badMethodSymbol;
 };
@@ -67,8 +67,33 @@ namespace binaryBuiltIns {
 enum Operator {
     operatorLess  = 0,
     operatorLessOrEq,
-    operatorPlus
+    operatorPlus,
+    operatorMinus,
+    operatorMultiply,
+    operatorEqual,
+    operatorNotEqual,
+    operatorGreater,
+    operatorGreaterOrEq,
+    operatorIdentical,
+    operatorIntegerDivide,
+    operatorModulo,
+    operatorBitAnd,
+    operatorBitOr,
+    operatorBitShift,
+
+    operatorsCount
 };
+
+// Selectors of the first operators are stored in the image.
+// The rest are looked up in the symbol table when image is loaded.
+enum { imageOperatorsCount = operatorPlus + 1 };
+
+inline const char* getOperatorName(Operator operation) {
+    static const char* const names[operatorsCount] = {
+        "<", "<=", "+", "-", "*", "=", "~=", ">", ">=", "==", "//", "\\\\", "bitAnd:", "bitOr:", "bitShift:"
+    };
+    return (operation < operatorsCount) ? names[operation] : 0;
+}
 }
 
 namespace special
@@ -111,6 +136,12 @@ enum {
     integerNew        = 32,
     flushCache        = 34,
     bulkReplace       = 38,
+    identityHash      = 41,
+    pushRegion        = 42,
+    popRegion         = 43,
+    allocatePinnedByteArray = 44,
+    pinObject         = 45,
+    unpinObject       = 46,
     LLVMsendMessage   = 252,
     getSystemTicks    = 253
 };
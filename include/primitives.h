@@ -37,8 +37,15 @@
 
 #include <types.h>
 
-TObject* callPrimitive(uint8_t opcode, TObjectArray* arguments, bool& primitiveFailed);
+// Primitives take their arguments by pointer to the first one. Arity is
+// defined by the primitive itself. This allows the VM to pass the arguments
+// right from the stack of the context, so primitive call allocates nothing.
+// Primitives called this way do not allocate either, so the pointer stays valid.
+TObject* callPrimitive(uint8_t opcode, TObject** arguments, bool& primitiveFailed);
 TObject* callSmallIntPrimitive(uint8_t opcode, int32_t leftOperand, int32_t rightOperand, bool& primitiveFailed);
-TObject* callIOPrimitive(uint8_t opcode, TObjectArray& args, bool& primitiveFailed);
+TObject* callIOPrimitive(uint8_t opcode, TObject** arguments, bool& primitiveFailed);
+
+// Same as above, with the arguments packed into the array (used by the JIT)
+TObject* callPrimitive(uint8_t opcode, TObjectArray* arguments, bool& primitiveFailed);
 
 #endif
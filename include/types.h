@@ -41,6 +41,7 @@
 #include <string>
 #include <sstream>
 #include <typeinfo>
+#include <cassert>
 
 struct TClass;
 struct TObject;
@@ -52,10 +53,27 @@ struct TMethod;
 inline std::size_t correctPadding(std::size_t size) { return (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1); }
 //inline size_t correctPadding(size_t size) { return (size + 3) & ~3; }
 
+// Identity hash of the object that was never moved. Pointers are aligned,
+// so lower bits are dropped. Result fits into the SmallInteger.
+inline uint32_t getAddressHash(const void* address)
+{
+    const uint32_t key = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(address) >> 2);
+    return (key * 2654435769u) >> 2;
+}
+
+// Objects hashed since the memory manager took the count last time. Copy
+// of the object hashed at its address takes one more slot, so collectors
+// reserve the space for them.
+extern uint32_t hashedObjectsCount;
+
 // VM handles the special case when object pointer has lowest bit set to 1
 // In that case pointer is treated as explicit 31 bit integer equal to (value >> 1)
 inline bool isSmallInteger(const TObject* value) { return reinterpret_cast<int32_t>(value) & 1; }
 
+// SmallInteger holds 31 bit signed value. This function checks
+// whether the result of an arithmetic operation still fits into it.
+inline bool isSmallIntegerValue(int64_t value) { return value >= -0x40000000LL && value <= 0x3FFFFFFFLL; }
+
 // This is a special interpretation of Smalltalk's SmallInteger
 // The struct is binary compatible with the TObject*
 struct TInteger {
@@ -80,30 +98,76 @@ protected:
 // Helper struct used to hold object size and special
 // status flags packed in a 4 bytes space. TSize is used
 // in the TObject hierarchy and in the TMovableObject in GC
+//
+// Two lowest bits hold the relocated and binary flags.
+// Next 24 bits hold the size. Upper six bits are reserved
+// for status flags that are kept intact when size changes.
 struct TSize {
 private:
     // Raw value holder. Do not edit this value directly
     uint32_t data;
 
-    static const int FLAG_RELOCATED = 1;
-    static const int FLAG_BINARY    = 2;
-    static const int FLAGS_MASK     = FLAG_RELOCATED | FLAG_BINARY;
+    static const uint32_t FLAG_RELOCATED = 1;
+    static const uint32_t FLAG_BINARY    = 2;
+    static const uint32_t FLAGS_MASK     = FLAG_RELOCATED | FLAG_BINARY;
+
+    static const uint32_t SIZE_SHIFT     = 2;
+    static const uint32_t SIZE_MASK      = 0x00FFFFFF;
+
+    // Set on contexts that may be referenced after they return
+    static const uint32_t FLAG_ESCAPED   = 1u << 26;
+
+    // Generational GC: number of survived young collections
+    // and the flag of old objects scanned by every young collection
+    static const uint32_t AGE_SHIFT      = 27;
+    static const uint32_t AGE_MASK       = 3;
+    static const uint32_t FLAG_REMEMBERED = 1u << 30;
+
+    // Identity hash was taken from the address of the object,
+    // and the slot holding it was appended when the object was moved
+    static const uint32_t FLAG_HASHED    = 1u << 29;
+    static const uint32_t FLAG_HASH_SLOT = 1u << 31;
+    static const uint32_t HIGH_FLAGS_MASK = ~((SIZE_MASK << SIZE_SHIFT) | FLAGS_MASK);
 public:
+    // Allocations of larger objects should fail before the header is built
+    static const uint32_t MAX_SIZE = SIZE_MASK;
+
     TSize(uint32_t size, bool binary = false, bool relocated = false)
     {
-        data  = (size << 2);
+        assert(size <= MAX_SIZE);
+        data  = (size & SIZE_MASK) << SIZE_SHIFT;
         data |= binary    ? FLAG_BINARY : 0;
         data |= relocated ? FLAG_RELOCATED : 0;
     }
 
     TSize(const TSize& size) : data(size.data) { }
 
-    uint32_t getSize() const { return data >> 2; }
-    uint32_t setSize(uint32_t size) { return data = (data & 3) | (size << 2); }
+    uint32_t getSize() const { return (data >> SIZE_SHIFT) & SIZE_MASK; }
+    uint32_t setSize(uint32_t size) { assert(size <= MAX_SIZE); return data = (data & ~(SIZE_MASK << SIZE_SHIFT)) | ((size & SIZE_MASK) << SIZE_SHIFT); }
     bool isBinary() const { return data & FLAG_BINARY; }
     bool isRelocated() const { return data & FLAG_RELOCATED; }
     void setBinary() { data |= FLAG_BINARY; }
     void setRelocated() { data |= FLAG_RELOCATED; }
+
+    bool isEscaped() const { return data & FLAG_ESCAPED; }
+    void setEscaped() { data |= FLAG_ESCAPED; }
+    void clearEscaped() { data &= ~FLAG_ESCAPED; }
+
+    enum { MAX_AGE = AGE_MASK };
+    uint32_t getAge() const { return (data >> AGE_SHIFT) & AGE_MASK; }
+    void setAge(uint32_t age) { data = (data & ~(AGE_MASK << AGE_SHIFT)) | ((age & AGE_MASK) << AGE_SHIFT); }
+
+    bool isRemembered() const { return data & FLAG_REMEMBERED; }
+    void setRemembered() { data |= FLAG_REMEMBERED; }
+    void clearRemembered() { data &= ~FLAG_REMEMBERED; }
+
+    bool isHashed() const { return data & FLAG_HASHED; }
+    void setHashed() { data |= FLAG_HASHED; }
+    bool hasHashSlot() const { return data & FLAG_HASH_SLOT; }
+    void setHashSlot() { data |= FLAG_HASH_SLOT; }
+
+    // Upper status flags should survive object relocation
+    void copyHighFlags(const TSize& source) { data = (data & ~HIGH_FLAGS_MASK) | (source.data & HIGH_FLAGS_MASK); }
 };
 
 // TObject is the base class for all objects in smalltalk.
@@ -153,6 +217,27 @@ public:
     bool isBinary() const { return size.isBinary(); }
     bool isRelocated() const { return size.isRelocated(); }
 
+    // Escape status is only meaningful for contexts, see TContext
+    bool isEscaped() const { return size.isEscaped(); }
+    void setEscaped() { size.setEscaped(); }
+    void clearEscaped() { size.clearEscaped(); }
+
+    // Fields or padded bytes of the object
+    std::size_t getBodySize() const { return isBinary() ? correctPadding(getSize()) : getSize() * sizeof(TObject*); }
+
+    // Identity hash is derived from the address until the object is moved.
+    // Collector keeps it in the slot appended to the moved copy.
+    TObject* getIdentityHash() {
+        if (size.hasHashSlot())
+            return *reinterpret_cast<TObject**>(bytes + getBodySize());
+
+        if (!size.isHashed()) {
+            size.setHashed();
+            hashedObjectsCount++;
+        }
+        return TInteger(static_cast<int32_t>(getAddressHash(this)));
+    }
+
     // TODO boundary checks
     TObject** getFields() { return fields; }
     TObject*  getField(uint32_t index) { return fields[index]; }
@@ -285,6 +370,18 @@ typedef TArray<TSymbol> TSymbolArray;
 // It contains the arguments passed to the method, stack space, array which
 // will hold temporary objects during the call dispatching and the pointers
 // to the current executing instruction and the stack top.
+//
+// Contexts created by the VM keep arguments, temporaries and the stack inline,
+// in the object's tail right after the named fields. Inline arguments come
+// first and the arguments field holds their count as a SmallInteger. The
+// temporaries and stack fields hold the SmallInteger index of the area within
+// the object fields instead of a pointer to a separate array. The stack always
+// occupies the rest of the object. Contexts created by the image code (see
+// Context>>setup:withArguments:) refer separate arrays as before.
+//
+// A context is said to be escaped when it may still be referenced after
+// it returns, i.e. it was captured by a block or stored into a process.
+// Inline contexts that did not escape are recycled by the VM on return.
 struct TContext : public TObject {
     TMethod*      method;
     TObjectArray* arguments;
@@ -294,6 +391,23 @@ struct TContext : public TObject {
     TInteger      stackTop;
     TContext*     previousContext;
 
+    // Count of the named fields, i.e. index of the first tail field
+    enum { FIELDS_COUNT = 7 };
+
+    bool hasInlineArguments() const { return isSmallInteger(arguments); }
+    bool hasInlineTemporaries() const { return isSmallInteger(temporaries); }
+    bool hasInlineStack() const { return isSmallInteger(stack); }
+
+    void setInlineArguments(uint32_t count) { arguments = reinterpret_cast<TObjectArray*>( static_cast<TObject*>(TInteger(count)) ); }
+    void setInlineTemporaries(uint32_t index) { temporaries = reinterpret_cast<TObjectArray*>( static_cast<TObject*>(TInteger(index)) ); }
+    void setInlineStack(uint32_t index) { stack = reinterpret_cast<TObjectArray*>( static_cast<TObject*>(TInteger(index)) ); }
+
+    TObject** getArgumentSlots() { return hasInlineArguments() ? &fields[FIELDS_COUNT] : arguments->getFields(); }
+    uint32_t  getArgumentsCount() const { return hasInlineArguments() ? TInteger(arguments).getValue() : arguments->getSize(); }
+    TObject** getTemporarySlots() { return hasInlineTemporaries() ? &fields[TInteger(temporaries)] : temporaries->getFields(); }
+    TObject** getStackSlots() { return hasInlineStack() ? &fields[TInteger(stack)] : stack->getFields(); }
+    uint32_t  getStackSize() const { return hasInlineStack() ? getSize() - TInteger(stack) : stack->getSize(); }
+
     static const char* InstanceClassName() { return "Context"; }
 };
 
@@ -309,6 +423,10 @@ struct TBlock : public TContext {
     TContext*     creatingContext;
     TInteger      blockBytePointer;
 
+    // Blocks created by the VM keep only the stack inline.
+    // Temporaries are shared with the wrapping method context.
+    enum { FIELDS_COUNT = 10 };
+
     static const char* InstanceClassName() { return "Block"; }
 };
 
@@ -36,6 +36,8 @@
 #define LLST_VM_H_INCLUDED
 
 #include <list>
+#include <map>
+#include <vector>
 
 #include <types.h>
 #include <memory.h>
@@ -67,6 +69,57 @@ public:
         returnNoReturn = 255
     };
 private:
+    // Decoded form of the method's bytecodes. Instructions are stored in the
+    // fixed width form, so the interpreter does not need to parse the nibble
+    // encoding every time the instruction is executed. Byte pointers are kept
+    // as is: branch targets and block entry points are mapped to the
+    // instruction index through the instructionIndex table.
+    struct TDecodedMethod {
+        // Per send site cache of the method lookup results. Site starts as
+        // monomorphic, grows up to POLYMORPHIC_SIZE receiver classes and
+        // becomes megamorphic after that. Megamorphic sites are not updated
+        // anymore and rely on the global lookup cache for the rest classes.
+        //
+        // Methods that only call one of the hot primitives (Array>>at:,
+        // Object>>class, Block>>value and so on) have the primitive number
+        // stored along with them. Such a send is performed without a context.
+        struct TInlineCache {
+            enum { POLYMORPHIC_SIZE = 4 };
+
+            uint32_t size;
+            bool     isMegamorphic;
+            TClass*  classes[POLYMORPHIC_SIZE];
+            TMethod* methods[POLYMORPHIC_SIZE];
+            uint8_t  primitives[POLYMORPHIC_SIZE]; // 0 if the method should be sent
+
+            TInlineCache() : size(0), isMegamorphic(false) {}
+        };
+
+        TMethod* method;
+
+        std::vector<st::TSmalltalkInstruction> instructions;
+        std::vector<uint16_t> nextBytePointers; // byte pointer of the following instruction
+        std::vector<uint16_t> instructionIndex; // byte offset to instruction index map
+
+        std::vector<TInlineCache> inlineCaches; // one per send site
+        std::vector<uint16_t>     sendSites;    // instruction index to inline cache index
+
+        explicit TDecodedMethod(TMethod* method);
+        std::size_t getMemoryUsage() const;
+
+        enum { NO_SEND_SITE = 0xFFFF };
+        TInlineCache* getInlineCache(uint16_t index) {
+            const uint16_t site = sendSites[index];
+            return (site != NO_SEND_SITE) ? &inlineCaches[site] : 0;
+        }
+    };
+
+    typedef std::map<TMethod*, TDecodedMethod*> TDecodedMethodMap;
+    TDecodedMethodMap m_decodedMethods;
+
+    // Incremented every time decoded methods are deleted
+    uint32_t m_decodedMethodsEpoch;
+
     struct TVMExecutionContext {
     private:
         // TODO Think about proper memory organization
@@ -81,6 +134,11 @@ private:
 
         hptr<TObject>  returnedValue;
 
+        // Decoded form of the current method and the epoch it was taken at
+        TDecodedMethod* decodedMethod;
+        uint32_t        decodedMethodEpoch;
+        uint16_t        instructionIndex;
+
         void loadPointers() {
             bytePointer = currentContext->bytePointer;
             stackTop    = currentContext->stackTop;
@@ -94,11 +152,11 @@ private:
         void stackPush(TObject* object);
 
         TObject* stackLast() {
-            return currentContext->stack->getField(stackTop - 1);
+            return currentContext->getStackSlots()[stackTop - 1];
         }
 
         TObject* stackPop() {
-            TObject* top = currentContext->stack->getField(--stackTop);
+            TObject* top = currentContext->getStackSlots()[--stackTop];
             return top;
         }
         template <typename ResultType>
@@ -110,7 +168,10 @@ private:
             m_vm(vm),
             currentContext( static_cast<TContext*>(globals.nilObject), mm),
             instruction(opcode::extended),
-            returnedValue(globals.nilObject, mm)
+            returnedValue(globals.nilObject, mm),
+            decodedMethod(0),
+            decodedMethodEpoch(0),
+            instructionIndex(0)
         { }
     };
 
@@ -121,28 +182,90 @@ private:
         TMethod* method;
     };
 
-    static const unsigned int LOOKUP_CACHE_SIZE = 512;
-    TMethodCacheEntry m_lookupCache[LOOKUP_CACHE_SIZE];
+    // Global lookup cache is set associative. Entry is placed in one of the
+    // LOOKUP_CACHE_WAYS slots of the set selected by the selector and class.
+    //
+    // Objects of the image reside in the static heap and never move, so their
+    // addresses serve as a stable identity. After collection only entries
+    // referring dynamic objects are purged, the rest of the cache survives.
+    enum { LOOKUP_CACHE_WAYS = 4, DEFAULT_LOOKUP_CACHE_SIZE = 2048, MAX_LOOKUP_CACHE_SIZE = 1 << 20 };
+    std::vector<TMethodCacheEntry> m_lookupCache;
+    uint32_t m_lookupCacheSetMask;
     uint32_t m_cacheHits;
     uint32_t m_cacheMisses;
     uint32_t m_messagesSent;
 
+    uint32_t m_inlineCacheHits;
+    uint32_t m_inlineCacheMisses;
+    uint32_t m_primitiveShortcuts;
+
+    // Method contexts that did not escape are put to the free list on return
+    // and reused by the following sends. Lists are segregated by the size of
+    // the context tail (temporaries and stack) and linked through the
+    // previousContext field. Free contexts are not roots, so lists are
+    // dropped on every collection.
+    enum { MAX_RECYCLED_CONTEXT_SIZE = 64 };
+    TContext* m_contextFreeLists[MAX_RECYCLED_CONTEXT_SIZE];
+    uint32_t  m_contextsRecycled;
+    uint32_t  m_contextsReused;
+
 
     // fast method lookup in the method cache
     TMethod* lookupMethodInCache(TSymbol* selector, TClass* klass);
 public:
     TMethod* lookupMethod(TSymbol* selector, TClass* klass);
 
-    bool checkRoot(TObject* value, TObject** objectSlot);
+    // Should be called before storing the value to the heap object slot
+    bool checkRoot(TObject* value, TObject** objectSlot) { return m_memoryManager->writeBarrier(value, objectSlot); }
+
+    // Stores the value to the object slot notifying the memory manager
+    template<typename T, typename V> void assignPointer(T*& slot, const V& value) {
+        T* const pointer = value;
+        checkRoot(pointer, reinterpret_cast<TObject**>(&slot));
+        slot = pointer;
+    }
 private:
 
     void updateMethodCache(TSymbol* selector, TClass* klass, TMethod* method);
 
     // flush the method lookup cache
     void flushMethodCache();
+    // remove entries that may be invalidated by the collection
+    void purgeMethodCache();
+
+    TDecodedMethod* getDecodedMethod(TMethod* method);
+    // Method lookup through the inline cache of the current send site.
+    // If shortcut is given, it receives the primitive the send may be replaced with.
+    TMethod* lookupMethodAtSendSite(TVMExecutionContext& ec, TSymbol* selector, TClass* klass, uint8_t* shortcut = 0);
+    // Returns the primitive number if the whole job of the method is to call
+    // one of the hot primitives with its own arguments, 0 otherwise
+    static uint8_t getShortcutPrimitive(TMethod* method, uint32_t argumentsCount);
+    // Performs the shortcut primitive on the arguments at the top of the stack
+    // instead of the send. Returns false if the primitive failed.
+    bool doPrimitiveShortcut(TVMExecutionContext& ec, uint8_t primitive, uint32_t argumentsCount);
+    void releaseInlineCaches(TDecodedMethod* decodedMethod);
+    // Loads the instruction at ec.bytePointer and advances the pointer
+    void fetchInstruction(TVMExecutionContext& ec);
+    // Deletes the decoded methods. Methods residing in the static heap never
+    // move, so after a collection only the dynamic ones need to be dropped.
+    void flushDecodedMethods(bool dynamicOnly = false);
 
     void doPushConstant(TVMExecutionContext& ec);
     void doPushBlock(TVMExecutionContext& ec);
+    // Moves inline arguments, temporaries or stack of the context to a separate array
+    void materializeArguments(hptr<TContext>& context);
+    void materializeTemporaries(hptr<TContext>& context);
+    void materializeStack(hptr<TContext>& context);
+    // Materializes the tails of all contexts in the chain for the image code
+    void materializeContextChain(TContext* context);
+
+    // Marks the context and its callers as the ones that may be referenced after return
+    void markContextEscaped(TContext* context);
+    // Puts the context that has just returned to the free list if it did not escape
+    void recycleContext(TContext* context);
+    // Creates method context with the inline tail, reusing the free one if possible
+    hptr<TContext> newMethodContext(uint32_t argumentsCount, uint32_t temporariesCount, uint32_t stackSize);
+    void flushContextFreeLists();
     void doMarkArguments(TVMExecutionContext& ec);
     //Takes selector, arguments from context and sends message
     //The class is taken from the first argument
@@ -150,6 +273,11 @@ private:
     //This method is used to send message to the first argument
     //If receiverClass != 0 then the class is not taken from the first argument (implementation of sendToSuper)
     void doSendMessage(TVMExecutionContext& ec, TSymbol* selector, TObjectArray* arguments, TClass* receiverClass = 0);
+    //Same as above, but arguments are taken from the top of the stack and passed
+    //to the callee context directly, without packing them into the array
+    void doSendMessage(TVMExecutionContext& ec, TSymbol* selector, uint32_t argumentsCount, TClass* receiverClass = 0);
+    //Switches execution to the context of the method being sent
+    void enterContext(TVMExecutionContext& ec, hptr<TContext>& newContext);
     void doSendUnary(TVMExecutionContext& ec);
     void doSendBinary(TVMExecutionContext& ec);
 
@@ -174,12 +302,11 @@ public:
     TByteObject* newBinaryObject  (TClass* klass, std::size_t dataSize);
     TObject*     newOrdinaryObject(TClass* klass, std::size_t slotSize);
 
-    SmalltalkVM(Image* image, IMemoryManager* memoryManager)
-        : m_cacheHits(0), m_cacheMisses(0), m_messagesSent(0), m_image(image),
-        m_memoryManager(memoryManager), m_lastGCOccured(false) //, ec(memoryManager)
-    {
-        flushMethodCache();
-    }
+    // lookupCacheSize is the amount of entries in the global method lookup cache.
+    // It is rounded up to the power of two and to at least one set.
+    SmalltalkVM(Image* image, IMemoryManager* memoryManager, uint32_t lookupCacheSize = DEFAULT_LOOKUP_CACHE_SIZE);
+
+    ~SmalltalkVM() { flushDecodedMethods(); }
 
     TExecuteResult execute(TProcess* p, uint32_t ticks);
     template<class T> hptr<T> newObject(std::size_t dataSize = 0, bool registerPointer = true);
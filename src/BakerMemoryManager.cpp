@@ -33,6 +33,8 @@
  */
 
 #include <memory.h>
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <sys/time.h>
@@ -46,18 +48,21 @@ bool is_aligned_properly(uint32_t x) {
 }
 
 BakerMemoryManager::BakerMemoryManager() :
-    m_memoryInfo(), m_heapSize(0), m_maxHeapSize(0), m_heapOne(0), m_heapTwo(0),
+    m_memoryInfo(), m_heapSize(0), m_maxHeapSize(0), m_initialHeapSize(0), m_targetHeapSize(0),
+    m_sizingPolicy(), m_pendingAllocation(0), m_lastCollectionEnd(),
+    m_reservedSize(0), m_heapOne(0), m_heapTwo(0),
     m_activeHeapOne(true), m_inactiveHeapBase(0), m_inactiveHeapPointer(0),
     m_activeHeapBase(0), m_activeHeapPointer(0), m_staticHeapSize(0),
-    m_staticHeapBase(0), m_staticHeapPointer(0), m_externalPointersHead(0)
+    m_staticHeapBase(0), m_staticHeapPointer(0), m_largeObjectThreshold(DEFAULT_LARGE_OBJECT_THRESHOLD),
+    m_largeObjects(), m_largeObjectStack(), m_staticRoots(), m_externalPointersHead(0), m_pins()
 {}
 
 BakerMemoryManager::~BakerMemoryManager()
 {
     // TODO Reset the external pointers to catch the null pointers if something goes wrong
     std::free(m_staticHeapBase);
-    std::free(m_heapOne);
-    std::free(m_heapTwo);
+    heapMemory::release(m_heapOne, m_reservedSize);
+    heapMemory::release(m_heapTwo, m_reservedSize);
 }
 
 bool BakerMemoryManager::initializeStaticHeap(std::size_t heapSize)
@@ -80,76 +85,66 @@ bool BakerMemoryManager::initializeStaticHeap(std::size_t heapSize)
 bool BakerMemoryManager::initializeHeap(std::size_t heapSize, std::size_t maxHeapSize /* = 0 */)
 {
     // To initialize properly we need a heap with an even size
-    heapSize = correctPadding(heapSize);
-
-    uint32_t mediane = heapSize / 2;
-    m_heapSize = heapSize;
+    const std::size_t mediane = correctPadding(heapSize / 2);
+    m_heapSize = mediane * 2;
+    m_initialHeapSize = m_heapSize;
+    m_targetHeapSize = m_heapSize;
     m_maxHeapSize = maxHeapSize;
 
-    m_heapOne = static_cast<uint8_t*>( std::malloc(mediane) );
-    m_heapTwo = static_cast<uint8_t*>( std::malloc(mediane) );
-    // TODO check for allocation errors
+    // Address space is reserved for the maximal heap size. If the system
+    // could not provide so much, the heap would not be able to grow.
+    m_reservedSize = std::max(mediane, correctPadding(maxHeapSize / 2));
+    m_heapOne = heapMemory::allocate(m_reservedSize);
+    m_heapTwo = heapMemory::allocate(m_reservedSize);
+
+    if ((!m_heapOne || !m_heapTwo) && m_reservedSize > mediane) {
+        heapMemory::release(m_heapOne, m_reservedSize);
+        heapMemory::release(m_heapTwo, m_reservedSize);
+
+        m_reservedSize = mediane;
+        m_heapOne = heapMemory::allocate(m_reservedSize);
+        m_heapTwo = heapMemory::allocate(m_reservedSize);
+    }
+
+    if (!m_heapOne || !m_heapTwo) {
+        std::fprintf(stderr, "MM: Cannot allocate %u bytes for the heap\n", static_cast<uint32_t>(m_heapSize));
+        return false;
+    }
 
-    std::memset(m_heapOne, 0, mediane);
-    std::memset(m_heapTwo, 0, mediane);
+    // Heap may shrink down to the initial size
+    m_sizingPolicy.setLimits(m_heapSize, 2 * m_reservedSize);
+
+    // Large objects are allocated in the heap if the space is not available
+    if (m_largeObjectThreshold && !m_largeObjects.initialize(std::max(m_heapSize, maxHeapSize))) {
+        std::fprintf(stderr, "MM: Cannot reserve the large object space\n");
+        m_largeObjectThreshold = 0;
+    }
 
     m_activeHeapOne = true;
 
-    m_activeHeapBase = m_heapOne;
-    m_activeHeapPointer = m_heapOne + mediane;
+    m_activeHeapBase = getHeapBase(m_heapOne, m_heapSize);
+    m_activeHeapPointer = getHeapEnd(m_heapOne);
 
-    m_inactiveHeapBase =  m_heapTwo;
-    m_inactiveHeapPointer = m_heapTwo + mediane;
+    m_inactiveHeapBase = getHeapBase(m_heapTwo, m_heapSize);
+    m_inactiveHeapPointer = getHeapEnd(m_heapTwo);
 
     return true;
 }
 
 void BakerMemoryManager::growHeap(uint32_t requestedSize)
 {
-    // Stage1. Growing inactive heap
-    uint32_t newHeapSize = correctPadding(2 * requestedSize + m_heapSize + m_heapSize / 2);
-    while( !is_aligned_properly(newHeapSize/2) )
-        newHeapSize = correctPadding(newHeapSize+1);
+    // Heap could not grow beyond the reserved space
+    const std::size_t newMediane = std::min(correctPadding((2 * requestedSize + m_heapSize + m_heapSize / 2) / 2), m_reservedSize);
+    const std::size_t newHeapSize = newMediane * 2;
 
-    std::printf("MM: Growing heap to %d\n", newHeapSize);
+    if (newHeapSize <= m_heapSize)
+        return;
 
-    const uint32_t newMediane = newHeapSize / 2;
-    uint8_t** activeHeapBase   = m_activeHeapOne ? &m_heapOne : &m_heapTwo;
-    uint8_t** inactiveHeapBase = m_activeHeapOne ? &m_heapTwo : &m_heapOne;
+    std::printf("MM: Growing heap to %u\n", static_cast<uint32_t>(newHeapSize));
 
-    // Reallocating space and zeroing it
-    {
-        void* newInactiveHeap = std::realloc(*inactiveHeapBase, newMediane);
-        if (!newInactiveHeap)
-        {
-            std::printf("MM: Cannot reallocate %d bytes for inactive heap\n", newMediane);
-            std::abort();
-        } else {
-            *inactiveHeapBase = static_cast<uint8_t*>(newInactiveHeap);
-            std::memset(*inactiveHeapBase, 0, newMediane);
-        }
-    }
-    // Stage 2. Collecting garbage so that
-    // active objects will be moved to a new home
+    // Objects are moved to the grown heap during the collection
+    m_targetHeapSize = newHeapSize;
     collectGarbage();
-
-    // Now pointers are swapped and previously active heap is now inactive
-    // We need to reallocate it too
-    {
-        void* newActiveHeap = std::realloc(*activeHeapBase, newMediane);
-        if (!newActiveHeap)
-        {
-            std::printf("MM: Cannot reallocate %d bytes for active heap\n", newMediane);
-            std::abort();
-        } else {
-            *activeHeapBase = static_cast<uint8_t*>(newActiveHeap);
-            std::memset(*activeHeapBase, 0, newMediane);
-        }
-    }
-
-    collectGarbage();
-
-    m_heapSize = newHeapSize;
 }
 
 void* BakerMemoryManager::allocate(std::size_t requestedSize, bool* gcOccured /*= 0*/ )
@@ -158,6 +153,22 @@ void* BakerMemoryManager::allocate(std::size_t requestedSize, bool* gcOccured /*
     if (gcOccured)
         *gcOccured = false;
 
+    // Large objects are never moved by the collector
+    if (m_largeObjectThreshold && requestedSize >= m_largeObjectThreshold) {
+        if (void* const result = allocateLarge(requestedSize, gcOccured))
+            return result;
+    }
+
+    // Objects that fit in the rest of the buffer are taken from it
+    if (void* const result = allocateFromBuffer(requestedSize)) {
+        if (gcOccured)
+            m_memoryInfo.allocationsCount++;
+        return result;
+    }
+    retireBuffer();
+
+    m_pendingAllocation = requestedSize;
+
     // Quick check for the case when new object is
     // considerably larger that the active heap space
     if (requestedSize > m_heapSize / 2) {
@@ -167,42 +178,101 @@ void* BakerMemoryManager::allocate(std::size_t requestedSize, bool* gcOccured /*
             growHeap(requestedSize);
         } else {
             std::fprintf(stderr, "Could not allocate %u bytes because doing so would exceed heap limit %u\n", requestedSize, m_maxHeapSize);
+            m_pendingAllocation = 0;
+            return 0;
+        }
+
+        if (gcOccured)
+            *gcOccured = true;
+    }
+
+    // Sizing policy takes the pending allocation into account, so if the object
+    // does not fit after the collection, the next one moves the objects to the
+    // grown heap. Object that does not fit even then exceeds the heap limit.
+    for (std::size_t collections = 0; m_activeHeapPointer - requestedSize < m_activeHeapBase; collections++) {
+        if (collections == 2) {
+            std::fprintf(stderr, "Could not allocate %u bytes in heap\n", requestedSize);
+            m_pendingAllocation = 0;
             return 0;
         }
 
+        collectGarbage();
         if (gcOccured)
             *gcOccured = true;
     }
 
-    std::size_t attempts = 2;
-    while (attempts-- > 0) {
-        if (m_activeHeapPointer - requestedSize < m_activeHeapBase) {
-            collectGarbage();
+    m_pendingAllocation = 0;
+    m_activeHeapPointer -= requestedSize;
+    void* result = m_activeHeapPointer;
+    assert( is_aligned_properly(result) );
 
-            // If even after collection there is too less space
-            // we may try to expand the heap if limit is not yet reached
-            const uintptr_t distance = m_activeHeapPointer - m_activeHeapBase;
-            if ((distance < m_heapSize / 16) && (m_heapSize < m_maxHeapSize))
-               growHeap(requestedSize);
+    // Following small objects are allocated inline by the VM
+    refillBuffer();
 
-            if (gcOccured)
-                *gcOccured = true;
-            continue;
-        }
+    if (gcOccured && !*gcOccured)
+        m_memoryInfo.allocationsCount++;
+    return result;
+}
+
+void* BakerMemoryManager::allocateLarge(std::size_t requestedSize, bool* gcOccured)
+{
+    void* result = m_largeObjects.allocate(requestedSize);
 
-        m_activeHeapPointer -= requestedSize;
-        void* result = m_activeHeapPointer;
-        assert( is_aligned_properly(result) );
+    if (!result) {
+        // Releasing the unreachable large objects. If the space
+        // is still exhausted, object is allocated in the heap.
+        collectGarbage();
+        if (gcOccured)
+            *gcOccured = true;
 
-        if (gcOccured && !*gcOccured)
-            m_memoryInfo.allocationsCount++;
-        return result;
+        result = m_largeObjects.allocate(requestedSize);
     }
 
-    // TODO Grow the heap if object still not fits
+    if (result && gcOccured && !*gcOccured)
+        m_memoryInfo.allocationsCount++;
+    return result;
+}
+
+void BakerMemoryManager::fillBuffer(uint8_t* base, std::size_t size)
+{
+    // Fields of ordinary objects allocated in the buffer are already nil
+    std::fill(reinterpret_cast<TObject**>(base), reinterpret_cast<TObject**>(base + size), globals.nilObject);
 
-    std::fprintf(stderr, "Could not allocate %u bytes in heap\n", requestedSize);
-    return 0;
+    m_bufferTop = base;
+    m_bufferEnd = base + size;
+}
+
+void* BakerMemoryManager::allocateFromBuffer(std::size_t requestedSize)
+{
+    if (requestedSize > static_cast<std::size_t>(m_bufferEnd - m_bufferTop))
+        return 0;
+
+    // Memory returned by allocate() is expected to be zeroed
+    uint8_t* const result = m_bufferTop;
+    m_bufferTop += requestedSize;
+    std::memset(result, 0, requestedSize);
+    return result;
+}
+
+void BakerMemoryManager::refillBuffer()
+{
+    // Buffer could not be filled until nil is loaded from the image
+    const std::size_t size = std::min<std::size_t>(BUFFER_SIZE, m_activeHeapPointer - m_activeHeapBase);
+    if (!globals.nilObject || size < MAX_BUFFERED_SIZE)
+        return;
+
+    m_activeHeapPointer -= size;
+    fillBuffer(m_activeHeapPointer, size);
+}
+
+void BakerMemoryManager::retireBuffer()
+{
+    // Unused part of the buffer is left as a gap that
+    // disappears when the live objects are moved
+    m_memoryInfo.allocationsCount += m_bufferAllocations;
+    m_bufferAllocations = 0;
+    m_bufferTop = 0;
+    m_bufferEnd = 0;
 }
 
 void* BakerMemoryManager::staticAllocate(std::size_t requestedSize)
@@ -217,6 +287,67 @@ void* BakerMemoryManager::staticAllocate(std::size_t requestedSize)
     return newPointer;
 }
 
+std::size_t BakerMemoryManager::getSlotSize(const TMovableObject* object)
+{
+    const std::size_t slotSize = sizeof(TObject) + reinterpret_cast<const TObject*>(object)->getBodySize();
+    return object->size.hasHashSlot() ? slotSize + sizeof(TObject*) : slotSize;
+}
+
+std::size_t BakerMemoryManager::getCopySize(const TMovableObject* object)
+{
+    const std::size_t slotSize = getSlotSize(object);
+    return (object->size.isHashed() && !object->size.hasHashSlot()) ? slotSize + sizeof(TObject*) : slotSize;
+}
+
+BakerMemoryManager::TMovableObject* BakerMemoryManager::copyObjectTo(uint8_t* location, const TMovableObject* object)
+{
+    // Padding of binary objects is left zeroed
+    const std::size_t dataSize = object->size.isBinary() ?
+        sizeof(TByteObject) + object->size.getSize() :
+        sizeof(TObject) + object->size.getSize() * sizeof(TObject*);
+
+    std::memcpy(location, reinterpret_cast<const uint8_t*>(object), dataSize);
+
+    TMovableObject* const copy = reinterpret_cast<TMovableObject*>(location);
+    copyIdentityHash(copy, object);
+    return copy;
+}
+
+std::size_t BakerMemoryManager::takeHashedObjects()
+{
+    const std::size_t count = hashedObjectsCount;
+    hashedObjectsCount = 0;
+    return count;
+}
+
+uint8_t* BakerMemoryManager::reserveCopySpace(std::size_t copySize)
+{
+    // Heap is sized by the bound on the hash slots that copies may add,
+    // so the space runs out only if the bound exceeds the heap limit
+    if (copySize > static_cast<std::size_t>(m_activeHeapPointer - m_activeHeapBase)) {
+        std::fprintf(stderr, "MM: New space is exhausted during the collection\n");
+        std::abort();
+    }
+
+    m_activeHeapPointer -= copySize;
+    return m_activeHeapPointer;
+}
+
+void BakerMemoryManager::copyIdentityHash(TMovableObject* copy, const TMovableObject* object)
+{
+    if (!object->size.isHashed())
+        return;
+
+    // Slot follows the body of the object. Hash of the object that
+    // was never moved is derived from its current address.
+    const std::size_t bodySize = reinterpret_cast<const TObject*>(object)->getBodySize();
+    TObject* const* const source = reinterpret_cast<TObject* const*>(reinterpret_cast<const uint8_t*>(object) + sizeof(TObject) + bodySize);
+    TObject** const target = reinterpret_cast<TObject**>(reinterpret_cast<uint8_t*>(copy) + sizeof(TObject) + bodySize);
+
+    *target = object->size.hasHashSlot() ? *source : static_cast<TObject*>(TInteger(static_cast<int32_t>(getAddressHash(object))));
+    copy->size.setHashSlot();
+}
+
 BakerMemoryManager::TMovableObject* BakerMemoryManager::moveObject(TMovableObject* object)
 {
     TMovableObject* currentObject  = object;
@@ -247,8 +378,9 @@ BakerMemoryManager::TMovableObject* BakerMemoryManager::moveObject(TMovableObjec
             if (!inOldSpace)
             {
                 // Object does not belong to a heap.
-                // Either it is located in static space
-                // or this is a broken pointer
+                // Either it is located in static space, in the
+                // large object space or this is a broken pointer
+                markLargeObject(currentObject);
                 replacement   = currentObject;
                 currentObject = previousObject;
                 break;
@@ -279,8 +411,9 @@ BakerMemoryManager::TMovableObject* BakerMemoryManager::moveObject(TMovableObjec
 
                 // We need to allocate space evenly, so calculating the
                 // actual size of the block being reserved for the moving object
-                m_activeHeapPointer -= sizeof(TByteObject) + correctPadding(dataSize);
-                objectCopy = new (m_activeHeapPointer) TMovableObject(dataSize, true);
+                objectCopy = new (reserveCopySpace(getCopySize(currentObject))) TMovableObject(dataSize, true);
+                objectCopy->size.copyHighFlags(currentObject->size);
+                copyIdentityHash(objectCopy, currentObject);
 
                 // Copying byte data. data[0] is the class pointer,
                 // actual binary data starts from the data[1]
@@ -307,8 +440,9 @@ BakerMemoryManager::TMovableObject* BakerMemoryManager::moveObject(TMovableObjec
 
                 uint32_t fieldsCount = currentObject->size.getSize();
 
-                m_activeHeapPointer -= sizeof(TObject) + fieldsCount * sizeof (TObject*);
-                objectCopy = new (m_activeHeapPointer) TMovableObject(fieldsCount, false);
+                objectCopy = new (reserveCopySpace(getCopySize(currentObject))) TMovableObject(fieldsCount, false);
+                objectCopy->size.copyHighFlags(currentObject->size);
+                copyIdentityHash(objectCopy, currentObject);
 
                 currentObject->size.setRelocated();
 
@@ -379,26 +513,24 @@ BakerMemoryManager::TMovableObject* BakerMemoryManager::moveObject(TMovableObjec
 
 void BakerMemoryManager::collectGarbage()
 {
+    // Unused part of the allocation buffer is not counted as used
+    const std::size_t unusedBuffer = m_bufferEnd - m_bufferTop;
+    retireBuffer();
+
     //get statistic before collect
     m_memoryInfo.collectionsCount++;
     TMemoryManagerEvent event("GC");
     event.begin = m_memoryInfo.timer.get<TSec>();
-    event.heapInfo.usedHeapSizeBeforeCollect =  (m_heapSize/2 - (m_activeHeapPointer - m_activeHeapBase));
+    event.heapInfo.usedHeapSizeBeforeCollect =  (m_heapSize/2 - (m_activeHeapPointer - m_activeHeapBase)) - unusedBuffer;
     event.heapInfo.totalHeapSize = m_heapSize;
-    // First of all swapping the spaces
-    if (m_activeHeapOne)
-    {
-        m_activeHeapBase = m_heapTwo;
-        m_inactiveHeapBase = m_heapOne;
-    } else {
-        m_activeHeapBase = m_heapOne;
-        m_inactiveHeapBase = m_heapTwo;
-    }
 
-    m_activeHeapOne = not m_activeHeapOne;
+    // Every live object is moved, so the objects hashed in place get
+    // the hash slot and take one more word in the new space
+    const std::size_t hashSlotsSize = takeHashedObjects() * sizeof(TObject*);
+    const std::size_t newHeapSize = getNewHeapSize(event.heapInfo.usedHeapSizeBeforeCollect + hashSlotsSize + getCopyOverhead());
 
-    m_inactiveHeapPointer = m_activeHeapPointer;
-    m_activeHeapPointer = m_activeHeapBase + m_heapSize / 2;
+    // First of all swapping the spaces
+    swapSpaces(newHeapSize);
 
     // Then, performing the collection. Seeking from the root
     // objects down the hierarchy to find active objects.
@@ -407,17 +539,89 @@ void BakerMemoryManager::collectGarbage()
     // Moving the live objects in the new heap
     moveObjects();
 
+    // Large objects that were not reached are released
+    if (m_largeObjects.getTotalSize()) {
+        TMemoryManagerHeapEvent largeObjects("Large objects");
+        largeObjects.usedHeapSizeBeforeCollect = m_largeObjects.getUsedSize();
+        m_largeObjects.sweep();
+        largeObjects.usedHeapSizeAfterCollect = m_largeObjects.getUsedSize();
+        largeObjects.totalHeapSize = m_largeObjects.getTotalSize();
+        event.heapInfo.heapEvents.push_back(largeObjects);
+    }
 
-    std::memset(m_inactiveHeapBase, 0, m_heapSize / 2);
+    releaseInactiveSpace(newHeapSize);
 
     // Calculating total microseconds spent in the garbage collection procedure
-    event.heapInfo.usedHeapSizeAfterCollect =  (m_heapSize/2 - (m_activeHeapPointer - m_activeHeapBase));
+    event.heapInfo.usedHeapSizeAfterCollect = m_heapSize/2 - (m_activeHeapPointer - m_activeHeapBase);
     event.timeDiff = m_memoryInfo.timer.get<TSec>() - event.begin;
     m_memoryInfo.totalCollectionDelay += event.timeDiff.convertTo<TMicrosec>().toInt();
+
+    updateTargetHeapSize(event);
     m_memoryInfo.events.push_front(event);
     m_gcLogger->writeLogLine(event);
 }
 
+std::size_t BakerMemoryManager::getNewHeapSize(std::size_t usedSize) const
+{
+    // Heap is resized when objects are moved to the other space. Shrinking
+    // is postponed if all objects of the current heap may not fit.
+    std::size_t newHeapSize = m_heapSize;
+    if (m_targetHeapSize > m_heapSize || usedSize <= m_targetHeapSize / 2)
+        newHeapSize = m_targetHeapSize;
+
+    // Heap grows at once if the copies may take more than the current one
+    if (usedSize > newHeapSize / 2)
+        newHeapSize = std::min(correctPadding(usedSize) * 2, 2 * m_reservedSize);
+
+    return newHeapSize;
+}
+
+void BakerMemoryManager::swapSpaces(std::size_t newHeapSize)
+{
+    uint8_t* const activeHeap   = m_activeHeapOne ? m_heapTwo : m_heapOne;
+    uint8_t* const inactiveHeap = m_activeHeapOne ? m_heapOne : m_heapTwo;
+
+    m_activeHeapBase   = getHeapBase(activeHeap, newHeapSize);
+    m_inactiveHeapBase = getHeapBase(inactiveHeap, m_heapSize);
+
+    m_activeHeapOne = not m_activeHeapOne;
+
+    m_inactiveHeapPointer = m_activeHeapPointer;
+    m_activeHeapPointer = getHeapEnd(activeHeap);
+}
+
+void BakerMemoryManager::releaseInactiveSpace(std::size_t newHeapSize)
+{
+    // Memory of the inactive heap is given back to the system
+    heapMemory::reset(m_inactiveHeapBase, m_heapSize / 2);
+
+    m_heapSize = newHeapSize;
+    m_inactiveHeapBase = getHeapBase(m_activeHeapOne ? m_heapTwo : m_heapOne, m_heapSize);
+}
+
+void BakerMemoryManager::updateTargetHeapSize(TMemoryManagerEvent& event)
+{
+    // Choosing the heap size for the next collection
+    THeapSizingPolicy::TSample sample;
+    sample.heapSize      = m_heapSize;
+    sample.usedBefore    = event.heapInfo.usedHeapSizeBeforeCollect;
+    sample.usedAfter     = event.heapInfo.usedHeapSizeAfterCollect;
+    sample.requestedSize = m_pendingAllocation;
+    sample.pause         = event.timeDiff.convertTo<TMicrosec>().toDouble();
+    sample.mutatorTime   = (event.begin - m_lastCollectionEnd).convertTo<TMicrosec>().toDouble();
+    m_lastCollectionEnd  = m_memoryInfo.timer.get<TSec>();
+
+    m_targetHeapSize = correctPadding(m_sizingPolicy.getNextHeapSize(sample) / 2) * 2;
+    if (m_targetHeapSize != m_heapSize) {
+        // Decision is logged as the change of the heap size within the limit
+        TMemoryManagerHeapEvent decision(m_targetHeapSize > m_heapSize ? "Grow" : "Shrink");
+        decision.usedHeapSizeBeforeCollect = m_heapSize;
+        decision.usedHeapSizeAfterCollect  = m_targetHeapSize;
+        decision.totalHeapSize             = 2 * m_reservedSize;
+        event.heapInfo.heapEvents.push_back(decision);
+    }
+}
+
 void BakerMemoryManager::moveObjects()
 {
     // Here we need to check the rootStack, staticRoots and the VM execution context
@@ -427,11 +631,33 @@ void BakerMemoryManager::moveObjects()
     }
 
     // Updating external references. Typically these are pointers stored in the hptr<>
+    for (std::size_t index = 0; index < m_handles.size(); index++) {
+        TMovableObject** const slot = reinterpret_cast<TMovableObject**>(m_handles[index]);
+        if (slot)
+            *slot = moveObject(*slot);
+    }
+
     object_ptr* currentPointer = m_externalPointersHead;
     while (currentPointer != 0) {
         currentPointer->data = reinterpret_cast<TObject*>( moveObject( reinterpret_cast<TMovableObject*>(currentPointer->data) ) );
         currentPointer = currentPointer->next;
     }
+
+    scanLargeObjects();
+}
+
+void BakerMemoryManager::scanLargeObjects()
+{
+    // Moving may mark more large objects, so the stack is drained until empty
+    while (! m_largeObjectStack.empty()) {
+        TMovableObject* const object = m_largeObjectStack.back();
+        m_largeObjectStack.pop_back();
+
+        // Binary objects have only the class pointer
+        const uint32_t pointersCount = object->size.isBinary() ? 1 : object->size.getSize() + 1;
+        for (uint32_t index = 0; index < pointersCount; index++)
+            object->data[index] = moveObject(object->data[index]);
+    }
 }
 
 bool BakerMemoryManager::isInStaticHeap(void* location)
@@ -483,18 +709,50 @@ bool BakerMemoryManager::checkRoot(TObject* value, TObject** objectSlot)
 
 void BakerMemoryManager::addStaticRoot(TObject** pointer)
 {
-    m_staticRoots.push_front( reinterpret_cast<TMovableObject**>(pointer) );
+    m_staticRoots.insert( reinterpret_cast<TMovableObject**>(pointer) );
 }
 
 void BakerMemoryManager::removeStaticRoot(TObject** pointer)
 {
-    TStaticRootsIterator iRoot = m_staticRoots.begin();
-    for (; iRoot != m_staticRoots.end(); ++iRoot) {
-        if (*iRoot == reinterpret_cast<TMovableObject**>(pointer)) {
-            m_staticRoots.erase(iRoot);
-            return;
-        }
+    m_staticRoots.erase( reinterpret_cast<TMovableObject**>(pointer) );
+}
+
+void* BakerMemoryManager::allocateNonMoving(std::size_t requestedSize, bool* gcOccured /*= 0*/)
+{
+    if (gcOccured)
+        *gcOccured = false;
+
+    // Only the large objects are never moved
+    if (!m_largeObjects.getTotalSize())
+        return 0;
+
+    return allocateLarge(correctPadding(requestedSize), gcOccured);
+}
+
+bool BakerMemoryManager::pinObject(TObject* object)
+{
+    if (isSmallInteger(object) || !(m_largeObjects.contains(object) || isInStaticHeap(object)))
+        return false;
+
+    TPin& pin = m_pins[object];
+    if (pin.count++ == 0) {
+        pin.object = object;
+        addStaticRoot(&pin.object);
     }
+    return true;
+}
+
+bool BakerMemoryManager::unpinObject(TObject* object)
+{
+    TPins::iterator iPin = m_pins.find(object);
+    if (iPin == m_pins.end())
+        return false;
+
+    if (--iPin->second.count == 0) {
+        removeStaticRoot(&iPin->second.object);
+        m_pins.erase(iPin);
+    }
+    return true;
 }
 
 void BakerMemoryManager::registerExternalHeapPointer(object_ptr& pointer) {
@@ -528,5 +786,8 @@ void BakerMemoryManager::releaseExternalHeapPointer(object_ptr& pointer) {
 
 TMemoryManagerInfo BakerMemoryManager::getStat()
 {
-    return m_memoryInfo;
+    // Allocations made in the buffer since it was filled
+    TMemoryManagerInfo info = m_memoryInfo;
+    info.allocationsCount += m_bufferAllocations;
+    return info;
 }
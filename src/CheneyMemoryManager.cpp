@@ -0,0 +1,127 @@
+/*
+ *    CheneyMemoryManager.cpp
+ *
+ *    Implementation of the copying garbage collector
+ *    based on the Cheney breadth first traversal
+ *
+ *    LLST (LLVM Smalltalk or Low Level Smalltalk) version 0.4
+ *
+ *    LLST is
+ *        Copyright (C) 2012-2015 by Dmitry Kashitsyn   <korvin@deeptown.org>
+ *        Copyright (C) 2012-2015 by Roman Proskuryakov <humbug@deeptown.org>
+ *
+ *    LLST is based on the LittleSmalltalk which is
+ *        Copyright (C) 1987-2005 by Timothy A. Budd
+ *        Copyright (C) 2007 by Charles R. Childers
+ *        Copyright (C) 2005-2007 by Danny Reinhold
+ *
+ *    Original license of LittleSmalltalk may be found in the LICENSE file.
+ *
+ *
+ *    This file is part of LLST.
+ *    LLST is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LLST is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LLST.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__GNUC__)
+    #define PREFETCH(address) __builtin_prefetch(address)
+#else
+    #define PREFETCH(address)
+#endif
+
+CheneyMemoryManager::TMovableObject* CheneyMemoryManager::moveObject(TMovableObject* object)
+{
+    // Inline integers and objects outside of the collected space stay as is
+    if (isSmallInteger(reinterpret_cast<TObject*>(object)))
+        return object;
+
+    if (!isInOldSpace(object)) {
+        // Large objects are scanned in place
+        markLargeObject(object);
+        return object;
+    }
+
+    // Forwarding address is stored in the class slot of the original object
+    if (object->size.isRelocated())
+        return object->data[0];
+
+    // Heap is sized by the bound on the hash slots that copies may add,
+    // so the space runs out only if the bound exceeds the heap limit
+    const std::size_t slotSize = getCopySize(object);
+    if (slotSize > static_cast<std::size_t>(m_activeHeapPointer - m_copyPointer)) {
+        std::fprintf(stderr, "MM: New space is exhausted during the collection\n");
+        std::abort();
+    }
+
+    TMovableObject* const copy = copyObjectTo(m_copyPointer, object);
+    m_copyPointer += slotSize;
+
+    object->size.setRelocated();
+    object->data[0] = copy;
+
+    return copy;
+}
+
+void CheneyMemoryManager::moveObjects()
+{
+    // Live objects are placed at the bottom of the new space
+    m_scanPointer = m_activeHeapBase;
+    m_copyPointer = m_activeHeapBase;
+
+    // Roots are moved by the base class. Only the objects
+    // referred directly by the roots are copied at this point.
+    BakerMemoryManager::moveObjects();
+
+    // Now scanning the copied objects and moving the objects they refer to.
+    // Newly copied objects are appended to the queue, so scan continues
+    // until there is nothing left to scan. Large objects marked during
+    // the scan may refer to more objects to be copied.
+    do {
+        while (m_scanPointer < m_copyPointer) {
+            TMovableObject* const object = reinterpret_cast<TMovableObject*>(m_scanPointer);
+            const uint32_t size = object->size.getSize();
+
+            if (object->size.isBinary()) {
+                // Binary objects have only the class pointer
+                object->data[0] = moveObject(object->data[0]);
+                m_scanPointer += getSlotSize(object);
+                continue;
+            }
+
+            // Class pointer and fields of the ordinary object
+            const uint32_t pointersCount = size + 1;
+
+            // Loading headers of the referred objects before they are copied
+            for (uint32_t index = 0; index < pointersCount; index++) {
+                TMovableObject* const field = object->data[index];
+                if (!isSmallInteger(reinterpret_cast<TObject*>(field)) && isInOldSpace(field))
+                    PREFETCH(field);
+            }
+
+            for (uint32_t index = 0; index < pointersCount; index++)
+                object->data[index] = moveObject(object->data[index]);
+
+            m_scanPointer += getSlotSize(object);
+        }
+
+        scanLargeObjects();
+    } while (m_scanPointer < m_copyPointer);
+
+    // The rest of the new space is free
+    m_activeHeapBase = m_copyPointer;
+}
@@ -1,5 +1,5 @@
 /*
- *    primitives.cpp
+ *    GenerationalMemoryManager.cpp
  *
  *    Implementation of generational memory manager which extends
  *    original Baker memory manager by introducing asymmetrical
@@ -36,247 +36,776 @@
 
 #include <memory.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <sys/time.h>
+
+namespace {
+    uint32_t countBits(uint32_t word)
+    {
+#if defined(__GNUC__)
+        return __builtin_popcount(word);
+#else
+        word = word - ((word >> 1) & 0x55555555);
+        word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+        return (((word + (word >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+    }
+}
+
+GenerationalMemoryManager::GenerationalMemoryManager(std::size_t nurserySize /*= 0*/, uint32_t tenuringAge /*= DEFAULT_TENURING_AGE*/) :
+    BakerMemoryManager(), m_activeSurvivor(0), m_nurserySize(nurserySize), m_oldSpaceReserved(0),
+    m_tenuringAge(tenuringAge), m_unslottedHashes(0), m_cardTable(), m_crossingMap(), m_rememberedObjects(), m_oldMarks(), m_youngMarks(),
+    m_markStack(), m_forwards(), m_phase(PHASE_COPY), m_survivorSpace(0), m_promotionSpace(0), m_survivorScan(0), m_promotionScan(0),
+    m_leftToRightCollections(0), m_rightToLeftCollections(0), m_rightCollectionDelay(0)
+{
+    // Age is stored in the TSize, so it could not grow infinitely
+    if (m_tenuringAge > TSize::MAX_AGE)
+        m_tenuringAge = TSize::MAX_AGE;
+}
 
 GenerationalMemoryManager::~GenerationalMemoryManager()
 {
-    // Nothing to do here
+    // Survivor spaces share the memory block with the nursery
+    heapMemory::release(m_nursery.base, m_youngEnd - m_youngBase);
+    heapMemory::release(m_oldSpace.base, m_oldSpaceReserved);
+}
+
+bool GenerationalMemoryManager::initializeSpace(TSpace& space, std::size_t size)
+{
+    // Objects expect fresh memory to be zeroed
+    uint8_t* const base = heapMemory::allocate(size);
+    if (!base)
+        return false;
+
+    space.assign(base, size);
+    return true;
+}
+
+bool GenerationalMemoryManager::initializeHeap(std::size_t heapSize, std::size_t maxHeapSize /* = 0 */)
+{
+    m_heapSize = correctPadding(heapSize);
+    m_maxHeapSize = maxHeapSize;
+
+    // Survivor spaces hold objects that survived few collections,
+    // typically it is a small part of the nursery
+    const std::size_t nurserySize  = correctPadding(m_nurserySize ? m_nurserySize : m_heapSize / 4);
+    const std::size_t survivorSize = correctPadding(nurserySize / 4);
+
+    // Young spaces are allocated as a single block, so the
+    // write barrier may filter young slots with one comparison
+    TSpace youngSpace;
+    if (!initializeSpace(youngSpace, nurserySize + 2 * survivorSize))
+        return false;
+
+    // Old space is compacted in place, so it is reserved once for the heap
+    // limit and the promoted young objects. Pages are committed when used.
+    m_oldSpaceReserved = correctPadding(std::max(m_heapSize, maxHeapSize) + youngSpace.size);
+    if (!initializeSpace(m_oldSpace, m_oldSpaceReserved))
+        return false;
+    m_oldSpace.size = m_heapSize;
+
+    m_nursery.assign(youngSpace.base, nurserySize);
+    m_survivors[0].assign(youngSpace.base + nurserySize, survivorSize);
+    m_survivors[1].assign(youngSpace.base + nurserySize + survivorSize, survivorSize);
+
+    m_youngBase = reinterpret_cast<uintptr_t>(youngSpace.base);
+    m_youngEnd  = reinterpret_cast<uintptr_t>(youngSpace.base + youngSpace.size);
+
+    resetCardTable();
+    return true;
+}
+
+void GenerationalMemoryManager::resetCardTable()
+{
+    // Cards cover the whole reservation, so the old space may grow in place
+    const std::size_t cardsCount = (m_oldSpaceReserved + CARD_SIZE - 1) >> CARD_SHIFT;
+
+    m_cardTable.assign(cardsCount, CARD_CLEAN);
+    m_crossingMap.assign(cardsCount, 0);
+
+    m_cardedBase = reinterpret_cast<uintptr_t>(m_oldSpace.base);
+    m_cardedEnd  = reinterpret_cast<uintptr_t>(m_oldSpace.base + m_oldSpaceReserved);
+    m_cards      = & m_cardTable[0];
+}
+
+void GenerationalMemoryManager::markCard(void* slot)
+{
+    m_cardTable[(static_cast<uint8_t*>(slot) - m_oldSpace.base) >> CARD_SHIFT] = CARD_DIRTY;
 }
 
-void GenerationalMemoryManager::moveYoungObjects()
+void GenerationalMemoryManager::updateCrossingMap(const TSpace& space, uint8_t* object, std::size_t size)
 {
-    TPointerIterator iYoungPointer = m_crossGenerationalReferences.begin();
-    for (; iYoungPointer != m_crossGenerationalReferences.end(); ++iYoungPointer) {
-        **iYoungPointer = moveObject(**iYoungPointer);
+    // Object covers the start of every card that begins inside of it
+    const std::size_t start = object - space.base;
+    const std::size_t end   = start + size;
+
+    for (std::size_t card = (start + CARD_SIZE - 1) >> CARD_SHIFT; (card << CARD_SHIFT) < end; card++)
+        m_crossingMap[card] = start;
+}
+
+void* GenerationalMemoryManager::allocate(std::size_t requestedSize, bool* gcOccured /*= 0*/)
+{
+    if (gcOccured)
+        *gcOccured = false;
+
+    // Large objects would cause frequent young collections
+    // and would be copied on each of them, so they are
+    // allocated in the old space right away
+    if (requestedSize > m_nursery.size / 4)
+        return allocateOld(requestedSize, gcOccured);
+
+    // Objects that fit in the rest of the buffer are taken from it
+    if (void* const result = allocateFromBuffer(requestedSize)) {
+        if (gcOccured)
+            m_memoryInfo.allocationsCount++;
+        return result;
     }
+    retireBuffer();
 
-    // Now all active young objects are moved to the old space.
-    // The old space is collected with traditional algorithm, so
-    // cross generational references are not needed anymore.
-    m_crossGenerationalReferences.clear();
-
-    // Updating external references. Typically these are pointers stored in the hptr<>
-    object_ptr* currentPointer = m_externalPointersHead;
-    while (currentPointer != 0) {
-        TMovableObject* currentObject = reinterpret_cast<TMovableObject*>(currentPointer->data);
-        uint8_t* currentObjectBase    = reinterpret_cast<uint8_t*>(currentObject);
-
-        if ( (currentObjectBase >= m_inactiveHeapPointer ) &&
-            (currentObjectBase < m_heapOne + m_heapSize / 2))
-        {
-            currentObject = moveObject(currentObject);
-        }
-        currentPointer = currentPointer->next;
+    if (m_nursery.getFree() < requestedSize) {
+        collectGarbage();
+
+        if (gcOccured)
+            *gcOccured = true;
     }
 
-    TStaticRootsIterator iRoot = m_staticRoots.begin();
-    for (; iRoot != m_staticRoots.end(); ++iRoot) {
-        //if (isInYoungHeap(**iRoot))
-        uint8_t* currentRootBase   = reinterpret_cast<uint8_t*>(*iRoot);
-        uint8_t* currentObjectBase = reinterpret_cast<uint8_t*>(**iRoot);
+    void* const result = m_nursery.top;
+    m_nursery.top += requestedSize;
 
+    // Following small objects are allocated inline by the VM
+    refillBuffer();
 
-        if ( ((currentObjectBase >= m_inactiveHeapPointer) && (currentObjectBase < (m_heapOne + m_heapSize / 2)))
-            || ((currentRootBase >= m_inactiveHeapPointer) && (currentRootBase < (m_heapOne + m_heapSize / 2)))
-        )
-        {
-            **iRoot = moveObject(**iRoot);
+    if (gcOccured && !*gcOccured)
+        m_memoryInfo.allocationsCount++;
+    return result;
+}
+
+void* GenerationalMemoryManager::allocateOld(std::size_t requestedSize, bool* gcOccured)
+{
+    if (m_oldSpace.getFree() < requestedSize) {
+        collectRightToLeft(requestedSize);
+
+        if (gcOccured)
+            *gcOccured = true;
+
+        if (m_oldSpace.getFree() < requestedSize) {
+            std::fprintf(stderr, "Could not allocate %u bytes in heap\n", static_cast<uint32_t>(requestedSize));
+            return 0;
         }
     }
 
+    uint8_t* const result = m_oldSpace.top;
+    m_oldSpace.top += requestedSize;
+    updateCrossingMap(m_oldSpace, result, requestedSize);
+
+    // VM fills the fields of new objects without calling checkRoot(), so cards
+    // of the object are dirty. They get clean once scanned without young fields.
+    uint8_t* const end = result + requestedSize;
+    for (uint8_t* slot = result; slot < end; slot += CARD_SIZE)
+        markCard(slot);
+    markCard(end - sizeof(TObject*));
+
+    return result;
 }
 
-void GenerationalMemoryManager::collectGarbage()
+void GenerationalMemoryManager::refillBuffer()
 {
-//     printf("GMM: collectGarbage()\n");
+    // Buffer could not be filled until nil is loaded from the image
+    const std::size_t size = std::min<std::size_t>(BUFFER_SIZE, m_nursery.getFree());
+    if (!globals.nilObject || size < MAX_BUFFERED_SIZE)
+        return;
 
-    // Generational GC takes advantage of a fact that most objects are alive
-    // for a very short amount of time. Those who survived the first collection
-    // are typically stay there for much longer.
-    //
-    // In classic Baker collector both spaces are equal in rights and
-    // are used interchangebly. In Generational GC right space is selected
-    // as a storage for long living generation 1 whereas immediate generation 0
-    // objects are repeatedly allocated in the space one even after collection.
+    fillBuffer(m_nursery.top, size);
+    m_nursery.top += size;
+}
 
-    // In most frequent collection mode LeftToRight we move generation 0 objects from the
-    // left heap (heap one) to the right heap (heap two) so they'll become a generation 1 objects.
-    //
-    // After objects are moved two possible scenarios exist:
-    //
-    // 1. Normally, heap one is cleared and again used for further
-    // allocations.
-    //
-    // 2. If amount of free space in the heap two is below threshold,
-    // additional collection takes place which moves all objects
-    // to the left space and resets the state to csRightSpaceEmpty.
+void GenerationalMemoryManager::retireBuffer()
+{
+    // Buffer is the last part of the nursery, so its unused part is given
+    // back and the nursery may still be walked from the base to the top
+    if (m_bufferTop) {
+        std::memset(m_bufferTop, 0, m_bufferEnd - m_bufferTop);
+        m_nursery.top = m_bufferTop;
+    }
 
-    // Storing timestamp on start
-    timeval tv1;
-    gettimeofday(&tv1, NULL);
+    BakerMemoryManager::retireBuffer();
+}
 
-    collectLeftToRight();
-    if (checkThreshold())
-        collectRightToLeft();
+bool GenerationalMemoryManager::isContext(TMovableObject* object)
+{
+    // Classes reside in the static heap, so the class pointer stays valid during collection
+    TMovableObject* const klass = object->data[0];
+    return klass == reinterpret_cast<TMovableObject*>(globals.contextClass)
+        || klass == reinterpret_cast<TMovableObject*>(globals.blockClass);
+}
 
-    // Storing timestamp of the end
-    timeval tv2;
-    gettimeofday(&tv2, NULL);
+void GenerationalMemoryManager::remember(TMovableObject* object)
+{
+    object->size.setRemembered();
+    m_rememberedObjects.push_back(object);
+}
+
+GenerationalMemoryManager::TMovableObject* GenerationalMemoryManager::copyTo(TSpace& space, TMovableObject* object)
+{
+    const std::size_t slotSize = getCopySize(object);
+    if (object->size.isHashed() && !object->size.hasHashSlot() && m_unslottedHashes)
+        m_unslottedHashes--;
 
-    // Calculating total microseconds spent in the garbage collection procedure
-    m_memoryInfo.totalCollectionDelay += (tv2.tv_sec - tv1.tv_sec) * 1000000 + (tv2.tv_usec - tv1.tv_usec);
+    TMovableObject* const copy = copyObjectTo(space.top, object);
+    space.top += slotSize;
 
-    m_memoryInfo.collectionsCount++;
+    // Forwarding address is stored in the class slot of the original object
+    object->size.setRelocated();
+    object->data[0] = copy;
+
+    return copy;
 }
 
-void GenerationalMemoryManager::collectLeftToRight(bool fullCollect /*= false*/)
-{
-    // Classic baker algorithm moves objects after swapping the spaces,
-    // but in our case we do not want to swap them now. Still, in order to
-    // satisfy moveObjects() we do this temporarily and then revert the pointers
-    // to the needed state.
-
-    // Setting the heap two as active leaving the heap pointer as is
-    m_activeHeapBase    = m_heapTwo;
-    m_inactiveHeapBase  = m_heapOne;
-
-    std::swap(m_activeHeapPointer, m_inactiveHeapPointer);
-
-    // Moving the objects from the left to the right heap
-    // TODO In certain circumstances right heap may not have
-    //      enough space to store all active objects from gen 0.
-    //      This may happen if massive allocation took place before
-    //      the collection was initiated. In this case we need to interrupt
-    //      the collection, then allocate a new larger heap and recollect
-    //      ALL objects from both spaces to a new allocated heap.
-    //      After that old space is freed and new is treated either as heap one
-    //      or heap two depending on the size.
-    if (fullCollect) {
-        moveObjects();
-    } else {
-        moveYoungObjects();
+GenerationalMemoryManager::TMovableObject* GenerationalMemoryManager::moveObject(TMovableObject* object)
+{
+    if (isSmallInteger(reinterpret_cast<TObject*>(object)))
+        return object;
+
+    // Roots are visited the same way by every phase of the full collection
+    if (m_phase == PHASE_MARK) {
+        markObject(object);
+        return object;
+    }
+
+    if (m_phase == PHASE_UPDATE)
+        return getForward(object);
+
+    // Only young objects are copied
+    if (!isInYoungHeap(object))
+        return object;
+
+    if (object->size.isRelocated())
+        return object->data[0];
+
+    const uint32_t age = object->size.getAge() + 1;
+
+    if (age < m_tenuringAge && m_survivorSpace->getFree() >= getCopySize(object)) {
+        TMovableObject* const copy = copyTo(*m_survivorSpace, object);
+        copy->size.setAge(age);
+        return copy;
+    }
+
+    TMovableObject* const copy = copyTo(*m_promotionSpace, object);
+    copy->size.setAge(0);
+    copy->size.clearRemembered();
+
+    // Old contexts are written by the VM without calling checkRoot()
+    if (isContext(copy))
+        remember(copy);
+
+    return copy;
+}
+
+void GenerationalMemoryManager::scanObject(TMovableObject* object, bool isPromoted)
+{
+    if (object->size.isBinary()) {
+        // Binary objects have only the class pointer
+        object->data[0] = moveObject(object->data[0]);
+        return;
+    }
+
+    // Remembered objects are scanned entirely on
+    // each young collection, so their slots are not tracked
+    const bool trackSlots = isPromoted && !object->size.isRemembered();
+
+    // Class pointer and fields of the ordinary object
+    const uint32_t pointersCount = object->size.getSize() + 1;
+    for (uint32_t index = 0; index < pointersCount; index++) {
+        TMovableObject* const field = moveObject(object->data[index]);
+        object->data[index] = field;
+
+        if (trackSlots && m_survivorSpace->contains(field))
+            markCard(& object->data[index]);
+    }
+
+    if (isContext(object))
+        scanContextArrays(object);
+}
+
+void GenerationalMemoryManager::scanContextArrays(TMovableObject* context)
+{
+    // Arguments, temporaries and stack of the context may be held in separate
+    // arrays that are written by the VM without calling checkRoot(). Old arrays
+    // are remembered as a whole. data[0] is the class, so fields start at data[1].
+    for (uint32_t index = 2; index <= 4; index++) {
+        TMovableObject* const array = context->data[index];
+
+        if (isSmallInteger(reinterpret_cast<TObject*>(array)) || !m_oldSpace.contains(array))
+            continue;
+
+        if (array->size.isBinary() || array->size.isRemembered())
+            continue;
+
+        remember(array);
+        scanObject(array, false);
     }
+}
+
+void GenerationalMemoryManager::scanDirtyCards(uint8_t* scanLimit)
+{
+    const std::size_t cardsCount = (scanLimit - m_oldSpace.base + CARD_SIZE - 1) >> CARD_SHIFT;
+
+    for (std::size_t card = 0; card < cardsCount; card++) {
+        if (m_cardTable[card] == CARD_CLEAN)
+            continue;
+
+        // Card stays dirty only if it still refers to young objects
+        m_cardTable[card] = CARD_CLEAN;
+
+        TMovableObject** const cardStart = reinterpret_cast<TMovableObject**>(m_oldSpace.base + (card << CARD_SHIFT));
+        TMovableObject** const cardEnd   = reinterpret_cast<TMovableObject**>(std::min(m_oldSpace.base + ((card + 1) << CARD_SHIFT), scanLimit));
+
+        uint8_t* objectBase = m_oldSpace.base + m_crossingMap[card];
+        while (objectBase < reinterpret_cast<uint8_t*>(cardEnd)) {
+            TMovableObject* const object = reinterpret_cast<TMovableObject*>(objectBase);
+            objectBase += getSlotSize(object);
+
+            // Only the class pointer of binary objects may refer to the heap
+            TMovableObject** first = & object->data[0];
+            TMovableObject** last  = object->size.isBinary() ? first + 1 : first + object->size.getSize() + 1;
+
+            // Fields of the object that belong to the card
+            first = std::max(first, cardStart);
+            last  = std::min(last, cardEnd);
+
+            for (TMovableObject** slot = first; slot < last; slot++) {
+                *slot = moveObject(*slot);
+
+                if (m_survivorSpace->contains(*slot))
+                    m_cardTable[card] = CARD_DIRTY;
+            }
+        }
+    }
+}
+
+void GenerationalMemoryManager::scanCopiedObjects()
+{
+    // Objects copied to the survivor and promotion spaces are scanned
+    // in the Cheney manner until there is nothing left to scan in both
+    while (true) {
+        if (m_survivorSpace) {
+            while (m_survivorScan < m_survivorSpace->top) {
+                TMovableObject* const object = reinterpret_cast<TMovableObject*>(m_survivorScan);
+                scanObject(object, false);
+                m_survivorScan += getSlotSize(object);
+            }
+        }
+
+        if (m_promotionScan == m_promotionSpace->top)
+            break;
+
+        while (m_promotionScan < m_promotionSpace->top) {
+            TMovableObject* const object = reinterpret_cast<TMovableObject*>(m_promotionScan);
+            const std::size_t slotSize = getSlotSize(object);
+
+            updateCrossingMap(*m_promotionSpace, m_promotionScan, slotSize);
+            scanObject(object, true);
+            m_promotionScan += slotSize;
+        }
+    }
+}
+
+void GenerationalMemoryManager::resetYoungSpaces()
+{
+    TSpace& survivor = m_survivors[m_activeSurvivor];
 
-    m_inactiveHeapBase    = m_heapTwo;
-    m_inactiveHeapPointer = m_activeHeapPointer;
+    heapMemory::reset(m_nursery.base, m_nursery.getUsed());
+    heapMemory::reset(survivor.base, survivor.getUsed());
 
-    // Now, all active objects are located in the space two
-    // (inactive space in terms of classic Baker).
-    // Resetting the space one pointers to mark space as empty.
-    m_activeHeapBase    = m_heapOne;
-    m_activeHeapPointer = m_activeHeapBase + m_heapSize / 2;
+    m_nursery.top = m_nursery.base;
+    survivor.top  = survivor.base;
+}
+
+std::size_t GenerationalMemoryManager::getYoungCopySize()
+{
+    // Which of the hashed objects are young is not known, so
+    // every one of them is expected to get the hash slot
+    m_unslottedHashes += takeHashedObjects();
+
+    const std::size_t youngSize = m_nursery.getUsed() + m_survivors[m_activeSurvivor].getUsed();
+    return youngSize + m_unslottedHashes * sizeof(TObject*);
+}
+
+bool GenerationalMemoryManager::checkThreshold()
+{
+    // Every young object may get promoted during the young collection
+    return m_oldSpace.getFree() < getYoungCopySize();
+}
+
+void GenerationalMemoryManager::collectGarbage()
+{
+    // Generational GC takes advantage of a fact that most objects are alive
+    // for a very short amount of time. Those who survived several collections
+    // are typically stay there for much longer.
+    //
+    // Young collection moves objects that are alive from the nursery to the
+    // survivor space or promotes them to the old space. If old space may not
+    // hold all of them, full collection is performed instead.
+
+    retireBuffer();
+    if (checkThreshold())
+        collectRightToLeft();
+    else
+        collectLeftToRight();
+}
+
+void GenerationalMemoryManager::collectLeftToRight()
+{
+    TMemoryManagerEvent event("GC");
+    beginEvent(event);
 
-    std::memset(m_heapOne, 0xAA, m_heapSize / 2);
+    evacuateYoungObjects();
 
-    // After this operation active objects from space one now all
-    // in space two and are treated as generation 1.
     m_leftToRightCollections++;
+    endEvent(event);
 }
 
-void GenerationalMemoryManager::collectRightToLeft()
+void GenerationalMemoryManager::evacuateYoungObjects()
 {
-    // Storing timestamp on start
-    timeval tv1;
-    gettimeofday(&tv1, NULL);
+    m_survivorSpace  = & m_survivors[1 - m_activeSurvivor];
+    m_promotionSpace = & m_oldSpace;
+    m_survivorScan   = m_survivorSpace->top;
+    m_promotionScan  = m_oldSpace.top;
 
-    m_activeHeapBase    = m_heapOne;
-    m_inactiveHeapBase  = m_heapTwo;
+    // Static roots and external pointers
+    BakerMemoryManager::moveObjects();
 
-    // m_inactiveHeapPointer remains the same
-    m_activeHeapPointer = m_heapOne + m_heapSize / 2;
+    // Objects promoted by this collection are scanned separately
+    scanDirtyCards(m_promotionScan);
 
-    moveObjects();
+    // List may grow during the iteration
+    for (std::size_t index = 0; index < m_rememberedObjects.size(); index++)
+        scanObject(m_rememberedObjects[index], false);
 
-    // Objects were moved from right heap to the left one.
-    // Now right heap may be emptied by resetting the heap pointer
+    scanCopiedObjects();
 
-    // Resetting heap two
-    m_inactiveHeapPointer = m_heapTwo + m_heapSize / 2;
-    // m_activeHeapPointer = ?
+    // Now all live young objects are in the other survivor space
+    // or in the old space, so nursery and survivor space are empty
+    resetYoungSpaces();
+    m_activeSurvivor = 1 - m_activeSurvivor;
+    m_survivorSpace  = 0;
+}
+
+void GenerationalMemoryManager::collectRightToLeft(std::size_t requestedSize /*= 0*/)
+{
+    // Old space may get exhausted while the buffer is in use
+    retireBuffer();
+
+    TMemoryManagerEvent event("Full GC");
+    beginEvent(event);
+
+    // Live old objects are slid towards the base of the old space in
+    // four passes: marking, computing new addresses, updating pointers
+    // and moving. Young objects are then collected as usual.
+    markLiveObjects();
+    computeForwards();
+    updatePointers();
+    const std::size_t oldUnslottedHashes = compactOldSpace();
+    m_phase = PHASE_COPY;
+
+    // In the worst case all young objects get promoted
+    const std::size_t youngSize = getYoungCopySize();
+    growOldSpace(youngSize + requestedSize);
+
+    if (m_oldSpace.getFree() < youngSize) {
+        std::printf("MM: Old space reservation of %u bytes is exhausted\n", static_cast<uint32_t>(m_oldSpaceReserved));
+        std::abort();
+    }
 
-    std::memset(m_heapTwo, 0xBB, m_heapSize / 2);
+    evacuateYoungObjects();
+    m_heapSize = m_oldSpace.size;
 
-    // Moving objects back to the right heap
-    collectLeftToRight(true);
+    // Young objects got their hash slots, the old ones are counted exactly
+    m_unslottedHashes = oldUnslottedHashes;
 
-    // m_activeHeapPointer remains there and used for futher allocations
-    // because heap one remains active
     m_rightToLeftCollections++;
+    endEvent(event);
+    m_rightCollectionDelay += event.timeDiff.convertTo<TMicrosec>().toInt();
+}
+
+void GenerationalMemoryManager::markLiveObjects()
+{
+    m_oldMarks.reset(m_oldSpace.base, m_oldSpace.getUsed());
+    m_youngMarks.reset(reinterpret_cast<uint8_t*>(m_youngBase), m_youngEnd - m_youngBase);
 
-    // Storing timestamp of the end
-    timeval tv2;
-    gettimeofday(&tv2, NULL);
+    m_phase = PHASE_MARK;
+    BakerMemoryManager::moveObjects();
 
-    // Calculating total microseconds spent in the garbage collection procedure
-    m_rightCollectionDelay += (tv2.tv_sec - tv1.tv_sec) * 1000000 + (tv2.tv_usec - tv1.tv_usec);
+    while (! m_markStack.empty()) {
+        TMovableObject* const object = m_markStack.back();
+        m_markStack.pop_back();
+
+        // Binary objects have only the class pointer
+        const uint32_t pointersCount = object->size.isBinary() ? 1 : object->size.getSize() + 1;
+        for (uint32_t index = 0; index < pointersCount; index++)
+            markObject(object->data[index]);
+    }
 }
 
-bool GenerationalMemoryManager::checkThreshold()
+void GenerationalMemoryManager::markObject(TMovableObject* object)
 {
-    const uintptr_t distance = m_inactiveHeapPointer - m_inactiveHeapBase;
-    return (distance < m_heapSize / 8);
+    if (isSmallInteger(reinterpret_cast<TObject*>(object)))
+        return;
+
+    // Static objects that refer to the heap are the static roots
+    TMarkBitmap* bitmap = 0;
+    if (object >= reinterpret_cast<TMovableObject*>(m_oldSpace.base) && object < reinterpret_cast<TMovableObject*>(m_oldSpace.top))
+        bitmap = & m_oldMarks;
+    else if (isInYoungHeap(object))
+        bitmap = & m_youngMarks;
+    else
+        return;
+
+    if (bitmap->mark(object))
+        m_markStack.push_back(object);
 }
 
-TMemoryManagerInfo GenerationalMemoryManager::getStat() {
-    TMemoryManagerInfo info = BakerMemoryManager::getStat();
-    info.leftToRightCollections = m_leftToRightCollections;
-    info.rightToLeftCollections = m_rightToLeftCollections;
-    info.rightCollectionDelay = m_rightCollectionDelay;
-    return info;
+void GenerationalMemoryManager::computeForwards()
+{
+    m_oldMarks.computeRanks();
+    m_forwards.clear();
+
+    uint8_t* newTop = m_oldSpace.base;
+    for (uint8_t* objectBase = m_oldSpace.base; objectBase < m_oldSpace.top; ) {
+        TMovableObject* const object = reinterpret_cast<TMovableObject*>(objectBase);
+        const std::size_t slotSize = getSlotSize(object);
+
+        if (m_oldMarks.isMarked(object)) {
+            m_forwards.push_back(newTop);
+
+            // Object that stays in place keeps deriving its hash from the address
+            newTop += (newTop == objectBase) ? slotSize : getCopySize(object);
+        }
+
+        objectBase += slotSize;
+    }
 }
 
-bool GenerationalMemoryManager::isInYoungHeap(void* location)
+GenerationalMemoryManager::TMovableObject* GenerationalMemoryManager::getForward(TMovableObject* object) const
 {
-    return (location >= m_activeHeapPointer) && (location < m_heapOne + m_heapSize / 2);
+    if (isSmallInteger(reinterpret_cast<TObject*>(object)))
+        return object;
+
+    if (object < reinterpret_cast<TMovableObject*>(m_oldSpace.base) || object >= reinterpret_cast<TMovableObject*>(m_oldSpace.top))
+        return object;
+
+    return reinterpret_cast<TMovableObject*>(m_forwards[m_oldMarks.getRank(object)]);
 }
 
-bool GenerationalMemoryManager::checkRoot(TObject* value, TObject** objectSlot)
+void GenerationalMemoryManager::updateFields(TMovableObject* object, TMovableObject* newAddress)
 {
-    // checkRoot is called during the normal program operation in which
-    // generational GC is using left heap for young objects
-    bool slotIsYoung  = isInYoungHeap(objectSlot);
+    // Binary objects have only the class pointer
+    const uint32_t pointersCount = object->size.isBinary() ? 1 : object->size.getSize() + 1;
 
-    if (! slotIsYoung) {
-        // Slot is either in old generation or in static roots
-        if (isInStaticHeap(objectSlot))
-            return BakerMemoryManager::checkRoot(value, objectSlot);
+    for (uint32_t index = 0; index < pointersCount; index++) {
+        TMovableObject* const field = getForward(object->data[index]);
+        object->data[index] = field;
 
-        TObject* previousValue = *objectSlot;
+        // Old slots referring to young objects are found by the cards
+        if (newAddress && isInYoungHeap(field))
+            markCard(& newAddress->data[index]);
+    }
+}
 
-        bool valueIsYoung = isInYoungHeap(value);
-        bool previousValueIsYoung = isInYoungHeap(previousValue);
+void GenerationalMemoryManager::updatePointers()
+{
+    m_phase = PHASE_UPDATE;
+    BakerMemoryManager::moveObjects();
 
-        if (valueIsYoung) {
-            if (! previousValueIsYoung) {
-                addCrossgenReference(objectSlot);
-                return true;
-            }
-        } else {
-            if (previousValueIsYoung) {
-                removeCrossgenReference(objectSlot);
-                return true;
+    // Cards and crossing map describe the compacted old space
+    resetCardTable();
+
+    std::size_t rank = 0;
+    for (uint8_t* objectBase = m_oldSpace.base; objectBase < m_oldSpace.top; ) {
+        TMovableObject* const object = reinterpret_cast<TMovableObject*>(objectBase);
+        objectBase += getSlotSize(object);
+
+        if (m_oldMarks.isMarked(object))
+            updateFields(object, reinterpret_cast<TMovableObject*>(m_forwards[rank++]));
+    }
+
+    // Young objects stay in place until they are copied by the young collection.
+    // Marked young objects are scanned linearly the same way as the old ones.
+    TSpace* const youngSpaces[] = { & m_nursery, & m_survivors[m_activeSurvivor] };
+    for (std::size_t space = 0; space < 2; space++) {
+        for (uint8_t* objectBase = youngSpaces[space]->base; objectBase < youngSpaces[space]->top; ) {
+            TMovableObject* const object = reinterpret_cast<TMovableObject*>(objectBase);
+            objectBase += getSlotSize(object);
+
+            if (m_youngMarks.isMarked(object))
+                updateFields(object, 0);
+        }
+    }
+}
+
+std::size_t GenerationalMemoryManager::compactOldSpace()
+{
+    uint8_t* const oldTop = m_oldSpace.top;
+    uint8_t* newTop = m_oldSpace.base;
+    std::size_t rank = 0;
+    std::size_t unslottedHashes = 0;
+
+    // Remembered objects are collected again at their new addresses
+    m_rememberedObjects.clear();
+
+    for (uint8_t* objectBase = m_oldSpace.base; objectBase < oldTop; ) {
+        TMovableObject* const object = reinterpret_cast<TMovableObject*>(objectBase);
+        const std::size_t slotSize = getSlotSize(object);
+
+        if (m_oldMarks.isMarked(object)) {
+            uint8_t* const newBase = m_forwards[rank++];
+            TMovableObject* const moved = reinterpret_cast<TMovableObject*>(newBase);
+            std::size_t newSize = slotSize;
+
+            if (newBase != objectBase) {
+                // Hash slot is appended only when the object moves down by at least
+                // one word, so it never overwrites the objects that are not moved yet
+                const bool addHashSlot = object->size.isHashed() && !object->size.hasHashSlot();
+                std::memmove(newBase, objectBase, slotSize);
+
+                if (addHashSlot) {
+                    *reinterpret_cast<TObject**>(newBase + slotSize) = TInteger(static_cast<int32_t>(getAddressHash(object)));
+                    moved->size.setHashSlot();
+                    newSize += sizeof(TObject*);
+                }
             }
+
+            if (moved->size.isHashed() && !moved->size.hasHashSlot())
+                unslottedHashes++;
+
+            updateCrossingMap(m_oldSpace, newBase, newSize);
+            if (moved->size.isRemembered())
+                m_rememberedObjects.push_back(moved);
+
+            newTop = newBase + newSize;
         }
+
+        objectBase += slotSize;
     }
 
-    return false;
+    // Objects expect fresh memory to be zeroed
+    heapMemory::reset(newTop, oldTop - newTop);
+    m_oldSpace.top = newTop;
+    return unslottedHashes;
 }
 
-void GenerationalMemoryManager::addCrossgenReference(TObject** pointer)
+void GenerationalMemoryManager::growOldSpace(std::size_t requiredSize)
 {
-    //printf("addCrossgenReference %p", pointer);
-    m_crossGenerationalReferences.push_front( reinterpret_cast<TMovableObject**>(pointer) );
+    // Old space grows in place when live objects take more than a half of it.
+    // It never exceeds the reservation made for the heap limit.
+    const std::size_t liveSize = m_oldSpace.getUsed();
+
+    std::size_t targetSize = std::max(m_oldSpace.size, liveSize + requiredSize);
+    if (liveSize > m_oldSpace.size / 2)
+        targetSize = std::max(targetSize, 2 * liveSize + m_nursery.size);
+    targetSize = std::min(correctPadding(targetSize), m_oldSpaceReserved);
+
+    if (targetSize > m_oldSpace.size) {
+        std::printf("MM: Growing old space to %u\n", static_cast<uint32_t>(targetSize));
+        m_oldSpace.size = targetSize;
+    }
 }
 
-void GenerationalMemoryManager::removeCrossgenReference(TObject** pointer)
+void GenerationalMemoryManager::TMarkBitmap::reset(uint8_t* spaceBase, std::size_t size)
 {
-    TPointerIterator iPointer = m_crossGenerationalReferences.begin();
-    for (; iPointer != m_crossGenerationalReferences.end(); ++iPointer) {
-        if (*iPointer == reinterpret_cast<TMovableObject**>(pointer)) {
-            m_crossGenerationalReferences.erase(iPointer);
-            return;
-        }
+    const std::size_t wordsCount = size / sizeof(TObject*);
+
+    base = spaceBase;
+    bits.assign((wordsCount + 31) / 32, 0);
+    ranks.clear();
+}
+
+bool GenerationalMemoryManager::TMarkBitmap::mark(const void* object)
+{
+    const std::size_t word = (static_cast<const uint8_t*>(object) - base) / sizeof(TObject*);
+    const uint32_t mask = 1u << (word % 32);
+
+    uint32_t& bitmapWord = bits[word / 32];
+    if (bitmapWord & mask)
+        return false;
+
+    bitmapWord |= mask;
+    return true;
+}
+
+bool GenerationalMemoryManager::TMarkBitmap::isMarked(const void* object) const
+{
+    const std::size_t word = (static_cast<const uint8_t*>(object) - base) / sizeof(TObject*);
+    return bits[word / 32] & (1u << (word % 32));
+}
+
+void GenerationalMemoryManager::TMarkBitmap::computeRanks()
+{
+    ranks.resize(bits.size());
+
+    uint32_t rank = 0;
+    for (std::size_t index = 0; index < bits.size(); index++) {
+        ranks[index] = rank;
+        rank += countBits(bits[index]);
     }
 }
+
+uint32_t GenerationalMemoryManager::TMarkBitmap::getRank(const void* object) const
+{
+    // Live objects of the preceding bitmap words and the lower bits of this one
+    const std::size_t word = (static_cast<const uint8_t*>(object) - base) / sizeof(TObject*);
+    return ranks[word / 32] + countBits(bits[word / 32] & ((1u << (word % 32)) - 1));
+}
+
+std::size_t GenerationalMemoryManager::getUsedSize() const
+{
+    return m_nursery.getUsed() + m_survivors[m_activeSurvivor].getUsed() + m_oldSpace.getUsed();
+}
+
+std::size_t GenerationalMemoryManager::getTotalSize() const
+{
+    return m_nursery.size + m_survivors[0].size + m_survivors[1].size + m_oldSpace.size;
+}
+
+void GenerationalMemoryManager::beginEvent(TMemoryManagerEvent& event)
+{
+    m_memoryInfo.collectionsCount++;
+    event.begin = m_memoryInfo.timer.get<TSec>();
+    event.heapInfo.usedHeapSizeBeforeCollect = getUsedSize();
+    event.heapInfo.totalHeapSize = getTotalSize();
+}
+
+void GenerationalMemoryManager::endEvent(TMemoryManagerEvent& event)
+{
+    event.heapInfo.usedHeapSizeAfterCollect = getUsedSize();
+    event.timeDiff = m_memoryInfo.timer.get<TSec>() - event.begin;
+    m_memoryInfo.totalCollectionDelay += event.timeDiff.convertTo<TMicrosec>().toInt();
+    m_memoryInfo.events.push_front(event);
+    m_gcLogger->writeLogLine(event);
+}
+
+TMemoryManagerInfo GenerationalMemoryManager::getStat()
+{
+    TMemoryManagerInfo info = BakerMemoryManager::getStat();
+    info.leftToRightCollections = m_leftToRightCollections;
+    info.rightToLeftCollections = m_rightToLeftCollections;
+    info.rightCollectionDelay = m_rightCollectionDelay;
+    return info;
+}
+
+bool GenerationalMemoryManager::checkRoot(TObject* value, TObject** objectSlot)
+{
+    // Static slots referring to the dynamic heap are the static roots
+    if (isInStaticHeap(objectSlot))
+        return BakerMemoryManager::checkRoot(value, objectSlot);
+
+    // Young objects are scanned entirely on collection.
+    // Old slots are usually handled by writeBarrier() itself.
+    if (!m_oldSpace.contains(objectSlot))
+        return false;
+
+    markCard(objectSlot);
+    return true;
+}
@@ -0,0 +1,122 @@
+/*
+ *    HeapMemory.cpp
+ *
+ *    Allocation of the memory for the heap spaces
+ *    directly from the operating system
+ *
+ *    LLST (LLVM Smalltalk or Low Level Smalltalk) version 0.4
+ *
+ *    LLST is
+ *        Copyright (C) 2012-2015 by Dmitry Kashitsyn   <korvin@deeptown.org>
+ *        Copyright (C) 2012-2015 by Roman Proskuryakov <humbug@deeptown.org>
+ *
+ *    LLST is based on the LittleSmalltalk which is
+ *        Copyright (C) 1987-2005 by Timothy A. Budd
+ *        Copyright (C) 2007 by Charles R. Childers
+ *        Copyright (C) 2005-2007 by Danny Reinhold
+ *
+ *    Original license of LittleSmalltalk may be found in the LICENSE file.
+ *
+ *
+ *    This file is part of LLST.
+ *    LLST is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LLST is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LLST.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <memory.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+    #include <unistd.h>
+
+    #if !defined(MAP_ANONYMOUS)
+        #define MAP_ANONYMOUS MAP_ANON
+    #endif
+    #if !defined(MAP_NORESERVE)
+        #define MAP_NORESERVE 0
+    #endif
+#endif
+
+namespace {
+    bool useHugePages = false;
+
+    // Giving small areas back to the system costs more
+    // than clearing them and the subsequent page faults
+    const std::size_t MIN_RELEASED_SIZE = 64 * 1024;
+}
+
+void heapMemory::setHugePages(bool enabled)
+{
+    useHugePages = enabled;
+}
+
+uint8_t* heapMemory::allocate(std::size_t size)
+{
+#if defined(_WIN32)
+    return static_cast<uint8_t*>( std::calloc(size, 1) );
+#else
+    // Heaps are reserved for the maximal size, so the
+    // pages are committed only when they are touched
+    void* const base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return 0;
+
+    #if defined(MADV_HUGEPAGE)
+        if (useHugePages)
+            madvise(base, size, MADV_HUGEPAGE);
+    #endif
+
+    return static_cast<uint8_t*>(base);
+#endif
+}
+
+void heapMemory::release(uint8_t* base, std::size_t size)
+{
+    if (!base)
+        return;
+
+#if defined(_WIN32)
+    std::free(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+void heapMemory::reset(uint8_t* base, std::size_t size)
+{
+#if defined(__linux__)
+    if (size >= MIN_RELEASED_SIZE) {
+        // Private anonymous pages read as zeroes after MADV_DONTNEED.
+        // Partial pages at the edges are cleared by hand.
+        const uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+        uint8_t* const pagesBegin = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(base) + pageMask) & ~pageMask);
+        uint8_t* const pagesEnd   = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(base + size) & ~pageMask);
+
+        std::memset(base, 0, pagesBegin - base);
+        std::memset(pagesEnd, 0, base + size - pagesEnd);
+
+        if (madvise(pagesBegin, pagesEnd - pagesBegin, MADV_DONTNEED) == 0)
+            return;
+
+        // Pages are still in place, clearing them
+        std::memset(pagesBegin, 0, pagesEnd - pagesBegin);
+        return;
+    }
+#endif
+
+    std::memset(base, 0, size);
+}
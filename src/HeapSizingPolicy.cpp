@@ -0,0 +1,85 @@
+/*
+ *    HeapSizingPolicy.cpp
+ *
+ *    Choosing the heap size of the copying collectors
+ *
+ *    LLST (LLVM Smalltalk or Low Level Smalltalk) version 0.4
+ *
+ *    LLST is
+ *        Copyright (C) 2012-2015 by Dmitry Kashitsyn   <korvin@deeptown.org>
+ *        Copyright (C) 2012-2015 by Roman Proskuryakov <humbug@deeptown.org>
+ *
+ *    LLST is based on the LittleSmalltalk which is
+ *        Copyright (C) 1987-2005 by Timothy A. Budd
+ *        Copyright (C) 2007 by Charles R. Childers
+ *        Copyright (C) 2005-2007 by Danny Reinhold
+ *
+ *    Original license of LittleSmalltalk may be found in the LICENSE file.
+ *
+ *
+ *    This file is part of LLST.
+ *    LLST is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LLST is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LLST.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory.h>
+#include <algorithm>
+
+std::size_t THeapSizingPolicy::getNextHeapSize(const THeapSizingPolicy::TSample& sample)
+{
+    const std::size_t heapSize = sample.heapSize;
+    const std::size_t spaceSize = heapSize / 2;
+    const std::size_t freeSize = spaceSize > sample.usedAfter ? spaceSize - sample.usedAfter : 0;
+
+    // Amount of the memory allocated since the previous collection
+    const std::size_t allocated = sample.usedBefore > m_lastUsed ? sample.usedBefore - m_lastUsed : sample.usedBefore;
+    m_lastUsed = sample.usedAfter;
+
+    std::size_t nextHeapSize = heapSize;
+
+    if (m_goals.gcTimePercent) {
+        const double percent = std::min<uint32_t>(m_goals.gcTimePercent, 99);
+        const double interval = sample.pause * (100 - percent) / percent;
+        const double allocationRate = allocated / std::max(sample.mutatorTime, 1.0);
+        const double requiredFree = std::min(allocationRate * interval, static_cast<double>(m_maxHeapSize));
+
+        nextHeapSize = 2 * (sample.usedAfter + sample.requestedSize + static_cast<std::size_t>(requiredFree));
+    } else {
+        if (freeSize < heapSize / 16)
+            nextHeapSize = heapSize + heapSize / 2;
+
+        if (sample.usedAfter < heapSize / 16)
+            m_sparseCollections++;
+        else
+            m_sparseCollections = 0;
+
+        if (m_sparseCollections >= SHRINK_COLLECTIONS) {
+            nextHeapSize = heapSize / 2;
+            m_sparseCollections = 0;
+        }
+    }
+
+    if (m_goals.maxPause && sample.pause > m_goals.maxPause)
+        nextHeapSize = std::min(nextHeapSize, heapSize);
+
+    // Heap is resized gradually and small changes are not worth the effort
+    nextHeapSize = std::max(std::min(nextHeapSize, 2 * heapSize), heapSize / 2);
+    if (std::max(nextHeapSize, heapSize) - std::min(nextHeapSize, heapSize) < heapSize / 8)
+        nextHeapSize = heapSize;
+
+    // Live objects should fit with some space left for the allocations
+    const std::size_t minimalSize = 2 * (sample.usedAfter + sample.usedAfter / 4 + sample.requestedSize);
+    nextHeapSize = std::max(nextHeapSize, minimalSize);
+
+    return std::min(std::max(nextHeapSize, m_minHeapSize), m_maxHeapSize);
+}
@@ -48,6 +48,8 @@
 // Placeholder for root objects
 TGlobals globals;
 
+uint32_t hashedObjectsCount = 0;
+
 template<typename N>
 TObject* Image::getGlobal(const N* name) const {
     TDictionary* globalsDictionary = globals.globalsObject;
@@ -180,17 +182,58 @@ bool Image::loadImage(const std::string& fileName)
     globals.stringClass   = readObject<TClass>();
     globals.initialMethod = readObject<TMethod>();
 
-    for (int i = 0; i < 3; i++)
+    for (int i = 0; i < binaryBuiltIns::imageOperatorsCount; i++)
         globals.binaryMessages[i] = readObject();
 
     globals.badMethodSymbol = readObject<TSymbol>();
 
+    // Selectors of the rest operators are not stored in the image
+    for (int i = binaryBuiltIns::imageOperatorsCount; i < binaryBuiltIns::operatorsCount; i++)
+        globals.binaryMessages[i] = findSymbol( binaryBuiltIns::getOperatorName(static_cast<binaryBuiltIns::Operator>(i)) );
+
     std::fprintf(stdout, "Image read complete. Loaded %d objects\n", m_indirects.size());
     m_indirects.clear();
 
     return true;
 }
 
+TSymbol* Image::findSymbol(const char* name) const
+{
+    // Symbol table is the Tree held in the class variable of Symbol.
+    // Class variables follow the instance variables of Class.
+    TClass* symbolClass = getGlobal<TClass>("Symbol");
+    const uint32_t symbolsIndex = sizeof(TClass) / sizeof(TObject*) - 2;
+    if (!symbolClass || symbolClass->getSize() <= symbolsIndex)
+        return 0;
+
+    TObject* symbols = symbolClass->getField(symbolsIndex);
+    if (symbols == globals.nilObject)
+        return 0;
+
+    // Tree nodes are visited in any order, so the tree
+    // layout does not matter. Symbols are compared by content.
+    std::vector<TNode*> pendingNodes;
+    pendingNodes.push_back(static_cast<TNode*>(symbols->getField(0)));
+
+    const TSymbol::TCompareFunctor compare;
+    while (! pendingNodes.empty()) {
+        TNode* node = pendingNodes.back();
+        pendingNodes.pop_back();
+
+        if (node == globals.nilObject)
+            continue;
+
+        TSymbol* symbol = static_cast<TSymbol*>(node->value);
+        if (!compare(symbol, name) && !compare(name, symbol))
+            return symbol;
+
+        pendingNodes.push_back(node->left);
+        pendingNodes.push_back(node->right);
+    }
+
+    return 0;
+}
+
 void Image::ImageWriter::writeWord(std::ofstream& os, uint32_t word)
 {
     while (word >= 0xFF) {
@@ -308,7 +351,7 @@ void Image::ImageWriter::writeTo(const char* fileName)
     writeObject(os, m_globals.stringClass);
     writeObject(os, m_globals.initialMethod);
 
-    for (int i = 0; i < 3; i++)
+    for (int i = 0; i < binaryBuiltIns::imageOperatorsCount; i++)
         writeObject(os, m_globals.binaryMessages[i]);
 
     writeObject(os, m_globals.badMethodSymbol);
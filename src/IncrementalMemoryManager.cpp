@@ -0,0 +1,566 @@
+/*
+ *    IncrementalMemoryManager.cpp
+ *
+ *    Incremental copying collector with the page protection barrier
+ *
+ *    LLST (LLVM Smalltalk or Low Level Smalltalk) version 0.4
+ *
+ *    LLST is
+ *        Copyright (C) 2012-2015 by Dmitry Kashitsyn   <korvin@deeptown.org>
+ *        Copyright (C) 2012-2015 by Roman Proskuryakov <humbug@deeptown.org>
+ *
+ *    LLST is based on the LittleSmalltalk which is
+ *        Copyright (C) 1987-2005 by Timothy A. Budd
+ *        Copyright (C) 2007 by Charles R. Childers
+ *        Copyright (C) 2005-2007 by Danny Reinhold
+ *
+ *    Original license of LittleSmalltalk may be found in the LICENSE file.
+ *
+ *
+ *    This file is part of LLST.
+ *    LLST is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LLST is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LLST.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <memory.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <sys/mman.h>
+#include <unistd.h>
+
+IncrementalMemoryManager* IncrementalMemoryManager::s_activeManager = 0;
+struct sigaction IncrementalMemoryManager::s_previousAction;
+
+IncrementalMemoryManager::IncrementalMemoryManager() :
+    CheneyMemoryManager(), m_collecting(false), m_inCollector(false),
+    m_pauseTarget(DEFAULT_PAUSE_TARGET), m_newHeapSize(0), m_usedBeforeCollect(0),
+    m_allocatedSinceSlice(0), m_pagesBase(0), m_pageTable(), m_firstObjectTable(),
+    m_openPageTable(), m_pageStates(0), m_firstObjects(0), m_openPages(0),
+    m_openPagesCount(0), m_protectedPages(0), m_scannedPages(0), m_copyLimit(0),
+    m_fillerSize(0), m_fillerLimit(0), m_collectionBegin(), m_collectionPauses(0),
+    m_collectionLongestPause(0), m_pauseBegin(0)
+{
+    // Large objects are copied incrementally as the others
+    m_largeObjectThreshold = 0;
+}
+
+IncrementalMemoryManager::~IncrementalMemoryManager()
+{
+    // Heap is released by the base class, so it should not stay protected
+    if (m_collecting)
+        mprotect(m_pagesBase, m_reservedSize, PROT_READ | PROT_WRITE);
+
+    if (s_activeManager == this) {
+        sigaction(SIGSEGV, &s_previousAction, 0);
+        s_activeManager = 0;
+    }
+}
+
+bool IncrementalMemoryManager::initializeHeap(std::size_t heapSize, std::size_t maxHeapSize /* = 0 */)
+{
+    if (!CheneyMemoryManager::initializeHeap(heapSize, maxHeapSize))
+        return false;
+
+    // Page tables cover the whole reservation of a space. Open pages are
+    // reserved in advance, so the fault handler never allocates memory.
+    const std::size_t pagesCount = (m_reservedSize + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    m_pageTable.assign(pagesCount, PAGE_UNSCANNED);
+    m_firstObjectTable.assign(pagesCount, static_cast<uint8_t*>(0));
+    m_openPageTable.assign(pagesCount, 0);
+    m_pageStates   = & m_pageTable[0];
+    m_firstObjects = & m_firstObjectTable[0];
+    m_openPages    = & m_openPageTable[0];
+    m_openPagesCount = 0;
+
+    // Only one manager may own the handler. It is the last initialized one.
+    if (!s_activeManager) {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = faultHandler;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+
+        if (sigaction(SIGSEGV, &action, &s_previousAction) != 0) {
+            std::fprintf(stderr, "MM: Cannot install the fault handler\n");
+            return false;
+        }
+    }
+    s_activeManager = this;
+
+    return true;
+}
+
+void IncrementalMemoryManager::setSizingGoals(const THeapSizingGoals& goals)
+{
+    // Pauses are bounded by the slices, so the heap
+    // is sized only by the time spent in collections
+    THeapSizingGoals policyGoals(goals);
+    policyGoals.maxPause = 0;
+    m_sizingPolicy.setGoals(policyGoals);
+
+    m_pauseTarget = goals.maxPause ? goals.maxPause : static_cast<uint32_t>(DEFAULT_PAUSE_TARGET);
+}
+
+std::size_t IncrementalMemoryManager::getFillerLimit(std::size_t usedSize)
+{
+    // Every opened page may waste its tail
+    return std::max(correctPadding(usedSize / 8), static_cast<std::size_t>(16 * PAGE_SIZE));
+}
+
+void* IncrementalMemoryManager::allocate(std::size_t requestedSize, bool* gcOccured /*= 0*/ )
+{
+    assert(requestedSize == correctPadding(requestedSize));
+    if (gcOccured)
+        *gcOccured = false;
+
+    m_pendingAllocation = requestedSize;
+
+    // Object larger than a half of the space grows the heap at once
+    if (requestedSize > m_heapSize / 4 && !m_collecting) {
+        growHeap(requestedSize);
+        if (gcOccured)
+            *gcOccured = true;
+    }
+
+    for (std::size_t attempt = 0; attempt < 4; attempt++) {
+        if (!m_collecting && attempt == 0) {
+            // Collection is started while the rest of the space is able to
+            // hold the copies of all objects as well as the new ones
+            const std::size_t usedSize = m_heapSize / 2 - (m_activeHeapPointer - m_activeHeapBase) + requestedSize;
+            if (2 * (usedSize + getFillerLimit(usedSize)) > m_heapSize / 2) {
+                beginPause();
+                startCollection();
+                endPause();
+
+                if (gcOccured)
+                    *gcOccured = true;
+            }
+        }
+
+        // Allocations never reach the space reserved for the copies
+        uint8_t* const limit = m_collecting ? m_copyLimit : m_activeHeapBase;
+        if (m_activeHeapPointer < limit + requestedSize) {
+            beginPause();
+            if (m_collecting)
+                finishCollection();
+            else
+                startCollection();
+            endPause();
+
+            if (gcOccured)
+                *gcOccured = true;
+            continue;
+        }
+
+        m_pendingAllocation = 0;
+        m_activeHeapPointer -= requestedSize;
+        void* result = m_activeHeapPointer;
+
+        if (gcOccured && !*gcOccured)
+            m_memoryInfo.allocationsCount++;
+
+        // New object is not moved by the slice
+        if (m_collecting) {
+            m_allocatedSinceSlice += requestedSize;
+            if (m_allocatedSinceSlice >= SLICE_SIZE)
+                runSlice();
+        }
+
+        return result;
+    }
+
+    std::fprintf(stderr, "Could not allocate %u bytes in heap\n", requestedSize);
+    m_pendingAllocation = 0;
+    return 0;
+}
+
+void IncrementalMemoryManager::collectGarbage()
+{
+    // Objects allocated after the start of the current collection
+    // are not collected by it, so one more collection is performed
+    beginPause();
+    if (m_collecting)
+        finishCollection();
+
+    startCollection();
+    if (m_collecting)
+        finishCollection();
+    endPause();
+}
+
+void IncrementalMemoryManager::startCollection()
+{
+    // Part of the pause before the start is not accounted in the collection
+    m_collectionBegin = m_memoryInfo.timer.get<TSec>();
+    m_collectionPauses = m_pauseBegin - getTime();
+    m_collectionLongestPause = 0;
+
+    m_usedBeforeCollect = m_heapSize / 2 - (m_activeHeapPointer - m_activeHeapBase);
+    m_fillerLimit = getFillerLimit(m_usedBeforeCollect);
+
+    // Objects hashed in place get the hash slot when copied. Objects hashed
+    // during the collection are already copied, they are moved by the next one.
+    const std::size_t copiedSize = m_usedBeforeCollect + takeHashedObjects() * sizeof(TObject*);
+
+    // New space should hold all copies along with the pending allocation
+    const std::size_t requiredSize = 2 * correctPadding(copiedSize + m_fillerLimit + m_pendingAllocation + PAGE_SIZE);
+    m_newHeapSize = std::min(std::max(getNewHeapSize(copiedSize), requiredSize), 2 * m_reservedSize);
+
+    swapSpaces(m_newHeapSize);
+    m_pagesBase = m_activeHeapOne ? m_heapOne : m_heapTwo;
+
+    const uint32_t firstPage = getPage(m_activeHeapBase);
+    const uint32_t endPage   = getPage(m_activeHeapPointer - 1) + 1;
+    std::fill(m_pageStates + firstPage, m_pageStates + endPage, static_cast<uint8_t>(PAGE_UNSCANNED));
+    std::fill(m_firstObjects + firstPage, m_firstObjects + endPage, static_cast<uint8_t*>(0));
+    m_protectedPages = firstPage;
+    m_scannedPages   = firstPage;
+
+    // Copies and allocations never share a page
+    const uintptr_t copyEnd = reinterpret_cast<uintptr_t>(m_activeHeapBase) + copiedSize + m_fillerLimit;
+    m_copyLimit = std::min(reinterpret_cast<uint8_t*>((copyEnd + PAGE_SIZE - 1) & ~static_cast<uintptr_t>(PAGE_SIZE - 1)), m_activeHeapPointer);
+
+    m_scanPointer = m_activeHeapBase;
+    m_copyPointer = m_activeHeapBase;
+    m_fillerSize = 0;
+    m_allocatedSinceSlice = 0;
+    m_collecting = true;
+
+    // Only the objects referred by the roots are copied now
+    BakerMemoryManager::moveObjects();
+
+    if (m_scanPointer < m_copyPointer)
+        protectPages();
+    else
+        completeCollection();
+}
+
+void IncrementalMemoryManager::runSlice()
+{
+    m_allocatedSinceSlice = 0;
+    beginPause();
+
+    // Remaining work is bounded by the objects that may still be copied.
+    // It should be done before the allocations take the rest of the space.
+    const std::size_t copied = m_copyPointer - m_activeHeapBase;
+    const uint64_t remainingWork = (m_copyPointer - m_scanPointer) +
+        (m_usedBeforeCollect > copied ? m_usedBeforeCollect - copied : 0);
+    const uint64_t freeSize = m_activeHeapPointer - m_copyLimit;
+
+    std::size_t workSize = remainingWork;
+    if (freeSize > SLICE_SIZE)
+        workSize = std::max(static_cast<std::size_t>(2 * remainingWork * SLICE_SIZE / freeSize), static_cast<std::size_t>(SLICE_SIZE));
+
+    if (scanSlice(workSize, m_pauseBegin + m_pauseTarget))
+        completeCollection();
+    else
+        protectPages();
+
+    endPause();
+}
+
+void IncrementalMemoryManager::finishCollection()
+{
+    // The rest of the work is done at once
+    while (!scanSlice(static_cast<std::size_t>(-1), 0))
+        ;
+    completeCollection();
+}
+
+bool IncrementalMemoryManager::scanSlice(std::size_t workSize, double deadline)
+{
+    std::size_t work = 0;
+    uint32_t objectsCount = 0;
+
+    while (m_scanPointer < m_copyPointer) {
+        TMovableObject* const object = reinterpret_cast<TMovableObject*>(m_scanPointer);
+        scanObject(object);
+
+        const std::size_t slotSize = getSlotSize(object);
+        m_scanPointer += slotSize;
+        work += slotSize;
+
+        // All objects of the pages behind the scan pointer are scanned
+        const uint32_t scanPage = getPage(m_scanPointer);
+        for (; m_scannedPages < scanPage; m_scannedPages++)
+            markScanned(m_scannedPages);
+
+        if (work >= workSize)
+            break;
+
+        // Timer is not queried on every object
+        if (deadline && (++objectsCount % 64 == 0) && getTime() > deadline)
+            break;
+    }
+
+    return m_scanPointer >= m_copyPointer;
+}
+
+void IncrementalMemoryManager::scanObject(TMovableObject* object)
+{
+    // Header is read before the size of the whole object is known
+    uint8_t* const location = reinterpret_cast<uint8_t*>(object);
+    openRange(location, location + sizeof(TObject));
+    openRange(location, location + getSlotSize(object));
+
+    // Binary objects have only the class pointer
+    const uint32_t pointersCount = object->size.isBinary() ? 1 : object->size.getSize() + 1;
+    for (uint32_t index = 0; index < pointersCount; index++)
+        object->data[index] = moveObject(object->data[index]);
+}
+
+IncrementalMemoryManager::TMovableObject* IncrementalMemoryManager::moveObject(TMovableObject* object)
+{
+    if (isSmallInteger(reinterpret_cast<TObject*>(object)) || !isInOldSpace(object) || object->size.isRelocated())
+        return CheneyMemoryManager::moveObject(object);
+
+    uint8_t* const location = m_copyPointer;
+    const std::size_t slotSize = getCopySize(object);
+    if (location + slotSize > m_copyLimit) {
+        // Copy may be made by the fault handler, so stdio is not used
+        static const char message[] = "MM: Copies of the incremental collection exceed the reserved space\n";
+        write(STDERR_FILENO, message, sizeof(message) - 1);
+        std::abort();
+    }
+
+    openRange(location, location + slotSize);
+    TMovableObject* const copy = CheneyMemoryManager::moveObject(object);
+    recordObject(location, slotSize);
+
+    return copy;
+}
+
+void IncrementalMemoryManager::recordObject(uint8_t* location, std::size_t size)
+{
+    // Object covering the start of the page is the first one to scan
+    const uint32_t firstPage = getPage(location);
+    const uint32_t lastPage  = getPage(location + size - 1);
+
+    if (!m_firstObjects[firstPage])
+        m_firstObjects[firstPage] = location;
+    for (uint32_t page = firstPage + 1; page <= lastPage; page++)
+        m_firstObjects[page] = location;
+}
+
+void IncrementalMemoryManager::completeCollection()
+{
+    // Every copy is scanned, so the whole space is opened
+    openProtectedPages();
+    m_collecting = false;
+
+    const std::size_t liveSize = m_copyPointer - m_activeHeapBase;
+    m_activeHeapBase = m_copyPointer;
+    releaseInactiveSpace(m_newHeapSize);
+
+    m_memoryInfo.collectionsCount++;
+
+    // Collection takes the sum of its pauses
+    const double currentPause = getTime() - m_pauseBegin;
+    const double pauses = m_collectionPauses + currentPause;
+
+    TMemoryManagerEvent event("Incremental GC");
+    event.begin = m_collectionBegin;
+    event.heapInfo.usedHeapSizeBeforeCollect = m_usedBeforeCollect;
+    event.heapInfo.usedHeapSizeAfterCollect  = m_heapSize / 2 - (m_activeHeapPointer - m_activeHeapBase);
+    event.heapInfo.totalHeapSize = m_heapSize;
+    event.timeDiff = TDuration<TMicrosec>(pauses).convertTo<TSec>();
+    m_memoryInfo.totalCollectionDelay += static_cast<uint64_t>(pauses);
+
+    TMemoryManagerHeapEvent longestPause("Longest pause");
+    longestPause.usedHeapSizeBeforeCollect = m_usedBeforeCollect;
+    longestPause.usedHeapSizeAfterCollect  = liveSize;
+    longestPause.totalHeapSize = m_heapSize;
+    longestPause.timeDiff = TDuration<TMicrosec>(std::max(m_collectionLongestPause, currentPause)).convertTo<TSec>();
+    event.heapInfo.heapEvents.push_back(longestPause);
+
+    updateTargetHeapSize(event);
+
+    // Next collection starts when a half of the space is used,
+    // so the space should be twice as large as the live objects
+    const std::size_t requiredSize = 2 * correctPadding(2 * (liveSize + getFillerLimit(liveSize)));
+    m_targetHeapSize = std::min(std::max(m_targetHeapSize, requiredSize), 2 * m_reservedSize);
+
+    m_memoryInfo.events.push_front(event);
+    m_gcLogger->writeLogLine(event);
+}
+
+bool IncrementalMemoryManager::handleFault(uint8_t* location)
+{
+    if (!m_collecting || m_inCollector || location < m_pagesBase || location >= m_pagesBase + m_reservedSize)
+        return false;
+
+    const uint32_t page = getPage(location);
+    if (page >= m_protectedPages || m_pageStates[page] != PAGE_UNSCANNED)
+        return false;
+
+    // Handler runs in the signal context. It only scans the objects and
+    // changes the protection, so the fault is neither timed nor logged.
+    m_inCollector = true;
+
+    // Page that receives copies is filled up before it is opened. If the
+    // filler does not fit, the rest of the scan is done at once. Collection
+    // is completed by the next slice or allocation that reaches the limit.
+    uint8_t* const pageEnd = getPageBase(page + 1);
+    if (m_copyPointer < pageEnd && !padCopyPage()) {
+        while (!scanSlice(static_cast<std::size_t>(-1), 0))
+            ;
+        openProtectedPages();
+    } else {
+        uint8_t* object = m_firstObjects[page];
+        while (object && object < pageEnd && object < m_copyPointer) {
+            TMovableObject* const current = reinterpret_cast<TMovableObject*>(object);
+            scanObject(current);
+            object += getSlotSize(current);
+        }
+
+        markScanned(page);
+        protectPages();
+    }
+
+    m_inCollector = false;
+    return true;
+}
+
+bool IncrementalMemoryManager::padCopyPage()
+{
+    uint8_t* const pageEnd = getPageBase(getPage(m_copyPointer) + 1);
+
+    // Filler is the binary object of the minimal size of its header
+    std::size_t fillerSize = pageEnd - m_copyPointer;
+    if (fillerSize < sizeof(TByteObject))
+        fillerSize += sizeof(TByteObject);
+
+    if (m_fillerSize + fillerSize > m_fillerLimit || m_copyPointer + fillerSize > m_copyLimit)
+        return false;
+
+    uint8_t* const location = m_copyPointer;
+    openRange(location, location + fillerSize);
+
+    TMovableObject* const filler = new (location) TMovableObject(fillerSize - sizeof(TByteObject), true);
+    // Inline integer in the class slot is never moved
+    filler->data[0] = reinterpret_cast<TMovableObject*>(static_cast<TObject*>(TInteger(0)));
+    recordObject(location, fillerSize);
+
+    m_copyPointer += fillerSize;
+    m_fillerSize  += fillerSize;
+    return true;
+}
+
+void IncrementalMemoryManager::openRange(uint8_t* begin, uint8_t* end)
+{
+    const uint32_t lastPage = getPage(end - 1);
+    for (uint32_t page = getPage(begin); page <= lastPage; page++) {
+        if (page >= m_protectedPages || m_pageStates[page] != PAGE_UNSCANNED)
+            continue;
+
+        mprotect(getPageBase(page), PAGE_SIZE, PROT_READ | PROT_WRITE);
+        m_pageStates[page] = PAGE_OPEN;
+        m_openPages[m_openPagesCount++] = page;
+    }
+}
+
+void IncrementalMemoryManager::markScanned(uint32_t page)
+{
+    if (page < m_protectedPages && m_pageStates[page] == PAGE_UNSCANNED)
+        mprotect(getPageBase(page), PAGE_SIZE, PROT_READ | PROT_WRITE);
+    m_pageStates[page] = PAGE_SCANNED;
+}
+
+void IncrementalMemoryManager::protectPages()
+{
+    // Pages opened by the collector are closed unless they were scanned
+    for (uint32_t index = 0; index < m_openPagesCount; index++) {
+        const uint32_t page = m_openPages[index];
+        if (m_pageStates[page] == PAGE_OPEN) {
+            mprotect(getPageBase(page), PAGE_SIZE, PROT_NONE);
+            m_pageStates[page] = PAGE_UNSCANNED;
+        }
+    }
+    m_openPagesCount = 0;
+
+    // Pages of the new copies are protected by contiguous runs
+    const uint32_t endPage = getPage(m_copyPointer - 1) + 1;
+    uint32_t page = m_protectedPages;
+    while (page < endPage) {
+        if (m_pageStates[page] != PAGE_UNSCANNED) {
+            page++;
+            continue;
+        }
+
+        const uint32_t runBegin = page;
+        while (page < endPage && m_pageStates[page] == PAGE_UNSCANNED)
+            page++;
+        mprotect(getPageBase(runBegin), static_cast<std::size_t>(page - runBegin) << PAGE_SHIFT, PROT_NONE);
+    }
+
+    m_protectedPages = std::max(m_protectedPages, endPage);
+}
+
+void IncrementalMemoryManager::openProtectedPages()
+{
+    const uint32_t firstPage = getPage(m_activeHeapBase);
+    if (m_protectedPages > firstPage)
+        mprotect(getPageBase(firstPage), static_cast<std::size_t>(m_protectedPages - firstPage) << PAGE_SHIFT, PROT_READ | PROT_WRITE);
+
+    m_protectedPages = firstPage;
+    m_openPagesCount = 0;
+}
+
+void IncrementalMemoryManager::beginPause()
+{
+    m_inCollector = true;
+    m_pauseBegin = getTime();
+}
+
+void IncrementalMemoryManager::endPause()
+{
+    const double pause = getTime() - m_pauseBegin;
+    m_inCollector = false;
+
+    m_collectionPauses += pause;
+    m_collectionLongestPause = std::max(m_collectionLongestPause, pause);
+
+    m_memoryInfo.pausesCount++;
+    m_memoryInfo.longestPause = std::max(m_memoryInfo.longestPause, static_cast<uint64_t>(pause));
+}
+
+void IncrementalMemoryManager::faultHandler(int signal, siginfo_t* info, void* context)
+{
+    if (s_activeManager && s_activeManager->handleFault(static_cast<uint8_t*>(info->si_addr)))
+        return;
+
+    // Fault is not caused by the barrier, so it is passed to the previous
+    // handler. Own handler stays installed for the faults that follow.
+    if (s_previousAction.sa_flags & SA_SIGINFO) {
+        s_previousAction.sa_sigaction(signal, info, context);
+        return;
+    }
+
+    if (s_previousAction.sa_handler != SIG_DFL && s_previousAction.sa_handler != SIG_IGN) {
+        s_previousAction.sa_handler(signal);
+        return;
+    }
+
+    // Ignored fault would be restarted forever. Default action
+    // terminates the process when the instruction is restarted.
+    struct sigaction defaultAction;
+    std::memset(&defaultAction, 0, sizeof(defaultAction));
+    defaultAction.sa_handler = SIG_DFL;
+    sigemptyset(&defaultAction.sa_mask);
+    sigaction(signal, &defaultAction, 0);
+}
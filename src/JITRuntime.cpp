@@ -920,14 +920,12 @@ void JITRuntime::initializeGlobals() {
     GlobalValue* gContextClass = cast<GlobalValue>( m_JITModule->getOrInsertGlobal("Context", m_baseTypes.klass) );
     m_executionEngine->addGlobalMapping(gContextClass, reinterpret_cast<void*>(globals.contextClass));
 
-    GlobalValue* gmessageL = cast<GlobalValue>( m_JITModule->getOrInsertGlobal("<", m_baseTypes.symbol) );
-    m_executionEngine->addGlobalMapping(gmessageL, reinterpret_cast<void*>(globals.binaryMessages[0]));
-
-    GlobalValue* gmessageLE = cast<GlobalValue>( m_JITModule->getOrInsertGlobal("<=", m_baseTypes.symbol) );
-    m_executionEngine->addGlobalMapping(gmessageLE, reinterpret_cast<void*>(globals.binaryMessages[1]));
-
-    GlobalValue* gmessagePlus = cast<GlobalValue>( m_JITModule->getOrInsertGlobal("+", m_baseTypes.symbol) );
-    m_executionEngine->addGlobalMapping(gmessagePlus, reinterpret_cast<void*>(globals.binaryMessages[2]));
+    // Selectors of the binary operators are named after the operators themselves
+    for (int i = 0; i < binaryBuiltIns::operatorsCount; i++) {
+        const char* operatorName = binaryBuiltIns::getOperatorName(static_cast<binaryBuiltIns::Operator>(i));
+        GlobalValue* gmessage = cast<GlobalValue>( m_JITModule->getOrInsertGlobal(operatorName, m_baseTypes.symbol) );
+        m_executionEngine->addGlobalMapping(gmessage, reinterpret_cast<void*>(globals.binaryMessages[i]));
+    }
 }
 
 void JITRuntime::initializePassManager() {
@@ -978,7 +976,9 @@ void JITRuntime::initializeRuntimeAPI() {
     m_executionEngine->addGlobalMapping(m_runtimeAPI.emitBlockReturn, reinterpret_cast<void*>(& ::emitBlockReturn));
     m_executionEngine->addGlobalMapping(m_runtimeAPI.checkRoot, reinterpret_cast<void*>(& ::checkRoot));
     m_executionEngine->addGlobalMapping(m_runtimeAPI.bulkReplace, reinterpret_cast<void*>(& ::bulkReplace));
-    m_executionEngine->addGlobalMapping(m_runtimeAPI.callPrimitive, reinterpret_cast<void*>(& ::callPrimitive));
+    // JIT code passes the arguments packed into the array
+    TObject* (*callPrimitiveWithArray)(uint8_t, TObjectArray*, bool&) = & ::callPrimitive;
+    m_executionEngine->addGlobalMapping(m_runtimeAPI.callPrimitive, reinterpret_cast<void*>(callPrimitiveWithArray));
 
     //Type*  rootChainType = m_JITModule->getTypeByName("gc_stackentry")->getPointerTo();
     //GlobalValue* gRootChain    = cast<GlobalValue>( m_JITModule->getOrInsertGlobal("llvm_gc_root_chain", rootChainType) );
@@ -81,6 +81,9 @@ void LLVMMemoryManager::moveObjects()
             entry->roots[entryIndex] = object;
         }
     }
+
+    // Stack roots may refer to the large objects not reached before
+    scanLargeObjects();
 }
 
 LLVMMemoryManager::LLVMMemoryManager()
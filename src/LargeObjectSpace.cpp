@@ -0,0 +1,126 @@
+/*
+ *    LargeObjectSpace.cpp
+ *
+ *    Non-moving space for the large objects
+ *
+ *    LLST (LLVM Smalltalk or Low Level Smalltalk) version 0.4
+ *
+ *    LLST is
+ *        Copyright (C) 2012-2015 by Dmitry Kashitsyn   <korvin@deeptown.org>
+ *        Copyright (C) 2012-2015 by Roman Proskuryakov <humbug@deeptown.org>
+ *
+ *    LLST is based on the LittleSmalltalk which is
+ *        Copyright (C) 1987-2005 by Timothy A. Budd
+ *        Copyright (C) 2007 by Charles R. Childers
+ *        Copyright (C) 2005-2007 by Danny Reinhold
+ *
+ *    Original license of LittleSmalltalk may be found in the LICENSE file.
+ *
+ *
+ *    This file is part of LLST.
+ *    LLST is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LLST is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LLST.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory.h>
+
+TLargeObjectSpace::~TLargeObjectSpace()
+{
+    heapMemory::release(m_base, m_end - m_base);
+}
+
+bool TLargeObjectSpace::initialize(std::size_t size)
+{
+    size = (size + PAGE_SIZE - 1) & ~static_cast<std::size_t>(PAGE_SIZE - 1);
+
+    m_base = heapMemory::allocate(size);
+    if (!m_base)
+        return false;
+
+    m_end = m_base + size;
+    m_freeBlocks[m_base] = size;
+    return true;
+}
+
+void* TLargeObjectSpace::allocate(std::size_t size)
+{
+    const std::size_t blockSize = (sizeof(TBlock) + size + PAGE_SIZE - 1) & ~static_cast<std::size_t>(PAGE_SIZE - 1);
+
+    // Large objects are few, so the first fit is good enough
+    for (TFreeBlocks::iterator iBlock = m_freeBlocks.begin(); iBlock != m_freeBlocks.end(); ++iBlock) {
+        if (iBlock->second < blockSize)
+            continue;
+
+        uint8_t* const location = iBlock->first;
+        const std::size_t rest = iBlock->second - blockSize;
+        m_freeBlocks.erase(iBlock);
+        if (rest)
+            m_freeBlocks[location + blockSize] = rest;
+
+        TBlock* const block = reinterpret_cast<TBlock*>(location);
+        block->size   = blockSize;
+        block->marked = 0;
+
+        m_blocks.push_back(block);
+        m_usedSize += blockSize;
+
+        return location + sizeof(TBlock);
+    }
+
+    return 0;
+}
+
+void TLargeObjectSpace::sweep()
+{
+    std::size_t index = 0;
+    while (index < m_blocks.size()) {
+        TBlock* const block = m_blocks[index];
+
+        if (block->marked) {
+            block->marked = 0;
+            index++;
+            continue;
+        }
+
+        release(block);
+        m_blocks[index] = m_blocks.back();
+        m_blocks.pop_back();
+    }
+}
+
+void TLargeObjectSpace::release(TBlock* block)
+{
+    uint8_t* location = reinterpret_cast<uint8_t*>(block);
+    std::size_t size = block->size;
+
+    m_usedSize -= size;
+    heapMemory::reset(location, size);
+
+    // Merging with the free neighbours
+    TFreeBlocks::iterator iNext = m_freeBlocks.lower_bound(location);
+    if (iNext != m_freeBlocks.end() && iNext->first == location + size) {
+        size += iNext->second;
+        m_freeBlocks.erase(iNext++);
+    }
+
+    if (iNext != m_freeBlocks.begin()) {
+        TFreeBlocks::iterator iPrevious = iNext;
+        --iPrevious;
+        if (iPrevious->first + iPrevious->second == location) {
+            iPrevious->second += size;
+            return;
+        }
+    }
+
+    m_freeBlocks[location] = size;
+}
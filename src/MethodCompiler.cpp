@@ -936,59 +936,100 @@ void MethodCompiler::setNodeValue(TJITContext& jit, st::ControlNode* node, llvm:
 
 void MethodCompiler::doSendBinary(TJITContext& jit)
 {
-    // 0, 1 or 2 for '<', '<=' or '+' respectively
+    // Index of the operator in binaryBuiltIns::Operator
     binaryBuiltIns::Operator opcode = static_cast<binaryBuiltIns::Operator>(jit.currentNode->getInstruction().getArgument());
 
     Value* const rightValue = getArgument(jit, 1); // jit.popValue();
     Value* const leftValue  = getArgument(jit, 0); // jit.popValue();
 
-    // Checking if values are both small integers
-    Value* const rightIsInt  = jit.builder->CreateCall(m_baseFunctions.isSmallInteger, rightValue);
-    Value* const leftIsInt   = jit.builder->CreateCall(m_baseFunctions.isSmallInteger, leftValue);
-    Value* const isSmallInts = jit.builder->CreateAnd(rightIsInt, leftIsInt);
+    // Identity does not depend on the operand classes, so no message is ever sent
+    if (opcode == binaryBuiltIns::operatorIdentical) {
+        Value* const isIdentical = jit.builder->CreateICmpEQ(leftValue, rightValue);
+        Value* const boolObject  = jit.builder->CreateSelect(isIdentical, m_globals.trueObject, m_globals.falseObject, "bool.");
 
-    BasicBlock* const integersBlock   = BasicBlock::Create(m_JITModule->getContext(), "asIntegers.", jit.function);
+        Value* const resultHolder = protectProducerNode(jit, jit.currentNode, boolObject);
+        setNodeValue(jit, jit.currentNode, resultHolder);
+        return;
+    }
+
+    BasicBlock* integersBlock         = 0;
     BasicBlock* const sendBinaryBlock = BasicBlock::Create(m_JITModule->getContext(), "asObjects.",  jit.function);
     BasicBlock* const resultBlock     = BasicBlock::Create(m_JITModule->getContext(), "result.",     jit.function);
 
-    // Depending on the contents we may either do the integer operations
-    // directly or create a send message call using operand objects
-    jit.builder->CreateCondBr(isSmallInts, integersBlock, sendBinaryBlock);
-
-    // Now the integers part
-    jit.builder->SetInsertPoint(integersBlock);
-    Value* const rightInt = jit.builder->CreateCall(m_baseFunctions.getIntegerValue, rightValue);
-    Value* const leftInt  = jit.builder->CreateCall(m_baseFunctions.getIntegerValue, leftValue);
+    // Multiplication, division and shifts are left to the image code
+    const bool hasIntegerPath =
+        opcode != binaryBuiltIns::operatorMultiply &&
+        opcode != binaryBuiltIns::operatorIntegerDivide &&
+        opcode != binaryBuiltIns::operatorModulo &&
+        opcode != binaryBuiltIns::operatorBitShift;
 
-    Value* intResult       = 0; // this will be an immediate operation result
     Value* intResultObject = 0; // this will be actual object to return
-    switch (opcode) {
-        case binaryBuiltIns::operatorLess:     intResult = jit.builder->CreateICmpSLT(leftInt, rightInt); break;
-        case binaryBuiltIns::operatorLessOrEq: intResult = jit.builder->CreateICmpSLE(leftInt, rightInt); break;
-        case binaryBuiltIns::operatorPlus:     intResult = jit.builder->CreateAdd(leftInt, rightInt);     break;
-        default:
-            std::fprintf(stderr, "JIT: Invalid opcode %d passed to sendBinary\n", opcode);
-    }
+    if (hasIntegerPath) {
+        // Checking if values are both small integers
+        Value* const rightIsInt  = jit.builder->CreateCall(m_baseFunctions.isSmallInteger, rightValue);
+        Value* const leftIsInt   = jit.builder->CreateCall(m_baseFunctions.isSmallInteger, leftValue);
+        Value* const isSmallInts = jit.builder->CreateAnd(rightIsInt, leftIsInt);
+
+        integersBlock = BasicBlock::Create(m_JITModule->getContext(), "asIntegers.", jit.function);
+
+        // Depending on the contents we may either do the integer operations
+        // directly or create a send message call using operand objects
+        jit.builder->CreateCondBr(isSmallInts, integersBlock, sendBinaryBlock);
+
+        // Now the integers part
+        jit.builder->SetInsertPoint(integersBlock);
+        Value* const rightInt = jit.builder->CreateCall(m_baseFunctions.getIntegerValue, rightValue);
+        Value* const leftInt  = jit.builder->CreateCall(m_baseFunctions.getIntegerValue, leftValue);
+
+        Value* intResult  = 0; // this will be an immediate operation result
+        bool   isNumber   = true;
+        bool   mayOverflow = false;
+        switch (opcode) {
+            case binaryBuiltIns::operatorLess:        intResult = jit.builder->CreateICmpSLT(leftInt, rightInt); isNumber = false; break;
+            case binaryBuiltIns::operatorLessOrEq:    intResult = jit.builder->CreateICmpSLE(leftInt, rightInt); isNumber = false; break;
+            case binaryBuiltIns::operatorGreater:     intResult = jit.builder->CreateICmpSGT(leftInt, rightInt); isNumber = false; break;
+            case binaryBuiltIns::operatorGreaterOrEq: intResult = jit.builder->CreateICmpSGE(leftInt, rightInt); isNumber = false; break;
+            case binaryBuiltIns::operatorEqual:       intResult = jit.builder->CreateICmpEQ(leftInt, rightInt);  isNumber = false; break;
+            case binaryBuiltIns::operatorNotEqual:    intResult = jit.builder->CreateICmpNE(leftInt, rightInt);  isNumber = false; break;
+
+            case binaryBuiltIns::operatorPlus:   intResult = jit.builder->CreateAdd(leftInt, rightInt); mayOverflow = true; break;
+            case binaryBuiltIns::operatorMinus:  intResult = jit.builder->CreateSub(leftInt, rightInt); mayOverflow = true; break;
+            case binaryBuiltIns::operatorBitAnd: intResult = jit.builder->CreateAnd(leftInt, rightInt); break;
+            case binaryBuiltIns::operatorBitOr:  intResult = jit.builder->CreateOr(leftInt, rightInt);  break;
+            default:
+                std::fprintf(stderr, "JIT: Invalid opcode %d passed to sendBinary\n", opcode);
+        }
+
+        // Checking which operation was performed and
+        // processing the intResult object in the proper way
+        if (isNumber) {
+            // Result of arithmetic operation will be number.
+            // We need to create TInteger value and cast it to the pointer
 
-    // Checking which operation was performed and
-    // processing the intResult object in the proper way
-    if (opcode == binaryBuiltIns::operatorPlus) {
-        // Result of + operation will be number.
-        // We need to create TInteger value and cast it to the pointer
+            // Interpreting raw integer value as a pointer
+            Value* const smalltalkInt = jit.builder->CreateCall(m_baseFunctions.newInteger, intResult, "intAsPtr.");
+            intResultObject = jit.builder->CreateIntToPtr(smalltalkInt, m_baseTypes.object->getPointerTo());
+            intResultObject->setName("number.");
+        } else {
+            // Returning a bool object depending on the compare operation result
+            intResultObject = jit.builder->CreateSelect(intResult, m_globals.trueObject, m_globals.falseObject);
+            intResultObject->setName("bool.");
+        }
 
-        // Interpreting raw integer value as a pointer
-        Value* const smalltalkInt = jit.builder->CreateCall(m_baseFunctions.newInteger, intResult, "intAsPtr.");
-        intResultObject = jit.builder->CreateIntToPtr(smalltalkInt, m_baseTypes.object->getPointerTo());
-        intResultObject->setName("sum.");
+        if (mayOverflow) {
+            // Sum or difference of two 31 bit values fits into 32 bits. If it does
+            // not survive the tagging shift, the message is sent as for objects.
+            Value* const restoredInt = jit.builder->CreateAShr(jit.builder->CreateShl(intResult, 1), 1);
+            Value* const fitsSmallInt = jit.builder->CreateICmpEQ(restoredInt, intResult, "fits.");
+            jit.builder->CreateCondBr(fitsSmallInt, resultBlock, sendBinaryBlock);
+        } else {
+            // Jumping out the integersBlock to the value aggregator
+            jit.builder->CreateBr(resultBlock);
+        }
     } else {
-        // Returning a bool object depending on the compare operation result
-        intResultObject = jit.builder->CreateSelect(intResult, m_globals.trueObject, m_globals.falseObject);
-        intResultObject->setName("bool.");
+        jit.builder->CreateBr(sendBinaryBlock);
     }
 
-    // Jumping out the integersBlock to the value aggregator
-    jit.builder->CreateBr(resultBlock);
-
     // Now the sendBinary block
     jit.builder->SetInsertPoint(sendBinaryBlock);
     // We need to create an arguments array and fill it with argument objects
@@ -1034,7 +1075,8 @@ void MethodCompiler::doSendBinary(TJITContext& jit)
     // so we need to aggregate two possible results one of which
     // will be then selected as a return value
     PHINode* const phi = jit.builder->CreatePHI(m_baseTypes.object->getPointerTo(), 2, "phi.");
-    phi->addIncoming(intResultObject, integersBlock);
+    if (integersBlock)
+        phi->addIncoming(intResultObject, integersBlock);
     phi->addIncoming(sendMessageResult, sendBinaryBlock);
 
     Value* const resultHolder = protectProducerNode(jit, jit.currentNode, phi);
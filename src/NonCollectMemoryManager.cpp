@@ -160,3 +160,23 @@ TMemoryManagerInfo NonCollectMemoryManager::getStat() {
 
 }
 
+
+bool NonCollectMemoryManager::pinObject(TObject* object)
+{
+    if (isSmallInteger(object))
+        return false;
+
+    m_pinCounts[object]++;
+    return true;
+}
+
+bool NonCollectMemoryManager::unpinObject(TObject* object)
+{
+    std::map<TObject*, uint32_t>::iterator iPin = m_pinCounts.find(object);
+    if (iPin == m_pinCounts.end())
+        return false;
+
+    if (--iPin->second == 0)
+        m_pinCounts.erase(iPin);
+    return true;
+}
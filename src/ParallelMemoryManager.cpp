@@ -0,0 +1,357 @@
+/*
+ *    ParallelMemoryManager.cpp
+ *
+ *    Implementation of the copying garbage collector
+ *    that shares the work between several threads
+ *
+ *    LLST (LLVM Smalltalk or Low Level Smalltalk) version 0.4
+ *
+ *    LLST is
+ *        Copyright (C) 2012-2015 by Dmitry Kashitsyn   <korvin@deeptown.org>
+ *        Copyright (C) 2012-2015 by Roman Proskuryakov <humbug@deeptown.org>
+ *
+ *    LLST is based on the LittleSmalltalk which is
+ *        Copyright (C) 1987-2005 by Timothy A. Budd
+ *        Copyright (C) 2007 by Charles R. Childers
+ *        Copyright (C) 2005-2007 by Danny Reinhold
+ *
+ *    Original license of LittleSmalltalk may be found in the LICENSE file.
+ *
+ *
+ *    This file is part of LLST.
+ *    LLST is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LLST is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LLST.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory.h>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
+
+// Class slot of the copied object holds the tagged forwarding pointer.
+// Objects are aligned to the pointer size, so the tag bit is always free.
+static const uintptr_t FORWARDED_TAG = 2;
+
+ParallelMemoryManager::TWorker::TWorker(ParallelMemoryManager* manager, uint32_t index)
+    : manager(manager), index(index), thread(), deque(), bufferPointer(0), bufferEnd(0)
+{
+    pthread_mutex_init(&dequeLock, 0);
+}
+
+ParallelMemoryManager::TWorker::~TWorker()
+{
+    pthread_mutex_destroy(&dequeLock);
+}
+
+void ParallelMemoryManager::TWorker::push(TMovableObject* object)
+{
+    pthread_mutex_lock(&dequeLock);
+    deque.push_back(object);
+    pthread_mutex_unlock(&dequeLock);
+}
+
+ParallelMemoryManager::TMovableObject* ParallelMemoryManager::TWorker::pop()
+{
+    TMovableObject* object = 0;
+
+    pthread_mutex_lock(&dequeLock);
+    if (! deque.empty()) {
+        object = deque.back();
+        deque.pop_back();
+    }
+    pthread_mutex_unlock(&dequeLock);
+
+    return object;
+}
+
+ParallelMemoryManager::TMovableObject* ParallelMemoryManager::TWorker::steal()
+{
+    TMovableObject* object = 0;
+
+    // Thief does not wait for the owner
+    if (pthread_mutex_trylock(&dequeLock) != 0)
+        return 0;
+
+    if (! deque.empty()) {
+        object = deque.front();
+        deque.pop_front();
+    }
+    pthread_mutex_unlock(&dequeLock);
+
+    return object;
+}
+
+bool ParallelMemoryManager::TWorker::isEmpty()
+{
+    pthread_mutex_lock(&dequeLock);
+    const bool empty = deque.empty();
+    pthread_mutex_unlock(&dequeLock);
+
+    return empty;
+}
+
+ParallelMemoryManager::ParallelMemoryManager(uint32_t threadsCount /*= 0*/)
+    : CheneyMemoryManager(), m_threadsCount(threadsCount), m_workers(), m_rootSlots(), m_idleWorkers(0),
+    m_collectionEpoch(0), m_finishedWorkers(0), m_shutdown(false)
+{
+    if (! m_threadsCount) {
+        const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        m_threadsCount = (processors > 0) ? processors : 1;
+    }
+
+    pthread_mutex_init(&m_poolLock, 0);
+    pthread_cond_init(&m_startCondition, 0);
+    pthread_cond_init(&m_finishCondition, 0);
+}
+
+ParallelMemoryManager::~ParallelMemoryManager()
+{
+    pthread_mutex_lock(&m_poolLock);
+    m_shutdown = true;
+    pthread_cond_broadcast(&m_startCondition);
+    pthread_mutex_unlock(&m_poolLock);
+
+    // The first worker is the collecting thread itself
+    for (std::size_t index = 1; index < m_workers.size(); index++)
+        pthread_join(m_workers[index]->thread, 0);
+
+    for (std::size_t index = 0; index < m_workers.size(); index++)
+        delete m_workers[index];
+
+    pthread_cond_destroy(&m_finishCondition);
+    pthread_cond_destroy(&m_startCondition);
+    pthread_mutex_destroy(&m_poolLock);
+}
+
+void ParallelMemoryManager::startWorkers()
+{
+    for (uint32_t index = 0; index < m_threadsCount; index++) {
+        TWorker* const worker = new TWorker(this, index);
+        m_workers.push_back(worker);
+
+        if (index > 0 && pthread_create(&worker->thread, 0, workerThread, worker) != 0) {
+            std::fprintf(stderr, "MM: Could not start GC thread %u\n", index);
+            std::abort();
+        }
+    }
+}
+
+void* ParallelMemoryManager::workerThread(void* argument)
+{
+    TWorker& worker = * static_cast<TWorker*>(argument);
+    ParallelMemoryManager& manager = * worker.manager;
+
+    uint32_t lastEpoch = 0;
+    while (true) {
+        pthread_mutex_lock(&manager.m_poolLock);
+        while (!manager.m_shutdown && manager.m_collectionEpoch == lastEpoch)
+            pthread_cond_wait(&manager.m_startCondition, &manager.m_poolLock);
+
+        if (manager.m_shutdown) {
+            pthread_mutex_unlock(&manager.m_poolLock);
+            return 0;
+        }
+
+        lastEpoch = manager.m_collectionEpoch;
+        pthread_mutex_unlock(&manager.m_poolLock);
+
+        manager.collect(worker);
+
+        pthread_mutex_lock(&manager.m_poolLock);
+        manager.m_finishedWorkers++;
+        pthread_cond_signal(&manager.m_finishCondition);
+        pthread_mutex_unlock(&manager.m_poolLock);
+    }
+}
+
+void ParallelMemoryManager::moveObjects()
+{
+    if (m_workers.empty())
+        startWorkers();
+
+    // Live objects are placed at the bottom of the new space
+    m_copyPointer = m_activeHeapBase;
+
+    // Gathering all root slots, so they may be divided between the workers
+    m_rootSlots.clear();
+    for (TStaticRootsIterator iRoot = m_staticRoots.begin(); iRoot != m_staticRoots.end(); ++iRoot)
+        m_rootSlots.push_back(*iRoot);
+
+    for (std::size_t index = 0; index < m_handles.size(); index++) {
+        if (m_handles[index])
+            m_rootSlots.push_back(reinterpret_cast<TMovableObject**>(m_handles[index]));
+    }
+
+    for (object_ptr* pointer = m_externalPointersHead; pointer != 0; pointer = pointer->next)
+        m_rootSlots.push_back(reinterpret_cast<TMovableObject**>(&pointer->data));
+
+    for (std::size_t index = 0; index < m_workers.size(); index++) {
+        m_workers[index]->bufferPointer = 0;
+        m_workers[index]->bufferEnd     = 0;
+    }
+
+    m_idleWorkers = 0;
+
+    // Waking up the pool and doing our share of work
+    pthread_mutex_lock(&m_poolLock);
+    m_finishedWorkers = 0;
+    m_collectionEpoch++;
+    pthread_cond_broadcast(&m_startCondition);
+    pthread_mutex_unlock(&m_poolLock);
+
+    collect(*m_workers[0]);
+
+    pthread_mutex_lock(&m_poolLock);
+    while (m_finishedWorkers < m_workers.size() - 1)
+        pthread_cond_wait(&m_finishCondition, &m_poolLock);
+    pthread_mutex_unlock(&m_poolLock);
+
+    // Unused tails of the allocation buffers are lost until the next collection
+    m_activeHeapBase = m_copyPointer;
+}
+
+void ParallelMemoryManager::collect(TWorker& worker)
+{
+    // Each worker takes its own contiguous range of the root slots
+    const std::size_t workersCount = m_workers.size();
+    const std::size_t rootsCount   = m_rootSlots.size();
+    const std::size_t first = rootsCount * worker.index / workersCount;
+    const std::size_t last  = rootsCount * (worker.index + 1) / workersCount;
+
+    for (std::size_t index = first; index < last; index++) {
+        TMovableObject** const slot = m_rootSlots[index];
+        *slot = copyObject(worker, *slot);
+    }
+
+    while (TMovableObject* object = findWork(worker))
+        scanObject(worker, object);
+}
+
+ParallelMemoryManager::TMovableObject* ParallelMemoryManager::findWork(TWorker& worker)
+{
+    const std::size_t workersCount = m_workers.size();
+
+    while (true) {
+        if (TMovableObject* object = worker.pop())
+            return object;
+
+        for (std::size_t offset = 1; offset < workersCount; offset++) {
+            if (TMovableObject* object = m_workers[(worker.index + offset) % workersCount]->steal())
+                return object;
+        }
+
+        // Nothing to do. Collection is over when every worker gets here. Idle
+        // workers do not produce new work, so the deques stay empty after that.
+        __sync_fetch_and_add(&m_idleWorkers, 1);
+        while (true) {
+            if (m_idleWorkers == workersCount)
+                return 0;
+
+            bool hasWork = false;
+            for (std::size_t index = 0; index < workersCount && !hasWork; index++)
+                hasWork = ! m_workers[index]->isEmpty();
+
+            if (hasWork) {
+                __sync_fetch_and_sub(&m_idleWorkers, 1);
+                break;
+            }
+
+            sched_yield();
+        }
+    }
+}
+
+void ParallelMemoryManager::scanObject(TWorker& worker, TMovableObject* object)
+{
+    // Copy belongs to the worker that has taken it from the deque, so
+    // its fields are updated without any synchronization
+    const uint32_t pointersCount = object->size.isBinary() ? 1 : object->size.getSize() + 1;
+
+    for (uint32_t index = 0; index < pointersCount; index++)
+        object->data[index] = copyObject(worker, object->data[index]);
+}
+
+uint8_t* ParallelMemoryManager::allocateCopy(TWorker& worker, std::size_t size)
+{
+    if (worker.bufferPointer + size > worker.bufferEnd) {
+        // Taking the next chunk of the new space. Close to the end of the space
+        // the chunk is made smaller, so it does not run out before the live
+        // objects do. Object larger than the buffer is placed separately.
+        uint8_t* chunk = 0;
+        std::size_t chunkSize = 0;
+        do {
+            chunk = m_copyPointer;
+
+            const std::size_t available = m_activeHeapPointer - chunk;
+            if (available < size) {
+                std::fprintf(stderr, "MM: New space is exhausted during the parallel collection\n");
+                std::abort();
+            }
+
+            chunkSize = (available < BUFFER_SIZE) ? available : static_cast<std::size_t>(BUFFER_SIZE);
+            if (chunkSize < size)
+                chunkSize = size;
+        } while (__sync_val_compare_and_swap(&m_copyPointer, chunk, chunk + chunkSize) != chunk);
+
+        if (size > BUFFER_SIZE)
+            return chunk;
+
+        worker.bufferPointer = chunk;
+        worker.bufferEnd     = chunk + chunkSize;
+    }
+
+    uint8_t* const result = worker.bufferPointer;
+    worker.bufferPointer += size;
+    return result;
+}
+
+ParallelMemoryManager::TMovableObject* ParallelMemoryManager::copyObject(TWorker& worker, TMovableObject* object)
+{
+    // Inline integers and objects outside of the collected space stay as is
+    if (isSmallInteger(reinterpret_cast<TObject*>(object)))
+        return object;
+
+    if (!isInOldSpace(object)) {
+        // Large object is scanned in place by the worker that marked it
+        if (m_largeObjects.contains(object) && m_largeObjects.mark(object))
+            worker.push(object);
+        return object;
+    }
+
+    TMovableObject* const klass = object->data[0];
+    if (reinterpret_cast<uintptr_t>(klass) & FORWARDED_TAG)
+        return reinterpret_cast<TMovableObject*>(reinterpret_cast<uintptr_t>(klass) & ~FORWARDED_TAG);
+
+    // Copying the object speculatively
+    const std::size_t slotSize = getCopySize(object);
+    uint8_t* const location = allocateCopy(worker, slotSize);
+
+    // Class slot may be already replaced by the forwarding pointer of the other worker
+    TMovableObject* const copy = copyObjectTo(location, object);
+    copy->data[0] = klass;
+
+    TMovableObject* const forwarding = reinterpret_cast<TMovableObject*>(reinterpret_cast<uintptr_t>(copy) | FORWARDED_TAG);
+    TMovableObject* const previous = __sync_val_compare_and_swap(&object->data[0], klass, forwarding);
+
+    if (previous == klass) {
+        worker.push(copy);
+        return copy;
+    }
+
+    // Other worker was first. Our copy was the last one in the buffer.
+    if (location + slotSize == worker.bufferPointer)
+        worker.bufferPointer = location;
+
+    return reinterpret_cast<TMovableObject*>(reinterpret_cast<uintptr_t>(previous) & ~FORWARDED_TAG);
+}
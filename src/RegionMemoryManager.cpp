@@ -0,0 +1,361 @@
+/*
+ *    RegionMemoryManager.cpp
+ *
+ *    Non collecting memory manager with the stack of regions
+ *    that are discarded at once when popped
+ *
+ *    LLST (LLVM Smalltalk or Low Level Smalltalk) version 0.4
+ *
+ *    LLST is
+ *        Copyright (C) 2012-2015 by Dmitry Kashitsyn   <korvin@deeptown.org>
+ *        Copyright (C) 2012-2015 by Roman Proskuryakov <humbug@deeptown.org>
+ *
+ *    LLST is based on the LittleSmalltalk which is
+ *        Copyright (C) 1987-2005 by Timothy A. Budd
+ *        Copyright (C) 2007 by Charles R. Childers
+ *        Copyright (C) 2005-2007 by Danny Reinhold
+ *
+ *    Original license of LittleSmalltalk may be found in the LICENSE file.
+ *
+ *
+ *    This file is part of LLST.
+ *    LLST is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    LLST is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with LLST.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+RegionMemoryManager::RegionMemoryManager() :
+    NonCollectMemoryManager(), m_reservedSize(0), m_base(0), m_top(0), m_regions(),
+    m_externalPointersHead(0), m_popBase(0), m_popTop(0), m_scratchBase(0), m_scratchTop(0),
+    m_contextStack(), m_scannedContexts()
+{
+}
+
+RegionMemoryManager::~RegionMemoryManager()
+{
+    heapMemory::release(m_base, m_reservedSize);
+}
+
+bool RegionMemoryManager::initializeHeap(size_t heapSize, size_t maxHeapSize /*= 0*/)
+{
+    // Nothing is collected outside of the regions, so
+    // the heap is reserved for its maximal size at once
+    m_reservedSize = correctPadding(std::max(heapSize, maxHeapSize));
+    m_base = heapMemory::allocate(m_reservedSize);
+    if (!m_base)
+        return false;
+
+    m_top = m_base;
+    m_heapSize = m_reservedSize;
+
+    updateYoungRange();
+    return true;
+}
+
+void* RegionMemoryManager::allocate(size_t requestedSize, bool* gcOccured /*= 0*/)
+{
+    if (gcOccured)
+        *gcOccured = false;
+
+    if (requestedSize > static_cast<std::size_t>(m_base + m_reservedSize - m_top)) {
+        std::fprintf(stderr, "Could not allocate %u bytes in region heap\n", static_cast<uint32_t>(requestedSize));
+        return 0;
+    }
+
+    void* const result = m_top;
+    m_top += requestedSize;
+
+    m_memoryInfo.allocationsCount++;
+    return result;
+}
+
+void RegionMemoryManager::updateYoungRange()
+{
+    // Stores to the slots of the innermost region are not tracked
+    uint8_t* const base = m_regions.empty() ? m_base : m_regions.back().base;
+
+    m_youngBase = reinterpret_cast<uintptr_t>(base);
+    m_youngEnd  = reinterpret_cast<uintptr_t>(m_base + m_reservedSize);
+}
+
+bool RegionMemoryManager::checkRoot(TObject* value, TObject** objectSlot)
+{
+    if (m_regions.empty() || isSmallInteger(value))
+        return false;
+
+    uint8_t* const target = reinterpret_cast<uint8_t*>(value);
+    if (target < m_regions.front().base || target >= m_top)
+        return false;
+
+    // Region of the value is the innermost one that starts below it
+    std::size_t index = m_regions.size() - 1;
+    while (target < m_regions[index].base)
+        index--;
+
+    // Slots of the same or newer regions are popped before the value
+    uint8_t* const slot = reinterpret_cast<uint8_t*>(objectSlot);
+    if (slot >= m_regions[index].base && slot < m_top)
+        return false;
+
+    remember(m_regions[index], objectSlot);
+    return true;
+}
+
+void RegionMemoryManager::remember(TRegion& region, TObject** slot)
+{
+    std::vector<TObject**>& slots = region.rememberedSlots;
+    slots.push_back(slot);
+
+    // Slots written repeatedly are kept once
+    if (slots.size() >= region.rememberedLimit) {
+        std::sort(slots.begin(), slots.end());
+        slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+        region.rememberedLimit = std::max<std::size_t>(MIN_REMEMBERED_LIMIT, 2 * slots.size());
+    }
+}
+
+bool RegionMemoryManager::pushRegion()
+{
+    m_regions.push_back(TRegion(m_top));
+    updateYoungRange();
+    return true;
+}
+
+bool RegionMemoryManager::popRegion()
+{
+    if (m_regions.empty())
+        return false;
+
+    m_memoryInfo.collectionsCount++;
+    TMemoryManagerEvent event("Region pop");
+    event.begin = m_memoryInfo.timer.get<TSec>();
+    event.heapInfo.usedHeapSizeBeforeCollect = m_top - m_base;
+    event.heapInfo.totalHeapSize = m_reservedSize;
+
+    std::vector<TObject**> rememberedSlots;
+    rememberedSlots.swap(m_regions.back().rememberedSlots);
+
+    m_popBase = m_regions.back().base;
+    m_popTop  = m_top;
+    m_regions.pop_back();
+
+    // Hashed objects get the hash slot when promoted, so in
+    // the worst case promoted objects take twice the region
+    const std::size_t regionSize = m_popTop - m_popBase;
+    m_scratchBase = regionSize ? heapMemory::allocate(2 * regionSize) : 0;
+    m_scratchTop  = m_scratchBase;
+
+    if (regionSize && !m_scratchBase) {
+        std::fprintf(stderr, "MM: Cannot allocate %u bytes for the region promotion\n", static_cast<uint32_t>(2 * regionSize));
+        std::abort();
+    }
+
+    // Handles and external pointers refer the objects of the running code
+    for (std::size_t index = 0; index < m_handles.size(); index++) {
+        TObject** const slot = m_handles[index];
+        if (slot)
+            *slot = promoteObject(*slot);
+    }
+
+    for (object_ptr* pointer = m_externalPointersHead; pointer; pointer = pointer->next)
+        pointer->data = promoteObject(pointer->data);
+
+    for (std::size_t index = 0; index < rememberedSlots.size(); index++)
+        promoteSlot(rememberedSlots[index]);
+
+    scanPromotedObjects();
+
+    // Promoted objects take the place of the popped region
+    const std::size_t promotedSize = m_scratchTop - m_scratchBase;
+    if (m_popBase + promotedSize > m_base + m_reservedSize) {
+        std::fprintf(stderr, "MM: Region heap of %u bytes is exhausted\n", static_cast<uint32_t>(m_reservedSize));
+        std::abort();
+    }
+
+    if (promotedSize)
+        std::memcpy(m_popBase, m_scratchBase, promotedSize);
+
+    m_top = m_popBase + promotedSize;
+    if (m_top < m_popTop)
+        heapMemory::reset(m_top, m_popTop - m_top);
+
+    heapMemory::release(m_scratchBase, 2 * regionSize);
+    m_scratchBase = 0;
+    m_scratchTop  = 0;
+    m_scannedContexts.clear();
+    updateYoungRange();
+
+    event.heapInfo.usedHeapSizeAfterCollect = m_top - m_base;
+    event.timeDiff = m_memoryInfo.timer.get<TSec>() - event.begin;
+    m_memoryInfo.totalCollectionDelay += event.timeDiff.convertTo<TMicrosec>().toInt();
+    m_memoryInfo.events.push_front(event);
+    IMemoryManager::m_gcLogger->writeLogLine(event);
+    return true;
+}
+
+void* RegionMemoryManager::allocateNonMoving(size_t requestedSize, bool* gcOccured /*= 0*/)
+{
+    if (gcOccured)
+        *gcOccured = false;
+
+    // New objects belong to the innermost region
+    if (!m_regions.empty())
+        return 0;
+
+    return allocate(requestedSize, gcOccured);
+}
+
+bool RegionMemoryManager::pinObject(TObject* object)
+{
+    uint8_t* const address = reinterpret_cast<uint8_t*>(object);
+    if (!m_regions.empty() && address >= m_regions.front().base && address < m_top)
+        return false;
+
+    return NonCollectMemoryManager::pinObject(object);
+}
+
+TObject* RegionMemoryManager::promoteObject(TObject* object)
+{
+    if (isSmallInteger(object))
+        return object;
+
+    uint8_t* const address = reinterpret_cast<uint8_t*>(object);
+    if (address < m_popBase || address >= m_popTop) {
+        // Contexts of the older regions are written without the write barrier
+        if (address >= m_base && address < m_popBase && isContext(object) && m_scannedContexts.insert(object).second)
+            m_contextStack.push_back(object);
+
+        return object;
+    }
+
+    TMovableObject* const movable = reinterpret_cast<TMovableObject*>(object);
+    if (movable->size.isRelocated())
+        return reinterpret_cast<TObject*>(movable->data[0]);
+
+    std::size_t slotSize = sizeof(TObject) + object->getBodySize();
+    if (movable->size.hasHashSlot())
+        slotSize += sizeof(TObject*);
+
+    uint8_t* const copy = m_scratchTop;
+    std::memcpy(copy, address, slotSize);
+
+    // Hash of the object that was never moved is derived from its address
+    if (movable->size.isHashed() && !movable->size.hasHashSlot()) {
+        *reinterpret_cast<TObject**>(copy + slotSize) = TInteger(static_cast<int32_t>(getAddressHash(object)));
+        reinterpret_cast<TMovableObject*>(copy)->size.setHashSlot();
+        slotSize += sizeof(TObject*);
+    }
+
+    // Forwarding address is the final place of the copy in the parent region
+    TObject* const promoted = reinterpret_cast<TObject*>(m_popBase + (copy - m_scratchBase));
+    m_scratchTop += slotSize;
+
+    movable->size.setRelocated();
+    movable->data[0] = reinterpret_cast<TMovableObject*>(promoted);
+    return promoted;
+}
+
+void RegionMemoryManager::promoteSlot(TObject** slot)
+{
+    TObject* const value = promoteObject(*slot);
+    *slot = value;
+
+    // Promoted objects belong to the parent region now, so its
+    // remembered list gets the older slots referring to them
+    if (m_regions.empty() || isSmallInteger(value) || reinterpret_cast<uint8_t*>(value) < m_popBase)
+        return;
+
+    if (reinterpret_cast<uint8_t*>(slot) < m_regions.back().base || reinterpret_cast<uint8_t*>(slot) >= m_popBase)
+        remember(m_regions.back(), slot);
+}
+
+void RegionMemoryManager::scanOutsideContext(TObject* context)
+{
+    TObject** const fields = context->getFields();
+    for (uint32_t index = 0; index < context->getSize(); index++)
+        promoteSlot(&fields[index]);
+
+    // Arguments, temporaries and stack arrays of the context are
+    // written by the VM without the write barrier too
+    for (uint32_t index = 1; index <= 3 && index < context->getSize(); index++) {
+        TObject* const array = fields[index];
+        uint8_t* const address = reinterpret_cast<uint8_t*>(array);
+
+        if (isSmallInteger(array) || address < m_base || address >= m_popBase || array->isBinary())
+            continue;
+
+        if (!m_scannedContexts.insert(array).second)
+            continue;
+
+        for (uint32_t field = 0; field < array->getSize(); field++)
+            promoteSlot(&array->getFields()[field]);
+    }
+}
+
+void RegionMemoryManager::scanPromotedObjects()
+{
+    // Copies are scanned in the Cheney manner. Outside contexts
+    // found on the way are scanned until nothing is left.
+    uint8_t* scan = m_scratchBase;
+
+    while (scan < m_scratchTop || !m_contextStack.empty()) {
+        while (scan < m_scratchTop) {
+            TMovableObject* const object = reinterpret_cast<TMovableObject*>(scan);
+            scan += sizeof(TObject) + reinterpret_cast<TObject*>(object)->getBodySize();
+            if (object->size.hasHashSlot())
+                scan += sizeof(TObject*);
+
+            // Binary objects have only the class pointer
+            const uint32_t pointersCount = object->size.isBinary() ? 1 : object->size.getSize() + 1;
+            for (uint32_t index = 0; index < pointersCount; index++) {
+                TObject* const field = reinterpret_cast<TObject*>(object->data[index]);
+                object->data[index] = reinterpret_cast<TMovableObject*>(promoteObject(field));
+            }
+        }
+
+        if (!m_contextStack.empty()) {
+            TObject* const context = m_contextStack.back();
+            m_contextStack.pop_back();
+            scanOutsideContext(context);
+        }
+    }
+}
+
+bool RegionMemoryManager::isContext(TObject* object)
+{
+    // Classes reside in the static heap, so the class pointer is valid
+    TClass* const klass = object->getClass();
+    return klass == globals.contextClass || klass == globals.blockClass;
+}
+
+void RegionMemoryManager::registerExternalHeapPointer(object_ptr& pointer)
+{
+    pointer.next = m_externalPointersHead;
+    m_externalPointersHead = &pointer;
+}
+
+void RegionMemoryManager::releaseExternalHeapPointer(object_ptr& pointer)
+{
+    object_ptr** link = &m_externalPointersHead;
+    while (*link && *link != &pointer)
+        link = &(*link)->next;
+
+    if (*link)
+        *link = pointer.next;
+}
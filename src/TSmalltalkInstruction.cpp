@@ -198,14 +198,10 @@ std::string st::TSmalltalkInstruction::toString() const
         } break;
         case opcode::sendBinary: {
             ss << "SendBinary ";
-            switch(argument) {
-                case binaryBuiltIns::operatorPlus:     ss << "+";  break;
-                case binaryBuiltIns::operatorLess:     ss << "<";  break;
-                case binaryBuiltIns::operatorLessOrEq: ss << "<="; break;
-                default: {
-                    throw std::runtime_error(errSs.str());
-                }
-            }
+            const char* operatorName = binaryBuiltIns::getOperatorName(static_cast<binaryBuiltIns::Operator>(argument));
+            if (! operatorName)
+                throw std::runtime_error(errSs.str());
+            ss << operatorName;
         } break;
         case opcode::doSpecial: {
             ss << "Special ";
@@ -37,6 +37,18 @@
 #include <iostream>
 #include <cstdlib>
 #include <sstream>
+#include <cstring>
+
+// Stream wraps negative numbers around instead of failing, so they are
+// rejected before parsing. Trailing garbage is not a number either.
+static bool readSize(const char* text, std::size_t& value)
+{
+    if (std::strchr(text, '-'))
+        return false;
+
+    std::istringstream stream(text);
+    return (stream >> value) && stream.eof();
+}
 
 void args::parse(int argc, char **argv)
 {
@@ -47,6 +59,13 @@ void args::parse(int argc, char **argv)
         heap_max = 'H',
         heap = 'h',
         mm_type = 'm',
+        lookup_cache = 'l',
+        gc_threads = 'g',
+        nursery = 'n',
+        huge_pages = 'p',
+        gc_time = 't',
+        max_pause = 'P',
+        large_object = 'L',
 
         getopt_set_arg = 0,
         getopt_err = '?',
@@ -59,6 +78,13 @@ void args::parse(int argc, char **argv)
         {"heap",       required_argument, 0, heap},
         {"image",      required_argument, 0, image},
         {"mm_type",    required_argument, 0, mm_type},
+        {"lookup_cache", required_argument, 0, lookup_cache},
+        {"gc_threads", required_argument, 0, gc_threads},
+        {"nursery",    required_argument, 0, nursery},
+        {"huge_pages", no_argument,       0, huge_pages},
+        {"gc_time",    required_argument, 0, gc_time},
+        {"max_pause",  required_argument, 0, max_pause},
+        {"large_object", required_argument, 0, large_object},
         {"help",       no_argument,       0, help},
         {"version",    no_argument,       0, version},
         {0, 0, 0, 0}
@@ -83,7 +109,7 @@ void args::parse(int argc, char **argv)
                 memoryManagerType = optarg;
             } break;
             case heap: {
-                bool good_number = std::istringstream( optarg ) >> heapSize;
+                bool good_number = readSize(optarg, heapSize);
                 if (!good_number)
                 {
                     std::cerr << "A malformed number is given for argument heap_size" << std::endl;
@@ -91,13 +117,64 @@ void args::parse(int argc, char **argv)
                 }
             } break;
             case heap_max: {
-                bool good_number = std::istringstream( optarg ) >> maxHeapSize;
+                bool good_number = readSize(optarg, maxHeapSize);
                 if (!good_number)
                 {
                     std::cerr << "A malformed number is given for argument max_heap_size" << std::endl;
                     std::exit(1);
                 }
             } break;
+            case lookup_cache: {
+                bool good_number = readSize(optarg, lookupCacheSize);
+                if (!good_number || lookupCacheSize == 0 || lookupCacheSize > MAX_LOOKUP_CACHE_SIZE)
+                {
+                    std::cerr << "Argument lookup_cache should be a number from 1 to " << MAX_LOOKUP_CACHE_SIZE << std::endl;
+                    std::exit(1);
+                }
+            } break;
+            case gc_threads: {
+                bool good_number = readSize(optarg, gcThreads);
+                if (!good_number)
+                {
+                    std::cerr << "A malformed number is given for argument gc_threads" << std::endl;
+                    std::exit(1);
+                }
+            } break;
+            case nursery: {
+                bool good_number = readSize(optarg, nurserySize);
+                if (!good_number)
+                {
+                    std::cerr << "A malformed number is given for argument nursery" << std::endl;
+                    std::exit(1);
+                }
+            } break;
+            case gc_time: {
+                bool good_number = readSize(optarg, gcTime);
+                if (!good_number || gcTime > 100)
+                {
+                    std::cerr << "A malformed percent is given for argument gc_time" << std::endl;
+                    std::exit(1);
+                }
+            } break;
+            case max_pause: {
+                bool good_number = readSize(optarg, maxPause);
+                if (!good_number)
+                {
+                    std::cerr << "A malformed number is given for argument max_pause" << std::endl;
+                    std::exit(1);
+                }
+            } break;
+            case large_object: {
+                bool good_number = readSize(optarg, largeObjectThreshold);
+                if (!good_number)
+                {
+                    std::cerr << "A malformed number is given for argument large_object" << std::endl;
+                    std::exit(1);
+                }
+            } break;
+            case huge_pages: {
+                hugePages = true;
+            } break;
             case help: {
                 showHelp = true;
             } break;
@@ -122,7 +199,20 @@ std::string args::getHelp()
         "  -h, --heap <number>              Starting <number> of the heap in bytes\n"
         "  -H, --heap_max <number>          Maximum allowed heap size\n"
         "  -i, --image <path>               Path to image\n"
-        "      --mm_type arg (=copy)        Choose memory manager. nc - NonCollect, copy - Stop-and-Copy\n"
+        "      --mm_type arg (=copy)        Choose memory manager. nc - NonCollect, copy - Stop-and-Copy,\n"
+        "                                   cheney - Stop-and-Copy with breadth first traversal,\n"
+        "                                   parallel - Stop-and-Copy performed by several threads,\n"
+        "                                   gen - Generational,\n"
+        "                                   incremental - Copying in slices bounded by --max_pause,\n"
+        "                                   region - NonCollect with regions discarded by Block>>inRegion\n"
+        "      --lookup_cache <number>      Number of entries in the method lookup cache\n"
+        "      --gc_threads <number>        Number of threads of the parallel collector (=number of processors)\n"
+        "      --nursery <number>           Size of the generational collector nursery in bytes (=heap / 4)\n"
+        "      --gc_time <percent>          Resize the heap so that collections take <percent> of the time\n"
+        "      --max_pause <number>         Do not grow the heap while pauses exceed <number> milliseconds,\n"
+        "                                   slice time of the incremental collector (=1)\n"
+        "      --large_object <number>      Objects of <number> bytes and larger are never moved (=65536, 0 disables)\n"
+        "      --huge_pages                 Back the heap with transparent huge pages where supported\n"
         "  -V, --version                    Display the version number and copyrights of the invoked LLST\n"
         "      --help                       Display this information and quit";
 }
@@ -55,6 +55,7 @@ int main(int argc, char **argv) {
     llstArgs.heapSize = 1048576;
     llstArgs.maxHeapSize = 1048576 * 100;
     llstArgs.imagePath = "../image/LittleSmalltalk.image";
+    llstArgs.lookupCacheSize = 2048;
 
     llstArgs.parse(argc, argv);
 
@@ -79,20 +80,53 @@ int main(int argc, char **argv) {
             mm = new BakerMemoryManager();
         #endif
     }
+    #if !defined(LLVM)
+    else if(llstArgs.memoryManagerType == "cheney") {
+        // JIT stack roots are handled by the LLVMMemoryManager only
+        mm = new CheneyMemoryManager();
+    }
+    else if(llstArgs.memoryManagerType == "parallel") {
+        mm = new ParallelMemoryManager(llstArgs.gcThreads);
+    }
+    else if(llstArgs.memoryManagerType == "gen") {
+        mm = new GenerationalMemoryManager(llstArgs.nurserySize);
+    }
+    else if(llstArgs.memoryManagerType == "incremental") {
+        mm = new IncrementalMemoryManager();
+    }
+    else if(llstArgs.memoryManagerType == "region") {
+        mm = new RegionMemoryManager();
+    }
+    #endif
     else{
         std::cout << "error: wrong option --mm_type=" << llstArgs.memoryManagerType << ";\n"
                   << "defined options for memory manager type:\n"
                   << "\"copy\" (default) - copying garbage collector;\n"
+                  #if !defined(LLVM)
+                  << "\"cheney\" - copying garbage collector with breadth first traversal;\n"
+                  << "\"parallel\" - copying garbage collector running in --gc_threads threads;\n"
+                  << "\"gen\" - generational garbage collector with the --nursery sized young space;\n"
+                  << "\"incremental\" - copying garbage collector with pauses bounded by --max_pause;\n"
+                  << "\"region\" - non-collecting memory manager with regions popped by Block>>inRegion;\n"
+                  #endif
                   << "\"nc\" - non-collecting memory manager.\n";
         return EXIT_FAILURE;
     }
     std::auto_ptr<IMemoryManager> memoryManager(mm);
+    heapMemory::setHugePages(llstArgs.hugePages);
+
+    THeapSizingGoals sizingGoals;
+    sizingGoals.gcTimePercent = llstArgs.gcTime;
+    sizingGoals.maxPause = llstArgs.maxPause * 1000;
+    memoryManager->setSizingGoals(sizingGoals);
+    memoryManager->setLargeObjectThreshold(llstArgs.largeObjectThreshold);
+
     memoryManager->initializeHeap(llstArgs.heapSize, llstArgs.maxHeapSize);
     memoryManager->setLogger(std::tr1::shared_ptr<IGCLogger>(new GCLogger("gc.log")));
     std::auto_ptr<Image> smalltalkImage(new Image(memoryManager.get()));
     smalltalkImage->loadImage(llstArgs.imagePath);
 
-    SmalltalkVM vm(smalltalkImage.get(), memoryManager.get());
+    SmalltalkVM vm(smalltalkImage.get(), memoryManager.get(), llstArgs.lookupCacheSize);
 
     // Creating completion database and filling it with info
     CompletionEngine* completionEngine = CompletionEngine::Instance();
@@ -166,6 +200,8 @@ int main(int argc, char **argv) {
     int averageAllocs = info.collectionsCount ? info.allocationsCount / info.collectionsCount : info.allocationsCount;
     std::printf("\nGC count: %d (%d/%d), average allocations per gc: %d, microseconds spent in GC: %d\n",
            info.collectionsCount, info.leftToRightCollections, info.rightToLeftCollections, averageAllocs, static_cast<uint32_t>(info.totalCollectionDelay));
+    if (info.pausesCount)
+        std::printf("GC pauses: %d, longest pause in microseconds: %d\n", info.pausesCount, static_cast<uint32_t>(info.longestPause));
 
     vm.printVMStat();
 
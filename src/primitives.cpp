@@ -44,8 +44,11 @@
 #include <sys/stat.h>
 
 TObject* callPrimitive(uint8_t opcode, TObjectArray* arguments, bool& primitiveFailed) {
+    return callPrimitive(opcode, arguments->getFields(), primitiveFailed);
+}
+
+TObject* callPrimitive(uint8_t opcode, TObject** args, bool& primitiveFailed) {
     primitiveFailed = false;
-    TObjectArray& args = *arguments;
 
     switch (opcode)
     {
@@ -70,6 +73,11 @@ TObject* callPrimitive(uint8_t opcode, TObjectArray* arguments, bool& primitiveF
             return objectSize;
         } break;
 
+        case primitive::identityHash: { // 41
+            TObject* object = args[0];
+            return isSmallInteger(object) ? object : object->getIdentityHash();
+        } break;
+
         case primitive::stringAt:      // 21
         case primitive::stringAtPut: { // 22
             TObject* indexObject = 0;
@@ -79,11 +87,11 @@ TObject* callPrimitive(uint8_t opcode, TObjectArray* arguments, bool& primitiveF
             // If the method is String:at:put then pop a value from the stack
             if (opcode == primitive::stringAtPut) {
                 indexObject = args[2];
-                string      = args.getField<TString>(1);
+                string      = static_cast<TString*>(args[1]);
                 valueObject = args[0];
             } else { // String:at:put
                 indexObject = args[1];
-                string      = args.getField<TString>(0);
+                string      = static_cast<TString*>(args[0]);
                 //valueObject is not used in primitive stringAtPut
             }
 
@@ -171,7 +179,23 @@ TObject* callPrimitive(uint8_t opcode, TObjectArray* arguments, bool& primitiveF
 TObject* callSmallIntPrimitive(uint8_t opcode, int32_t leftOperand, int32_t rightOperand, bool& primitiveFailed) {
     switch (opcode) {
         case primitive::smallIntAdd:
-            return TInteger( leftOperand + rightOperand ); //FIXME possible overflow
+        case primitive::smallIntMul:
+        case primitive::smallIntSub: {
+            // Operations are performed in 64 bits, so the result may be checked for overflow
+            int64_t result;
+            if (opcode == primitive::smallIntAdd)
+                result = static_cast<int64_t>(leftOperand) + rightOperand;
+            else if (opcode == primitive::smallIntMul)
+                result = static_cast<int64_t>(leftOperand) * rightOperand;
+            else
+                result = static_cast<int64_t>(leftOperand) - rightOperand;
+
+            if (! isSmallIntegerValue(result)) {
+                primitiveFailed = true;
+                return globals.nilObject;
+            }
+            return TInteger( static_cast<int32_t>(result) );
+        }
 
         case primitive::smallIntDiv:
             if (rightOperand == 0) {
@@ -199,12 +223,6 @@ TObject* callSmallIntPrimitive(uint8_t opcode, int32_t leftOperand, int32_t righ
             else
                 return globals.falseObject;
 
-        case primitive::smallIntMul:
-            return TInteger( leftOperand * rightOperand ); //FIXME possible overflow
-
-        case primitive::smallIntSub:
-            return TInteger( leftOperand - rightOperand ); //FIXME possible overflow
-
         case primitive::smallIntBitOr:
             return TInteger( leftOperand | rightOperand );
 
@@ -214,21 +232,26 @@ TObject* callSmallIntPrimitive(uint8_t opcode, int32_t leftOperand, int32_t righ
         case primitive::smallIntBitShift: {
             // operator << if rightOperand < 0, operator >> if rightOperand >= 0
 
-            int32_t result = 0;
+            int64_t result = 0;
 
             if (rightOperand < 0) {
-                //shift right
-                result = leftOperand >> -rightOperand;
+                //shift right, all significant bits are gone after 31 positions
+                result = leftOperand >> std::min(-rightOperand, 31);
             } else {
                 // shift left ; catch overflow
-                result = leftOperand << rightOperand;
-                if (leftOperand > result) {
+                if (rightOperand > 31 && leftOperand != 0) {
+                    primitiveFailed = true;
+                    return globals.nilObject;
+                }
+
+                result = (rightOperand > 31) ? 0 : static_cast<int64_t>(leftOperand) << rightOperand;
+                if (! isSmallIntegerValue(result)) {
                     primitiveFailed = true;
                     return globals.nilObject;
                 }
             }
 
-            return TInteger(result);
+            return TInteger( static_cast<int32_t>(result) );
         }
 
         default:
@@ -237,7 +260,7 @@ TObject* callSmallIntPrimitive(uint8_t opcode, int32_t leftOperand, int32_t righ
     }
 }
 
-TObject* callIOPrimitive(uint8_t opcode, TObjectArray& args, bool& primitiveFailed) {
+TObject* callIOPrimitive(uint8_t opcode, TObject** args, bool& primitiveFailed) {
     switch (opcode) {
 
         case primitive::ioGetChar: { // 9
@@ -255,7 +278,7 @@ TObject* callIOPrimitive(uint8_t opcode, TObjectArray& args, bool& primitiveFail
         } break;
 
         case primitive::ioFileOpen: { // 100
-            TString* name = args.getField<TString>(0);
+            TString* name = static_cast<TString*>(args[0]);
             int32_t  mode = TInteger( args[1] );
 
             //We have to pass NULL-terminated string to open()
@@ -281,7 +304,7 @@ TObject* callIOPrimitive(uint8_t opcode, TObjectArray& args, bool& primitiveFail
 
         case primitive::ioFileSetStatIntoArray: { // 105
             int32_t fileID = TInteger( args[0] );
-            TObjectArray* array = args.getField<TObjectArray>(1);
+            TObjectArray* array = static_cast<TObjectArray*>(args[1]);
 
             struct stat fileStat;
             if( fstat(fileID, &fileStat) < 0 ) {
@@ -301,7 +324,7 @@ TObject* callIOPrimitive(uint8_t opcode, TObjectArray& args, bool& primitiveFail
         case primitive::ioFileReadIntoByteArray:    // 106
         case primitive::ioFileWriteFromByteArray: { // 107
             int32_t fileID = TInteger( args[0] );
-            TByteArray* bufferArray = args.getField<TByteArray>(1);
+            TByteArray* bufferArray = static_cast<TByteArray*>(args[1]);
             uint32_t size = TInteger( args[2] );
 
             if ( size > bufferArray->getSize() ) {
@@ -311,6 +334,20 @@ TObject* callIOPrimitive(uint8_t opcode, TObjectArray& args, bool& primitiveFail
 
             int32_t involvedItems;
 
+            // Bytes are handed to the system without copying. No collection
+            // happens during the call, so the buffer stays in place. Buffers
+            // kept by the system beyond the call should be pinned, see
+            // IMemoryManager::pinObject() and ByteArray class>>newPinned:.
+
+            // Incremental collector may keep the buffer protected until it is
+            // touched. System call would fail instead of trapping, so every
+            // page of the buffer is touched in advance.
+            const volatile uint8_t* const bytes = bufferArray->getBytes();
+            for (uint32_t offset = 0; offset < size; offset += 4096)
+                bytes[offset];
+            if (size)
+                bytes[size - 1];
+
             if (opcode == primitive::ioFileReadIntoByteArray) {
                 involvedItems = read(fileID, bufferArray->getBytes(), size);
             } else { // ioFileWriteFromByteArray
@@ -38,6 +38,7 @@
 #include <iostream>
 #include <cassert>
 #include <cstring>
+#include <cctype>
 
 #include <primitives.h>
 #include <vm.h>
@@ -47,8 +48,37 @@
     #include <jit.h>
 #endif
 
+// Labels as values are a GNU extension. Other compilers
+// get the portable switch based interpreter loop.
+#if defined(USE_THREADED_DISPATCH) && defined(__GNUC__)
+    #define LLST_THREADED_DISPATCH
+#endif
+
+// Size argument of the allocation primitives should fit into the object header
+static bool isValidObjectSize(TObject* size)
+{
+    return isSmallInteger(size) && TInteger(size).getValue() >= 0
+        && static_cast<uint32_t>(TInteger(size).getValue()) <= TSize::MAX_SIZE;
+}
+
 TObject* SmalltalkVM::newOrdinaryObject(TClass* klass, std::size_t slotSize)
 {
+    // Object size stored in the TSize field of any ordinary object contains
+    // number of pointers except for the first two fields
+    std::size_t fieldsCount = slotSize / sizeof(TObject*) - 2;
+
+    // Header would not hold the size
+    if (fieldsCount > TSize::MAX_SIZE) {
+        std::fprintf(stderr, "VM: object of %u fields is too large\n", fieldsCount);
+        return globals.nilObject;
+    }
+
+    // Allocation buffer never triggers GC and its memory is already filled with nil
+    if (void* const bufferSlot = m_memoryManager->allocateInBuffer(correctPadding(slotSize))) {
+        m_lastGCOccured = false;
+        return new (bufferSlot) TObject(fieldsCount, klass);
+    }
+
     // Class may be moved during GC in allocation,
     // so we need to protect the pointer
     hptr<TClass> pClass = newPointer(klass);
@@ -64,10 +94,6 @@ TObject* SmalltalkVM::newOrdinaryObject(TClass* klass, std::size_t slotSize)
     if (m_lastGCOccured)
         onCollectionOccured();
 
-    // Object size stored in the TSize field of any ordinary object contains
-    // number of pointers except for the first two fields
-    std::size_t fieldsCount = slotSize / sizeof(TObject*) - 2;
-
     TObject* instance = new (objectSlot) TObject(fieldsCount, pClass);
 
     for (uint32_t index = 0; index < fieldsCount; index++)
@@ -78,14 +104,29 @@ TObject* SmalltalkVM::newOrdinaryObject(TClass* klass, std::size_t slotSize)
 
 TByteObject* SmalltalkVM::newBinaryObject(TClass* klass, std::size_t dataSize)
 {
-    // Class may be moved during GC in allocation,
-    // so we need to protect the pointer
-    hptr<TClass> pClass = newPointer(klass);
-
     // All binary objects are descendants of ByteObject
     // They could not have ordinary fields, so we may use it
     uint32_t slotSize = sizeof(TByteObject) + dataSize;
 
+    // Header would not hold the size
+    if (dataSize > TSize::MAX_SIZE) {
+        std::fprintf(stderr, "VM: binary object of %u bytes is too large\n", dataSize);
+        return static_cast<TByteObject*>(globals.nilObject);
+    }
+
+    // Allocation buffer is filled with nil pointers rather than zeros,
+    // so the bytes of the buffered object are cleared explicitly
+    if (void* const bufferSlot = m_memoryManager->allocateInBuffer(correctPadding(slotSize))) {
+        m_lastGCOccured = false;
+        TByteObject* const instance = new (bufferSlot) TByteObject(dataSize, klass);
+        std::memset(instance->getBytes(), 0, correctPadding(slotSize) - sizeof(TByteObject));
+        return instance;
+    }
+
+    // Class may be moved during GC in allocation,
+    // so we need to protect the pointer
+    hptr<TClass> pClass = newPointer(klass);
+
     void* objectSlot = m_memoryManager->allocate(correctPadding(slotSize), &m_lastGCOccured);
     if (!objectSlot) {
         std::fprintf(stderr, "VM: memory manager failed to allocate %d bytes\n", slotSize);
@@ -116,17 +157,19 @@ template<> hptr<TSymbolArray> SmalltalkVM::newObject<TSymbolArray>(std::size_t d
     return hptr<TSymbolArray>(instance, m_memoryManager, registerPointer);
 }
 
-template<> hptr<TContext> SmalltalkVM::newObject<TContext>(std::size_t /*dataSize*/, bool registerPointer)
+// dataSize of the context objects is the amount of inline tail fields
+
+template<> hptr<TContext> SmalltalkVM::newObject<TContext>(std::size_t dataSize, bool registerPointer)
 {
     TClass* klass = globals.contextClass;
-    TContext* instance = static_cast<TContext*>( newOrdinaryObject(klass, sizeof(TContext)) );
+    TContext* instance = static_cast<TContext*>( newOrdinaryObject(klass, sizeof(TContext) + dataSize * sizeof(TObject*)) );
     return hptr<TContext>(instance, m_memoryManager, registerPointer);
 }
 
-template<> hptr<TBlock> SmalltalkVM::newObject<TBlock>(std::size_t /*dataSize*/, bool registerPointer)
+template<> hptr<TBlock> SmalltalkVM::newObject<TBlock>(std::size_t dataSize, bool registerPointer)
 {
     TClass* klass = globals.blockClass;
-    TBlock* instance = static_cast<TBlock*>( newOrdinaryObject(klass, sizeof(TBlock)) );
+    TBlock* instance = static_cast<TBlock*>( newOrdinaryObject(klass, sizeof(TBlock) + dataSize * sizeof(TObject*)) );
     return hptr<TBlock>(instance, m_memoryManager, registerPointer);
 }
 
@@ -138,49 +181,85 @@ void SmalltalkVM::TVMExecutionContext::stackPush(TObject* object)
     //      The Timothy A. Budd's version of compiler produces
     //      bytecode which can overflow the stack of the context
 
-    TObjectArray&  oldStack  = *currentContext->stack;
-    const uint32_t stackSize = oldStack.getSize();
+    const uint32_t stackSize = currentContext->getStackSize();
 
     if (stackTop >= stackSize) {
+        // Object may be moved during GC in allocation
+        hptr<TObject> pObject = m_vm->newPointer(object);
+
         hptr<TObjectArray> newStack = m_vm->newObject<TObjectArray>(stackSize + 7);
+        TObject** oldStack = currentContext->getStackSlots();
 
         for (uint32_t i = 0; i < stackSize; i++)
             newStack[i] = oldStack[i];
 
+        // Inline stack area of the context is abandoned from now on
         currentContext->stack = newStack;
         std::cerr << currentContext->method->name->toString() << "!";
+
+        object = pObject;
     }
 
-    currentContext->stack->putField(stackTop++, object);
+    currentContext->getStackSlots()[stackTop++] = object;
+}
+
+SmalltalkVM::SmalltalkVM(Image* image, IMemoryManager* memoryManager, uint32_t lookupCacheSize /*= DEFAULT_LOOKUP_CACHE_SIZE*/)
+    : m_decodedMethodsEpoch(1), m_cacheHits(0), m_cacheMisses(0), m_messagesSent(0),
+    m_inlineCacheHits(0), m_inlineCacheMisses(0), m_primitiveShortcuts(0), m_contextsRecycled(0), m_contextsReused(0), m_image(image),
+    m_memoryManager(memoryManager), m_lastGCOccured(false) //, ec(memoryManager)
+{
+    // Set count is a power of two, so the size is capped before it overflows
+    const uint32_t cacheSize = std::min(lookupCacheSize, static_cast<uint32_t>(MAX_LOOKUP_CACHE_SIZE));
+    uint32_t setsCount = 1;
+    while (setsCount * LOOKUP_CACHE_WAYS < cacheSize)
+        setsCount *= 2;
+
+    m_lookupCache.resize(setsCount * LOOKUP_CACHE_WAYS);
+    m_lookupCacheSetMask = setsCount - 1;
+
+    flushMethodCache();
+    flushContextFreeLists();
 }
 
-bool SmalltalkVM::checkRoot(TObject* value, TObject** objectSlot)
+static inline uint32_t getLookupCacheHash(TSymbol* selector, TClass* klass)
 {
-    return m_memoryManager->checkRoot(value, objectSlot);
+    // Objects are aligned, so the lower bits are always zero
+    const uint32_t selectorBits = reinterpret_cast<uint32_t>(selector) >> 2;
+    const uint32_t classBits    = reinterpret_cast<uint32_t>(klass) >> 2;
+
+    return selectorBits ^ (classBits * 31) ^ (classBits >> 7);
 }
 
 TMethod* SmalltalkVM::lookupMethodInCache(TSymbol* selector, TClass* klass)
 {
-    uint32_t hash = reinterpret_cast<uint32_t>(selector) ^ reinterpret_cast<uint32_t>(klass);
-    TMethodCacheEntry& entry = m_lookupCache[hash % LOOKUP_CACHE_SIZE];
+    const uint32_t set = getLookupCacheHash(selector, klass) & m_lookupCacheSetMask;
+    TMethodCacheEntry* const entries = &m_lookupCache[set * LOOKUP_CACHE_WAYS];
 
-    if (entry.methodName == selector && entry.receiverClass == klass) {
-        m_cacheHits++;
-        return entry.method;
-    } else {
-        m_cacheMisses++;
-        return 0;
+    for (uint32_t way = 0; way < LOOKUP_CACHE_WAYS; way++) {
+        TMethodCacheEntry& entry = entries[way];
+
+        if (entry.methodName == selector && entry.receiverClass == klass) {
+            m_cacheHits++;
+            return entry.method;
+        }
     }
+
+    m_cacheMisses++;
+    return 0;
 }
 
 void SmalltalkVM::updateMethodCache(TSymbol* selector, TClass* klass, TMethod* method)
 {
-    uint32_t hash = reinterpret_cast<uint32_t>(selector) ^ reinterpret_cast<uint32_t>(klass);
-    TMethodCacheEntry& entry = m_lookupCache[hash % LOOKUP_CACHE_SIZE];
+    const uint32_t set = getLookupCacheHash(selector, klass) & m_lookupCacheSetMask;
+    TMethodCacheEntry* const entries = &m_lookupCache[set * LOOKUP_CACHE_WAYS];
+
+    // The newest entry goes first, the oldest one is evicted
+    for (uint32_t way = LOOKUP_CACHE_WAYS - 1; way > 0; way--)
+        entries[way] = entries[way - 1];
 
-    entry.methodName    = selector;
-    entry.receiverClass = klass;
-    entry.method        = method;
+    entries[0].methodName    = selector;
+    entries[0].receiverClass = klass;
+    entries[0].method        = method;
 }
 
 TMethod* SmalltalkVM::lookupMethod(TSymbol* selector, TClass* klass)
@@ -211,10 +290,407 @@ TMethod* SmalltalkVM::lookupMethod(TSymbol* selector, TClass* klass)
 
 void SmalltalkVM::flushMethodCache()
 {
-    for (std::size_t i = 0; i < LOOKUP_CACHE_SIZE; i++)
+    for (std::size_t i = 0; i < m_lookupCache.size(); i++)
         m_lookupCache[i].methodName = 0;
 }
 
+void SmalltalkVM::purgeMethodCache()
+{
+    for (std::size_t i = 0; i < m_lookupCache.size(); i++) {
+        TMethodCacheEntry& entry = m_lookupCache[i];
+        if (! entry.methodName)
+            continue;
+
+        if (! m_memoryManager->isInStaticHeap(entry.methodName) ||
+            ! m_memoryManager->isInStaticHeap(entry.receiverClass) ||
+            ! m_memoryManager->isInStaticHeap(entry.method))
+        {
+            entry.methodName = 0;
+        }
+    }
+}
+
+SmalltalkVM::TDecodedMethod::TDecodedMethod(TMethod* method) : method(method)
+{
+    const TByteObject& byteCodes = * method->byteCodes;
+    const uint16_t size = byteCodes.getSize();
+
+    instructionIndex.resize(size, 0);
+
+    // Bytecodes of the nested blocks are inlined into the method body,
+    // so a linear scan visits every instruction exactly once
+    uint16_t bytePointer = 0;
+    while (bytePointer < size) {
+        instructionIndex[bytePointer] = instructions.size();
+
+        const st::TSmalltalkInstruction instruction = st::InstructionDecoder::decodeAndShiftPointer(byteCodes, bytePointer);
+        instructions.push_back(instruction);
+        nextBytePointers.push_back(bytePointer);
+
+        // Binary operations fall back to the message send if operands are not small integers
+        const bool isSendSite =
+            instruction.getOpcode() == opcode::sendMessage ||
+            instruction.getOpcode() == opcode::sendBinary  ||
+            (instruction.getOpcode() == opcode::doSpecial && instruction.getArgument() == special::sendToSuper);
+
+        sendSites.push_back(isSendSite ? static_cast<uint16_t>(inlineCaches.size()) : static_cast<uint16_t>(NO_SEND_SITE));
+        if (isSendSite)
+            inlineCaches.push_back(TInlineCache());
+    }
+
+    // Inline cache slots may be registered as roots, so they should never be reallocated
+    std::vector<TInlineCache>(inlineCaches).swap(inlineCaches);
+}
+
+std::size_t SmalltalkVM::TDecodedMethod::getMemoryUsage() const
+{
+    return sizeof(*this) +
+        instructions.capacity() * sizeof(st::TSmalltalkInstruction) +
+        nextBytePointers.capacity() * sizeof(uint16_t) +
+        instructionIndex.capacity() * sizeof(uint16_t) +
+        inlineCaches.capacity() * sizeof(TInlineCache) +
+        sendSites.capacity() * sizeof(uint16_t);
+}
+
+SmalltalkVM::TDecodedMethod* SmalltalkVM::getDecodedMethod(TMethod* method)
+{
+    TDecodedMethodMap::iterator iMethod = m_decodedMethods.find(method);
+    if (iMethod != m_decodedMethods.end())
+        return iMethod->second;
+
+    TDecodedMethod* decodedMethod = new TDecodedMethod(method);
+    m_decodedMethods[method] = decodedMethod;
+
+    return decodedMethod;
+}
+
+inline void SmalltalkVM::fetchInstruction(TVMExecutionContext& ec)
+{
+    TMethod* const method = ec.currentContext->method;
+
+    // Checking the epoch first because the pointer may be already deleted
+    if (ec.decodedMethodEpoch != m_decodedMethodsEpoch || ec.decodedMethod->method != method) {
+        ec.decodedMethod      = getDecodedMethod(method);
+        ec.decodedMethodEpoch = m_decodedMethodsEpoch;
+    }
+
+    assert(ec.bytePointer < ec.decodedMethod->instructionIndex.size());
+    const uint16_t index = ec.decodedMethod->instructionIndex[ec.bytePointer];
+
+    ec.instruction = ec.decodedMethod->instructions[index];
+    ec.bytePointer = ec.decodedMethod->nextBytePointers[index];
+    ec.instructionIndex = index;
+}
+
+// Returns the number of the message arguments the selector takes
+static uint32_t getSelectorArity(TSymbol* selector)
+{
+    const uint32_t size = selector->getSize();
+    if (size == 0)
+        return 0;
+
+    // Binary selectors consist of the special characters
+    const uint8_t first = selector->getByte(0);
+    if (! std::isalpha(first))
+        return 1;
+
+    uint32_t colons = 0;
+    for (uint32_t index = 0; index < size; index++) {
+        if (selector->getByte(index) == ':')
+            colons++;
+    }
+    return colons;
+}
+
+TMethod* SmalltalkVM::lookupMethodAtSendSite(TVMExecutionContext& ec, TSymbol* selector, TClass* klass, uint8_t* shortcut /*= 0*/)
+{
+    if (shortcut)
+        *shortcut = 0;
+
+    // Decoded method may be already deleted if collection occured during the send
+    if (ec.decodedMethodEpoch != m_decodedMethodsEpoch)
+        return lookupMethod(selector, klass);
+
+    TDecodedMethod::TInlineCache* const cache = ec.decodedMethod->getInlineCache(ec.instructionIndex);
+    if (!cache)
+        return lookupMethod(selector, klass);
+
+    for (uint32_t index = 0; index < cache->size; index++) {
+        if (cache->classes[index] == klass) {
+            m_inlineCacheHits++;
+            if (shortcut)
+                *shortcut = cache->primitives[index];
+            return cache->methods[index];
+        }
+    }
+
+    m_inlineCacheMisses++;
+
+    TMethod* const method = lookupMethod(selector, klass);
+    if (!method || cache->isMegamorphic)
+        return method;
+
+    if (cache->size == TDecodedMethod::TInlineCache::POLYMORPHIC_SIZE) {
+        cache->isMegamorphic = true;
+        return method;
+    }
+
+    TClass**  classSlot  = &cache->classes[cache->size];
+    TMethod** methodSlot = &cache->methods[cache->size];
+    *classSlot  = klass;
+    *methodSlot = method;
+    cache->primitives[cache->size] = getShortcutPrimitive(method, getSelectorArity(selector) + 1);
+    cache->size++;
+
+    // Image classes and methods never move. Slots holding
+    // dynamic objects are updated by the GC as the roots.
+    if (! m_memoryManager->isInStaticHeap(klass))
+        m_memoryManager->addStaticRoot(reinterpret_cast<TObject**>(classSlot));
+    if (! m_memoryManager->isInStaticHeap(method))
+        m_memoryManager->addStaticRoot(reinterpret_cast<TObject**>(methodSlot));
+
+    return method;
+}
+
+void SmalltalkVM::releaseInlineCaches(TDecodedMethod* decodedMethod)
+{
+    for (std::size_t site = 0; site < decodedMethod->inlineCaches.size(); site++) {
+        TDecodedMethod::TInlineCache& cache = decodedMethod->inlineCaches[site];
+
+        for (uint32_t index = 0; index < cache.size; index++) {
+            if (! m_memoryManager->isInStaticHeap(cache.classes[index]))
+                m_memoryManager->removeStaticRoot(reinterpret_cast<TObject**>(&cache.classes[index]));
+            if (! m_memoryManager->isInStaticHeap(cache.methods[index]))
+                m_memoryManager->removeStaticRoot(reinterpret_cast<TObject**>(&cache.methods[index]));
+        }
+
+        cache.size = 0;
+    }
+}
+
+void SmalltalkVM::flushDecodedMethods(bool dynamicOnly /*= false*/)
+{
+    TDecodedMethodMap::iterator iMethod = m_decodedMethods.begin();
+    while (iMethod != m_decodedMethods.end()) {
+        if (dynamicOnly && m_memoryManager->isInStaticHeap(iMethod->first)) {
+            ++iMethod;
+            continue;
+        }
+
+        releaseInlineCaches(iMethod->second);
+        delete iMethod->second;
+        m_decodedMethods.erase(iMethod++);
+    }
+
+    m_decodedMethodsEpoch++;
+}
+
+uint8_t SmalltalkVM::getShortcutPrimitive(TMethod* method, uint32_t argumentsCount)
+{
+    // Methods of interest start with pushing their arguments for the primitive:
+    //    <24 self index>      pushArgument 0, pushArgument 1, doPrimitive 2 24
+    // The rest of the method is the failure handler, that is not needed here.
+    enum { MAX_PUSHES = 8 };
+    uint8_t pushes[MAX_PUSHES];
+    uint32_t pushesCount = 0;
+
+    uint8_t primitiveNumber = 0;
+
+    const TByteObject& byteCodes = * method->byteCodes;
+    uint16_t bytePointer = 0;
+    while (bytePointer < byteCodes.getSize()) {
+        const st::TSmalltalkInstruction instruction = st::InstructionDecoder::decodeAndShiftPointer(byteCodes, bytePointer);
+
+        if (instruction.getOpcode() == opcode::pushArgument) {
+            if (pushesCount == MAX_PUSHES)
+                return 0;
+            pushes[pushesCount++] = instruction.getArgument();
+            continue;
+        }
+
+        if (instruction.getOpcode() == opcode::doPrimitive && instruction.getArgument() == pushesCount)
+            primitiveNumber = instruction.getExtra();
+        break;
+    }
+
+    if (! primitiveNumber || pushesCount == 0 || pushesCount != argumentsCount)
+        return 0;
+
+    // Primitive arguments should be the method arguments in the expected order
+    switch (primitiveNumber) {
+        case primitive::getClass: // 2
+        case primitive::getSize:  // 4
+            if (pushesCount == 1 && pushes[0] == 0)
+                return primitiveNumber;
+            break;
+
+        case primitive::objectsAreEqual: // 1
+        case primitive::stringAt:        // 21
+        case primitive::arrayAt:         // 24
+            if (pushesCount == 2 && pushes[0] == 0 && pushes[1] == 1)
+                return primitiveNumber;
+            break;
+
+        case primitive::arrayAtPut:  // 5
+        case primitive::stringAtPut: // 22
+            // <5 value self index>
+            if (pushesCount == 3 && pushes[0] == 2 && pushes[1] == 0 && pushes[2] == 1)
+                return primitiveNumber;
+            break;
+
+        case primitive::blockInvoke: { // 8
+            // <8 a b self>
+            for (uint32_t index = 0; index < pushesCount - 1; index++) {
+                if (pushes[index] != index + 1)
+                    return 0;
+            }
+            if (pushes[pushesCount - 1] == 0)
+                return primitiveNumber;
+        } break;
+    }
+
+    return 0;
+}
+
+bool SmalltalkVM::doPrimitiveShortcut(TVMExecutionContext& ec, uint8_t primitiveNumber, uint32_t argumentsCount)
+{
+    // Receiver and the message arguments are at the top of the stack
+    TObject** arguments = ec.currentContext->getStackSlots() + ec.stackTop - argumentsCount;
+    TObject*  result    = 0;
+
+    switch (primitiveNumber) {
+        case primitive::arrayAt:      // 24
+        case primitive::arrayAtPut: { // 5
+            TObjectArray* const array = static_cast<TObjectArray*>(arguments[0]);
+            TObject* const indexObject = arguments[1];
+
+            if (! isSmallInteger(indexObject))
+                return false;
+
+            // Smalltalk indexes arrays starting from 1
+            const uint32_t actualIndex = TInteger(indexObject) - 1;
+            if (actualIndex >= array->getSize())
+                return false;
+
+            if (primitiveNumber == primitive::arrayAt) {
+                result = array->getField(actualIndex);
+            } else {
+                TObject* const valueObject = arguments[2];
+                checkRoot(valueObject, &array->getFields()[actualIndex]);
+                array->putField(actualIndex, valueObject);
+                result = array;
+            }
+        } break;
+
+        case primitive::blockInvoke: { // 8
+            hptr<TContext> block = newPointer(static_cast<TContext*>(arguments[0]));
+            TBlock* const blockObject = block.cast<TBlock>();
+
+            const uint32_t argCount = argumentsCount - 1;
+            const uint32_t argumentLocation = blockObject->argumentLocation;
+            TObjectArray* const blockTemps = blockObject->temporaries;
+
+            if (argCount > (blockTemps ? blockTemps->getSize() - argumentLocation : 0))
+                return false;
+
+            for (uint32_t index = 0; index < argCount; index++)
+                (*blockTemps)[argumentLocation + index] = arguments[index + 1];
+
+            ec.stackTop -= argumentsCount;
+            ec.storePointers();
+
+            // Block is entered directly, as if Block>>value was already running
+            block->stackTop    = 0;
+            block->bytePointer = blockObject->blockBytePointer;
+
+            m_primitiveShortcuts++;
+            enterContext(ec, block);
+            return true;
+        }
+
+        default: {
+            // Primitive takes the arguments in the order they were pushed by the method
+            TObject* primitiveArguments[3];
+            if (primitiveNumber == primitive::stringAtPut) {
+                primitiveArguments[0] = arguments[2];
+                primitiveArguments[1] = arguments[0];
+                primitiveArguments[2] = arguments[1];
+            } else {
+                for (uint32_t index = 0; index < argumentsCount; index++)
+                    primitiveArguments[index] = arguments[index];
+            }
+
+            bool failed = false;
+            result = callPrimitive(primitiveNumber, primitiveArguments, failed);
+            if (failed)
+                return false;
+        }
+    }
+
+    ec.stackTop -= argumentsCount;
+    ec.returnedValue = result;
+    ec.stackPush(result);
+
+    m_primitiveShortcuts++;
+    m_messagesSent++;
+    return true;
+}
+
+// Performs the binary operator on the small integer operands. Returns false
+// if the result could not be computed here (overflow, division by zero etc.)
+// and the message should be sent to the receiver instead.
+static bool evaluateSmallIntOperator(uint8_t operation, int32_t leftOperand, int32_t rightOperand, TObject*& result)
+{
+    bool failed = false;
+
+    switch (static_cast<binaryBuiltIns::Operator>(operation)) {
+        case binaryBuiltIns::operatorLess:        result = (leftOperand <  rightOperand) ? globals.trueObject : globals.falseObject; break;
+        case binaryBuiltIns::operatorLessOrEq:    result = (leftOperand <= rightOperand) ? globals.trueObject : globals.falseObject; break;
+        case binaryBuiltIns::operatorGreater:     result = (leftOperand >  rightOperand) ? globals.trueObject : globals.falseObject; break;
+        case binaryBuiltIns::operatorGreaterOrEq: result = (leftOperand >= rightOperand) ? globals.trueObject : globals.falseObject; break;
+        case binaryBuiltIns::operatorEqual:
+        case binaryBuiltIns::operatorIdentical:   result = (leftOperand == rightOperand) ? globals.trueObject : globals.falseObject; break;
+        case binaryBuiltIns::operatorNotEqual:    result = (leftOperand != rightOperand) ? globals.trueObject : globals.falseObject; break;
+
+        case binaryBuiltIns::operatorPlus:     result = callSmallIntPrimitive(primitive::smallIntAdd, leftOperand, rightOperand, failed); break;
+        case binaryBuiltIns::operatorMinus:    result = callSmallIntPrimitive(primitive::smallIntSub, leftOperand, rightOperand, failed); break;
+        case binaryBuiltIns::operatorMultiply: result = callSmallIntPrimitive(primitive::smallIntMul, leftOperand, rightOperand, failed); break;
+        case binaryBuiltIns::operatorBitAnd:   result = callSmallIntPrimitive(primitive::smallIntBitAnd, leftOperand, rightOperand, failed); break;
+        case binaryBuiltIns::operatorBitOr:    result = callSmallIntPrimitive(primitive::smallIntBitOr, leftOperand, rightOperand, failed); break;
+        case binaryBuiltIns::operatorBitShift: result = callSmallIntPrimitive(primitive::smallIntBitShift, leftOperand, rightOperand, failed); break;
+
+        case binaryBuiltIns::operatorIntegerDivide:
+        case binaryBuiltIns::operatorModulo: {
+            // Division by zero is reported by the image code
+            if (rightOperand == 0)
+                return false;
+
+            // Quotient is rounded towards negative infinity,
+            // so the remainder has the same sign as the divisor
+            int32_t quotient  = leftOperand / rightOperand;
+            int32_t remainder = leftOperand % rightOperand;
+            if (remainder != 0 && ((remainder < 0) != (rightOperand < 0))) {
+                quotient  -= 1;
+                remainder += rightOperand;
+            }
+
+            if (operation == binaryBuiltIns::operatorModulo) {
+                result = TInteger(remainder);
+            } else {
+                // -2^30 // -1 does not fit into the SmallInt
+                if (! isSmallIntegerValue(quotient))
+                    return false;
+                result = TInteger(quotient);
+            }
+        } break;
+
+        default:
+            return false;
+    }
+
+    return !failed;
+}
+
 SmalltalkVM::TExecuteResult SmalltalkVM::execute(TProcess* p, uint32_t ticks)
 {
     // Protecting the process pointer
@@ -228,35 +704,374 @@ SmalltalkVM::TExecuteResult SmalltalkVM::execute(TProcess* p, uint32_t ticks)
     ec.currentContext = currentProcess->context;
     ec.loadPointers(); // Loads bytePointer & stackTop
 
+#if defined(LLST_THREADED_DISPATCH)
+    // Direct threaded interpreter core.
+    //
+    // Instead of a switch on the opcode followed by another switch in the handler
+    // (doSpecial, doPushConstant, doSendBinary, doSendUnary) every instruction jumps
+    // straight to its handler through the dispatch table. The table is indexed by the
+    // opcode in the high nibble and the low nibble of the argument, so sub-operations
+    // get handlers of their own. Each handler ends with its own copy of the dispatch
+    // sequence which gives the branch predictor one indirect jump per handler.
+
+    static const void* dispatchTable[256];
+    static bool dispatchTableReady = false;
+
+    if (! dispatchTableReady) {
+        for (uint32_t index = 0; index < 256; index++)
+            dispatchTable[index] = &&label_invalidInstruction;
+
+        for (uint32_t argument = 0; argument < 16; argument++) {
+            dispatchTable[opcode::pushInstance    << 4 | argument] = &&label_pushInstance;
+            dispatchTable[opcode::pushArgument    << 4 | argument] = &&label_pushArgument;
+            dispatchTable[opcode::pushTemporary   << 4 | argument] = &&label_pushTemporary;
+            dispatchTable[opcode::pushLiteral     << 4 | argument] = &&label_pushLiteral;
+            dispatchTable[opcode::pushConstant    << 4 | argument] = &&label_pushConstant;
+            dispatchTable[opcode::assignInstance  << 4 | argument] = &&label_assignInstance;
+            dispatchTable[opcode::assignTemporary << 4 | argument] = &&label_assignTemporary;
+            dispatchTable[opcode::markArguments   << 4 | argument] = &&label_markArguments;
+            dispatchTable[opcode::sendMessage     << 4 | argument] = &&label_sendMessage;
+            dispatchTable[opcode::sendUnary       << 4 | argument] = &&label_sendUnary;
+            dispatchTable[opcode::sendBinary      << 4 | argument] = &&label_sendBinary;
+            dispatchTable[opcode::pushBlock       << 4 | argument] = &&label_pushBlock;
+            dispatchTable[opcode::doPrimitive     << 4 | argument] = &&label_doPrimitive;
+
+            // Unknown specials are silently skipped just as doSpecial() does
+            dispatchTable[opcode::doSpecial       << 4 | argument] = &&label_nextInstruction;
+        }
+
+        for (uint32_t constant = 0; constant < 10; constant++)
+            dispatchTable[opcode::pushConstant << 4 | constant] = &&label_pushSmallInt;
+
+        dispatchTable[opcode::pushConstant << 4 | pushConstants::nil]         = &&label_pushNil;
+        dispatchTable[opcode::pushConstant << 4 | pushConstants::trueObject]  = &&label_pushTrue;
+        dispatchTable[opcode::pushConstant << 4 | pushConstants::falseObject] = &&label_pushFalse;
+
+        dispatchTable[opcode::sendUnary << 4 | unaryBuiltIns::isNil]  = &&label_isNil;
+        dispatchTable[opcode::sendUnary << 4 | unaryBuiltIns::notNil] = &&label_notNil;
+
+        dispatchTable[opcode::sendBinary << 4 | binaryBuiltIns::operatorLess]     = &&label_operatorLess;
+        dispatchTable[opcode::sendBinary << 4 | binaryBuiltIns::operatorLessOrEq] = &&label_operatorLessOrEq;
+        dispatchTable[opcode::sendBinary << 4 | binaryBuiltIns::operatorPlus]     = &&label_operatorPlus;
+        dispatchTable[opcode::sendBinary << 4 | binaryBuiltIns::operatorMinus]    = &&label_operatorMinus;
+        dispatchTable[opcode::sendBinary << 4 | binaryBuiltIns::operatorEqual]    = &&label_operatorEqual;
+
+        dispatchTable[opcode::doSpecial << 4 | special::selfReturn]    = &&label_selfReturn;
+        dispatchTable[opcode::doSpecial << 4 | special::stackReturn]   = &&label_stackReturn;
+        dispatchTable[opcode::doSpecial << 4 | special::blockReturn]   = &&label_blockReturn;
+        dispatchTable[opcode::doSpecial << 4 | special::duplicate]     = &&label_duplicate;
+        dispatchTable[opcode::doSpecial << 4 | special::popTop]        = &&label_popTop;
+        dispatchTable[opcode::doSpecial << 4 | special::branch]        = &&label_branch;
+        dispatchTable[opcode::doSpecial << 4 | special::branchIfTrue]  = &&label_branchIfTrue;
+        dispatchTable[opcode::doSpecial << 4 | special::branchIfFalse] = &&label_branchIfFalse;
+        dispatchTable[opcode::doSpecial << 4 | special::sendToSuper]   = &&label_sendToSuper;
+
+        dispatchTableReady = true;
+    }
+
+    uint16_t lastBytePointer = 0;
+
+    #define LLST_DISPATCH() \
+        do { \
+            if (ticks && (--ticks == 0)) \
+                goto label_timeExpired; \
+            lastBytePointer = ec.bytePointer; \
+            fetchInstruction(ec); \
+            goto *dispatchTable[ec.instruction.getOpcode() << 4 | (ec.instruction.getArgument() & 0x0F)]; \
+        } while (0)
+
+    #define LLST_RETURN_TO_CURRENT_CONTEXT() \
+        do { \
+            if (ec.currentContext.rawptr() == globals.nilObject) \
+                goto label_processReturned; \
+            ec.loadPointers(); \
+            ec.stackPush( ec.returnedValue ); \
+        } while (0)
+
+label_nextInstruction:
+    LLST_DISPATCH();
+
+label_pushInstance: {
+    TObjectArray& instanceVariables = * static_cast<TObjectArray*>(ec.currentContext->getArgumentSlots()[0]);
+    ec.stackPush(instanceVariables[ec.instruction.getArgument()]);
+} LLST_DISPATCH();
+
+label_pushArgument:
+    ec.stackPush(ec.currentContext->getArgumentSlots()[ec.instruction.getArgument()]);
+    LLST_DISPATCH();
+
+label_pushTemporary:
+    ec.stackPush(ec.currentContext->getTemporarySlots()[ec.instruction.getArgument()]);
+    LLST_DISPATCH();
+
+label_pushLiteral:
+    ec.stackPush(ec.currentContext->method->literals->getField(ec.instruction.getArgument()));
+    LLST_DISPATCH();
+
+label_pushConstant:
+    doPushConstant(ec); // reports the invalid constant
+    LLST_DISPATCH();
+
+label_pushSmallInt:
+    ec.stackPush(TInteger(ec.instruction.getArgument()));
+    LLST_DISPATCH();
+
+label_pushNil:
+    ec.stackPush(globals.nilObject);
+    LLST_DISPATCH();
+
+label_pushTrue:
+    ec.stackPush(globals.trueObject);
+    LLST_DISPATCH();
+
+label_pushFalse:
+    ec.stackPush(globals.falseObject);
+    LLST_DISPATCH();
+
+label_pushBlock:
+    doPushBlock(ec);
+    LLST_DISPATCH();
+
+label_assignTemporary:
+    ec.currentContext->getTemporarySlots()[ec.instruction.getArgument()] = ec.stackLast();
+    LLST_DISPATCH();
+
+label_assignInstance: {
+    TObjectArray& instanceVariables = * static_cast<TObjectArray*>(ec.currentContext->getArgumentSlots()[0]);
+
+    TObject*  newValue   =   ec.stackLast();
+    TObject** objectSlot = & instanceVariables[ec.instruction.getArgument()];
+
+    // Checking whether we need to register current object slot in the GC
+    checkRoot(newValue, objectSlot);
+
+    // Performing the assignment
+    *objectSlot = newValue;
+} LLST_DISPATCH();
+
+label_markArguments:
+    doMarkArguments(ec);
+    LLST_DISPATCH();
+
+label_sendMessage:
+    doSendMessage(ec);
+    LLST_DISPATCH();
+
+label_sendUnary:
+    doSendUnary(ec); // reports the invalid operation
+    LLST_DISPATCH();
+
+label_isNil:
+    ec.returnedValue = (ec.stackPop() == globals.nilObject) ? globals.trueObject : globals.falseObject;
+    ec.stackPush(ec.returnedValue);
+    m_messagesSent++;
+    LLST_DISPATCH();
+
+label_notNil:
+    ec.returnedValue = (ec.stackPop() != globals.nilObject) ? globals.trueObject : globals.falseObject;
+    ec.stackPush(ec.returnedValue);
+    m_messagesSent++;
+    LLST_DISPATCH();
+
+label_sendBinary:
+    doSendBinary(ec); // reports the invalid operation
+    LLST_DISPATCH();
+
+    // Operands are popped to be examined. If they are not small integers
+    // they are put back and the generic doSendBinary() sends the message.
+label_operatorLess: {
+    TObject* rightObject = ec.stackPop();
+    TObject* leftObject  = ec.stackPop();
+
+    if (isSmallInteger(leftObject) && isSmallInteger(rightObject)) {
+        ec.returnedValue = (TInteger(leftObject).getValue() < TInteger(rightObject).getValue()) ? globals.trueObject : globals.falseObject;
+        ec.stackPush(ec.returnedValue);
+        m_messagesSent++;
+    } else {
+        ec.stackTop += 2;
+        doSendBinary(ec);
+    }
+} LLST_DISPATCH();
+
+label_operatorLessOrEq: {
+    TObject* rightObject = ec.stackPop();
+    TObject* leftObject  = ec.stackPop();
+
+    if (isSmallInteger(leftObject) && isSmallInteger(rightObject)) {
+        ec.returnedValue = (TInteger(leftObject).getValue() <= TInteger(rightObject).getValue()) ? globals.trueObject : globals.falseObject;
+        ec.stackPush(ec.returnedValue);
+        m_messagesSent++;
+    } else {
+        ec.stackTop += 2;
+        doSendBinary(ec);
+    }
+} LLST_DISPATCH();
+
+label_operatorEqual: {
+    TObject* rightObject = ec.stackPop();
+    TObject* leftObject  = ec.stackPop();
+
+    if (isSmallInteger(leftObject) && isSmallInteger(rightObject)) {
+        ec.returnedValue = (leftObject == rightObject) ? globals.trueObject : globals.falseObject;
+        ec.stackPush(ec.returnedValue);
+        m_messagesSent++;
+    } else {
+        ec.stackTop += 2;
+        doSendBinary(ec);
+    }
+} LLST_DISPATCH();
+
+    // Arithmetic operators also fall back to the message send on overflow
+label_operatorPlus: {
+    TObject* rightObject = ec.stackPop();
+    TObject* leftObject  = ec.stackPop();
+
+    if (isSmallInteger(leftObject) && isSmallInteger(rightObject)) {
+        bool overflow = false;
+        TObject* sum = callSmallIntPrimitive(primitive::smallIntAdd, TInteger(leftObject), TInteger(rightObject), overflow);
+        if (! overflow) {
+            ec.returnedValue = sum;
+            ec.stackPush(sum);
+            m_messagesSent++;
+            LLST_DISPATCH();
+        }
+    }
+
+    ec.stackTop += 2;
+    doSendBinary(ec);
+} LLST_DISPATCH();
+
+label_operatorMinus: {
+    TObject* rightObject = ec.stackPop();
+    TObject* leftObject  = ec.stackPop();
+
+    if (isSmallInteger(leftObject) && isSmallInteger(rightObject)) {
+        bool overflow = false;
+        TObject* difference = callSmallIntPrimitive(primitive::smallIntSub, TInteger(leftObject), TInteger(rightObject), overflow);
+        if (! overflow) {
+            ec.returnedValue = difference;
+            ec.stackPush(difference);
+            m_messagesSent++;
+            LLST_DISPATCH();
+        }
+    }
+
+    ec.stackTop += 2;
+    doSendBinary(ec);
+} LLST_DISPATCH();
+
+label_doPrimitive: {
+    TExecuteResult result = doPrimitive(currentProcess, ec);
+    if (result != returnNoReturn)
+        return result;
+} LLST_DISPATCH();
+
+label_selfReturn: {
+    TContext* finishedContext = ec.currentContext;
+    ec.returnedValue  = finishedContext->getArgumentSlots()[0]; // arguments[0] always keep self
+    ec.currentContext = finishedContext->previousContext;
+    recycleContext(finishedContext);
+    LLST_RETURN_TO_CURRENT_CONTEXT();
+} LLST_DISPATCH();
+
+label_stackReturn: {
+    TContext* finishedContext = ec.currentContext;
+    ec.returnedValue  = ec.stackPop();
+    ec.currentContext = finishedContext->previousContext;
+    recycleContext(finishedContext);
+    LLST_RETURN_TO_CURRENT_CONTEXT();
+} LLST_DISPATCH();
+
+label_blockReturn:
+    ec.returnedValue  = ec.stackPop();
+    ec.currentContext = ec.currentContext.cast<TBlock>()->creatingContext->previousContext;
+    LLST_RETURN_TO_CURRENT_CONTEXT();
+    LLST_DISPATCH();
+
+label_duplicate: {
+    TObject* copy = ec.stackLast();
+    ec.stackPush(copy);
+} LLST_DISPATCH();
+
+label_popTop:
+    ec.stackPop();
+    LLST_DISPATCH();
+
+label_branch:
+    ec.bytePointer = ec.instruction.getExtra();
+    LLST_DISPATCH();
+
+label_branchIfTrue:
+    ec.returnedValue = ec.stackPop();
+    if (ec.returnedValue == globals.trueObject)
+        ec.bytePointer = ec.instruction.getExtra();
+    LLST_DISPATCH();
+
+label_branchIfFalse:
+    ec.returnedValue = ec.stackPop();
+    if (ec.returnedValue == globals.falseObject)
+        ec.bytePointer = ec.instruction.getExtra();
+    LLST_DISPATCH();
+
+label_sendToSuper: {
+    TSymbol* messageSelector = ec.currentContext->method->literals->getField(ec.instruction.getExtra());
+    TClass*  receiverClass   = ec.currentContext->method->klass->parentClass;
+    TObjectArray* messageArguments = ec.stackPop<TObjectArray>();
+
+    doSendMessage(ec, messageSelector, messageArguments, receiverClass);
+} LLST_DISPATCH();
+
+label_timeExpired:
+    // Time frame expired. Suspended process may be inspected by the image.
+    ec.storePointers();
+    materializeContextChain(ec.currentContext);
+    markContextEscaped(ec.currentContext);
+    assignPointer(currentProcess->context, ec.currentContext);
+    assignPointer(currentProcess->result, ec.returnedValue);
+    return returnTimeExpired;
+
+label_processReturned:
+    assignPointer(currentProcess->context, ec.currentContext);
+    assignPointer(currentProcess->result, ec.returnedValue);
+    return returnReturned;
+
+label_invalidInstruction:
+    std::fprintf(stderr, "VM: Invalid opcode %d at offset %d in method ", ec.instruction.getOpcode(), lastBytePointer);
+    std::fprintf(stderr, "'%s'\n", ec.currentContext->method->name->toString().c_str() );
+    std::exit(1);
+
+    #undef LLST_RETURN_TO_CURRENT_CONTEXT
+    #undef LLST_DISPATCH
+#else
     while (true)
     {
         assert(ec.currentContext != 0);
         assert(ec.currentContext->method != 0);
         assert(ec.currentContext->stack != 0);
         assert(ec.bytePointer <= ec.currentContext->method->byteCodes->getSize());
-        assert(ec.currentContext->arguments->getSize() >= 1);
-        assert(ec.currentContext->arguments->getField(0) != 0);
+        assert(ec.currentContext->getArgumentsCount() >= 1);
+        assert(ec.currentContext->getArgumentSlots()[0] != 0);
 
         // Initializing helper references
-        TByteObject&  byteCodes = * ec.currentContext->method->byteCodes;
-
-        TObjectArray& temporaries       = * ec.currentContext->temporaries;
-        TObjectArray& arguments         = * ec.currentContext->arguments;
-        TObjectArray& instanceVariables = * arguments.getField<TObjectArray>(0);
+        TObject**     temporaries       =   ec.currentContext->getTemporarySlots();
+        TObject**     arguments         =   ec.currentContext->getArgumentSlots();
+        TObjectArray& instanceVariables = * static_cast<TObjectArray*>(arguments[0]);
         TSymbolArray& literals          = * ec.currentContext->method->literals;
 
         if (ticks && (--ticks == 0)) {
-            // Time frame expired
+            // Time frame expired. Suspended process may be inspected by the image.
             ec.storePointers();
-            currentProcess->context = ec.currentContext;
-            currentProcess->result  = ec.returnedValue;
+            materializeContextChain(ec.currentContext);
+            markContextEscaped(ec.currentContext);
+            assignPointer(currentProcess->context, ec.currentContext);
+            assignPointer(currentProcess->result, ec.returnedValue);
 
             return returnTimeExpired;
         }
 
-        // Decoding the instruction
+        // Fetching the decoded instruction
         const uint16_t lastBytePointer = ec.bytePointer;
-        ec.instruction = st::InstructionDecoder::decodeAndShiftPointer(byteCodes, ec.bytePointer);
+        fetchInstruction(ec);
 
         // And executing it
         switch (ec.instruction.getOpcode()) {
@@ -303,6 +1118,7 @@ SmalltalkVM::TExecuteResult SmalltalkVM::execute(TProcess* p, uint32_t ticks)
                 std::exit(1);
         }
     }
+#endif
 }
 
 void SmalltalkVM::doPushBlock(TVMExecutionContext& ec)
@@ -321,12 +1137,17 @@ void SmalltalkVM::doPushBlock(TVMExecutionContext& ec)
     // New byte pointer that points to the code right after the inline block
     const uint16_t newBytePointer = ec.instruction.getExtra();
 
-    // Creating block object
-    hptr<TBlock> newBlock = newObject<TBlock>();
+    // Block shares arguments and temporaries with the wrapping context and
+    // may outlive it. So if they are kept inline they should be moved out first.
+    if (ec.currentContext->hasInlineArguments())
+        materializeArguments(ec.currentContext);
+    if (ec.currentContext->hasInlineTemporaries())
+        materializeTemporaries(ec.currentContext);
 
-    // Allocating block's stack
+    // Creating block object with the inline stack
     const uint32_t stackSize = ec.currentContext->method->stackSize;
-    newBlock->stack    = newObject<TObjectArray>(stackSize/*, false*/);
+    hptr<TBlock> newBlock = newObject<TBlock>(stackSize);
+    newBlock->setInlineStack(TBlock::FIELDS_COUNT);
 
     newBlock->argumentLocation = ec.instruction.getArgument();
     newBlock->blockBytePointer = ec.bytePointer;
@@ -340,6 +1161,10 @@ void SmalltalkVM::doPushBlock(TVMExecutionContext& ec)
     else
         newBlock->creatingContext = ec.currentContext;
 
+    // Block may outlive the creating context and return to its caller,
+    // so neither of them may be reused when they return
+    markContextEscaped(newBlock->creatingContext);
+
     // Inheriting the context objects
     newBlock->method      = ec.currentContext->method;
     newBlock->arguments   = ec.currentContext->arguments;
@@ -351,20 +1176,232 @@ void SmalltalkVM::doPushBlock(TVMExecutionContext& ec)
     ec.stackPush(newBlock);
 }
 
+void SmalltalkVM::materializeArguments(hptr<TContext>& context)
+{
+    const uint32_t argumentsCount = context->getArgumentsCount();
+    hptr<TObjectArray> arguments = newObject<TObjectArray>(argumentsCount);
+
+    // Context may be moved during the allocation, so slots are taken after it
+    TObject** inlineArguments = context->getArgumentSlots();
+    for (uint32_t index = 0; index < argumentsCount; index++)
+        arguments[index] = inlineArguments[index];
+
+    context->arguments = arguments;
+}
+
+void SmalltalkVM::materializeContextChain(TContext* context)
+{
+    // Image code walks the chain and expects the arguments,
+    // temporaries and stack of every context to be an Array
+    hptr<TContext> currentContext = newPointer(context);
+    while (currentContext != 0 && currentContext != globals.nilObject) {
+        if (currentContext->hasInlineArguments())
+            materializeArguments(currentContext);
+        if (currentContext->hasInlineTemporaries())
+            materializeTemporaries(currentContext);
+        if (currentContext->hasInlineStack())
+            materializeStack(currentContext);
+
+        currentContext = currentContext->previousContext;
+    }
+}
+
+void SmalltalkVM::materializeTemporaries(hptr<TContext>& context)
+{
+    const uint32_t temporariesCount = context->method->temporarySize;
+    hptr<TObjectArray> temporaries = newObject<TObjectArray>(temporariesCount);
+
+    // Context may be moved during the allocation, so slots are taken after it
+    TObject** inlineTemporaries = context->getTemporarySlots();
+    for (uint32_t index = 0; index < temporariesCount; index++)
+        temporaries[index] = inlineTemporaries[index];
+
+    context->temporaries = temporaries;
+}
+
+void SmalltalkVM::materializeStack(hptr<TContext>& context)
+{
+    const uint32_t stackSize = context->getStackSize();
+    hptr<TObjectArray> stack = newObject<TObjectArray>(stackSize);
+
+    // Context may be moved during the allocation, so slots are taken after it
+    TObject** inlineStack = context->getStackSlots();
+    for (uint32_t index = 0; index < stackSize; index++)
+        stack[index] = inlineStack[index];
+
+    context->stack = stack;
+}
+
+void SmalltalkVM::markContextEscaped(TContext* context)
+{
+    // Callers of the escaped context are escaped too, so the walk
+    // stops at the first method context that is already marked.
+    // Blocks change their callers on every invocation, so they
+    // are passed through. They are never recycled anyway.
+    while (context && context != globals.nilObject) {
+        if (context->getClass() != globals.blockClass) {
+            if (context->isEscaped())
+                break;
+            context->setEscaped();
+        }
+
+        context = context->previousContext;
+    }
+}
+
+void SmalltalkVM::recycleContext(TContext* context)
+{
+    // Only contexts created by doSendMessage() are recycled. Contexts
+    // created by the image code or the JIT refer separate arrays.
+    if (context->isEscaped() || context->getClass() != globals.contextClass)
+        return;
+
+    if (! context->hasInlineTemporaries() || ! context->hasInlineStack())
+        return;
+
+    const uint32_t tailSize = context->getSize() - TContext::FIELDS_COUNT;
+    if (tailSize >= MAX_RECYCLED_CONTEXT_SIZE)
+        return;
+
+    context->previousContext = m_contextFreeLists[tailSize];
+    m_contextFreeLists[tailSize] = context;
+    m_contextsRecycled++;
+}
+
+hptr<TContext> SmalltalkVM::newMethodContext(uint32_t argumentsCount, uint32_t temporariesCount, uint32_t stackSize)
+{
+    const uint32_t tailSize = argumentsCount + temporariesCount + stackSize;
+
+    if (tailSize < MAX_RECYCLED_CONTEXT_SIZE && m_contextFreeLists[tailSize]) {
+        hptr<TContext> context = newPointer(m_contextFreeLists[tailSize]);
+        m_contextFreeLists[tailSize] = context->previousContext;
+        m_contextsReused++;
+
+        // Arguments are filled by the caller and stack slots are not read
+        // above the stack top, so only temporaries need to be cleared
+        context->setInlineArguments(argumentsCount);
+        context->setInlineTemporaries(TContext::FIELDS_COUNT + argumentsCount);
+        context->setInlineStack(TContext::FIELDS_COUNT + argumentsCount + temporariesCount);
+
+        TObject** temporaries = context->getTemporarySlots();
+        for (uint32_t index = 0; index < temporariesCount; index++)
+            temporaries[index] = globals.nilObject;
+
+        return context;
+    }
+
+    hptr<TContext> context = newObject<TContext>(tailSize);
+    context->setInlineArguments(argumentsCount);
+    context->setInlineTemporaries(TContext::FIELDS_COUNT + argumentsCount);
+    context->setInlineStack(TContext::FIELDS_COUNT + argumentsCount + temporariesCount);
+    return context;
+}
+
+void SmalltalkVM::flushContextFreeLists()
+{
+    for (uint32_t index = 0; index < MAX_RECYCLED_CONTEXT_SIZE; index++)
+        m_contextFreeLists[index] = 0;
+}
+
 void SmalltalkVM::doMarkArguments(TVMExecutionContext& ec)
 {
-    hptr<TObjectArray> args  = newObject<TObjectArray>(ec.instruction.getArgument());
+    const uint32_t argumentsCount = ec.instruction.getArgument();
+
+    // In most cases arguments are marked for the send that follows. Then there is
+    // no need to pack them into the array. Callee takes them right from our stack.
+    TDecodedMethod* const decodedMethod = ec.decodedMethod;
+    const uint16_t nextIndex = ec.instructionIndex + 1;
+    if (nextIndex < decodedMethod->instructions.size()) {
+        const st::TSmalltalkInstruction& next = decodedMethod->instructions[nextIndex];
+        const bool isSend = next.getOpcode() == opcode::sendMessage;
+        const bool isSuperSend = next.getOpcode() == opcode::doSpecial && next.getArgument() == special::sendToSuper;
+
+        if (isSend || isSuperSend) {
+            // Executing the send instruction right now
+            fetchInstruction(ec);
+
+            TMethod* const method = ec.currentContext->method;
+            if (isSend) {
+                TSymbol* messageSelector = method->literals->getField(ec.instruction.getArgument());
+                doSendMessage(ec, messageSelector, argumentsCount);
+            } else {
+                TSymbol* messageSelector = method->literals->getField(ec.instruction.getExtra());
+                doSendMessage(ec, messageSelector, argumentsCount, method->klass->parentClass);
+            }
+            return;
+        }
+    }
+
+    hptr<TObjectArray> args  = newObject<TObjectArray>(argumentsCount);
 
     // This operation takes specified amount of arguments
     // from top of the stack and creates new array with them
 
-    uint32_t index = ec.instruction.getArgument();
+    uint32_t index = argumentsCount;
     while (index > 0)
         args[--index] = ec.stackPop();
 
     ec.stackPush(args);
 }
 
+void SmalltalkVM::doSendMessage(TVMExecutionContext& ec, TSymbol* selector, uint32_t argumentsCount, TClass* receiverClass /*= 0*/)
+{
+    // Arguments are the topmost stack values, receiver goes first
+    TObject** stackArguments = ec.currentContext->getStackSlots() + ec.stackTop - argumentsCount;
+
+    if (!receiverClass) {
+        TObject* receiver = stackArguments[0];
+        assert(receiver != 0);
+        receiverClass = isSmallInteger(receiver) ? globals.smallIntClass : receiver->getClass();
+        assert(receiverClass != 0);
+    }
+
+    uint8_t shortcut = 0;
+    TMethod* method = lookupMethodAtSendSite(ec, selector, receiverClass, &shortcut);
+
+    // Method that just calls the primitive is not worth a context.
+    // If the primitive fails, the method is sent to handle the failure.
+    if (shortcut && doPrimitiveShortcut(ec, shortcut, argumentsCount))
+        return;
+
+    if (! method) {
+        // #doesNotUnderstand: gets the message arguments as an array
+        hptr<TClass> pReceiverClass = newPointer(receiverClass);
+        hptr<TSymbol> pSelector = newPointer(selector);
+        hptr<TObjectArray> messageArguments = newObject<TObjectArray>(argumentsCount);
+
+        uint32_t index = argumentsCount;
+        while (index > 0)
+            messageArguments[--index] = ec.stackPop();
+
+        doSendMessage(ec, pSelector, messageArguments, pReceiverClass);
+        return;
+    }
+
+    hptr<TMethod> receiverMethod = newPointer(method);
+
+    // Arguments are left in place above the stack top until they are copied.
+    // They are still inside the context, so the GC keeps them up to date.
+    ec.stackTop -= argumentsCount;
+
+    // Save stack and opcode pointers
+    ec.storePointers();
+
+    hptr<TContext> newContext = newMethodContext(argumentsCount, receiverMethod->temporarySize, receiverMethod->stackSize);
+
+    // Current context may be moved during the allocation, so slots are taken after it
+    stackArguments = ec.currentContext->getStackSlots() + ec.stackTop;
+    TObject** inlineArguments = newContext->getArgumentSlots();
+    for (uint32_t index = 0; index < argumentsCount; index++)
+        inlineArguments[index] = stackArguments[index];
+
+    newContext->method      = receiverMethod;
+    newContext->stackTop    = 0;
+    newContext->bytePointer = 0;
+
+    enterContext(ec, newContext);
+}
+
 void SmalltalkVM::doSendMessage(TVMExecutionContext& ec, TSymbol* selector, TObjectArray* arguments, TClass* receiverClass /*= 0*/ )
 {
     hptr<TObjectArray> messageArguments = newPointer(arguments);
@@ -376,7 +1413,7 @@ void SmalltalkVM::doSendMessage(TVMExecutionContext& ec, TSymbol* selector, TObj
         assert(receiverClass != 0);
     }
 
-    hptr<TMethod> receiverMethod = newPointer(lookupMethod(selector, receiverClass));
+    hptr<TMethod> receiverMethod = newPointer(lookupMethodAtSendSite(ec, selector, receiverClass));
 
     // Checking whether we found a method
     if (receiverMethod == 0) {
@@ -388,18 +1425,21 @@ void SmalltalkVM::doSendMessage(TVMExecutionContext& ec, TSymbol* selector, TObj
     // Save stack and opcode pointers
     ec.storePointers();
 
-    // Create a new context for the giving method and arguments
-    hptr<TContext>   newContext = newObject<TContext>();
-    hptr<TObjectArray> newStack = newObject<TObjectArray>(receiverMethod->stackSize);
-    hptr<TObjectArray> newTemps = newObject<TObjectArray>(receiverMethod->temporarySize);
+    // Create a new context for the giving method and arguments.
+    // Temporaries and the stack are allocated inline in the context object.
+    // Arguments were already packed by the caller, so the array is used as is.
+    hptr<TContext> newContext = newMethodContext(0, receiverMethod->temporarySize, receiverMethod->stackSize);
 
-    newContext->stack           = newStack;
-    newContext->temporaries     = newTemps;
     newContext->arguments       = messageArguments;
     newContext->method          = receiverMethod;
     newContext->stackTop        = 0;
     newContext->bytePointer     = 0;
 
+    enterContext(ec, newContext);
+}
+
+void SmalltalkVM::enterContext(TVMExecutionContext& ec, hptr<TContext>& newContext)
+{
     // Suppose that current send message operation is last operation in the current context.
     // If it is true then next instruction will be either stackReturn or blockReturn.
     //
@@ -410,10 +1450,14 @@ void SmalltalkVM::doSendMessage(TVMExecutionContext& ec, TSymbol* selector, TObj
     // previousContext for the newContext. In case of blockReturn it will be the previousContext
     // of the wrapping method context.
 
+    // Skipped context will not be returned to, so it may be reused right away.
+    TContext* skippedContext = 0;
+
     uint8_t nextInstruction = ec.currentContext->method->byteCodes->getByte(ec.bytePointer);
     if (nextInstruction == (opcode::doSpecial * 16 + special::stackReturn)) {
         // Optimizing stack return
         newContext->previousContext = ec.currentContext->previousContext;
+        skippedContext = ec.currentContext;
     } else if (nextInstruction == (opcode::doSpecial * 16 + special::blockReturn) &&
               (ec.currentContext->getClass() == globals.blockClass))
     {
@@ -427,6 +1471,9 @@ void SmalltalkVM::doSendMessage(TVMExecutionContext& ec, TSymbol* selector, TObj
     ec.currentContext = newContext;
     ec.loadPointers();
 
+    if (skippedContext)
+        recycleContext(skippedContext);
+
     m_messagesSent++;
 }
 
@@ -489,65 +1536,63 @@ void SmalltalkVM::doSendBinary(TVMExecutionContext& ec)
     TObject* rightObject = ec.stackPop();
     TObject* leftObject  = ec.stackPop();
 
-    // If operands are both small integers, we may handle it ourselves
-    if (isSmallInteger(leftObject) && isSmallInteger(rightObject)) {
-        // Loading actual operand values
-        int32_t rightOperand = TInteger(rightObject);
-        int32_t leftOperand  = TInteger(leftObject);
-        bool unusedCondition;
-
-        // Performing an operation
-        switch ( static_cast<binaryBuiltIns::Operator>(ec.instruction.getArgument()) ) {
-            case binaryBuiltIns::operatorLess:
-                ec.returnedValue = (leftOperand < rightOperand) ? globals.trueObject : globals.falseObject;
-                break;
-
-            case binaryBuiltIns::operatorLessOrEq:
-                ec.returnedValue = (leftOperand <= rightOperand) ? globals.trueObject : globals.falseObject;
-                break;
-
-            case binaryBuiltIns::operatorPlus:
-                ec.returnedValue = callSmallIntPrimitive(primitive::smallIntAdd, leftOperand, rightOperand, unusedCondition);
-                break;
-
-            default:
-                std::fprintf(stderr, "VM: Invalid opcode %d passed to sendBinary\n", ec.instruction.getArgument());
-                std::exit(1);
-        }
+    const uint8_t operation = ec.instruction.getArgument();
+    if (operation >= binaryBuiltIns::operatorsCount) {
+        std::fprintf(stderr, "VM: Invalid opcode %d passed to sendBinary\n", operation);
+        std::exit(1);
+    }
 
+    // Identity does not depend on the class of operands
+    if (operation == binaryBuiltIns::operatorIdentical) {
+        ec.returnedValue = (leftObject == rightObject) ? globals.trueObject : globals.falseObject;
         ec.stackPush( ec.returnedValue );
         m_messagesSent++;
-    } else {
-        // This binary operator is performed on an ordinary object.
-        // We do not know how to handle it, thus send the message to the receiver
-
-        // Protecting pointers in case if GC occurs
-        hptr<TObject> pRightObject = newPointer(rightObject);
-        hptr<TObject> pLeftObject  = newPointer(leftObject);
+        return;
+    }
 
-        hptr<TObjectArray> messageArguments = newObject<TObjectArray>(2/*, false*/);
-        messageArguments[1] = pRightObject;
-        messageArguments[0] = pLeftObject;
+    // If operands are both small integers, we may handle it ourselves
+    if (isSmallInteger(leftObject) && isSmallInteger(rightObject)) {
+        TObject* result = 0;
+        if (evaluateSmallIntOperator(operation, TInteger(leftObject), TInteger(rightObject), result)) {
+            ec.returnedValue = result;
+            ec.stackPush( ec.returnedValue );
+            m_messagesSent++;
+            return;
+        }
+    }
 
-        TSymbol* messageSelector = static_cast<TSymbol*>( globals.binaryMessages[ec.instruction.getArgument()] );
-        doSendMessage(ec, messageSelector, messageArguments);
+    // This binary operator is performed on an ordinary object or the result
+    // does not fit into the small integer. We do not know how to handle it,
+    // thus send the message to the receiver.
+    // Operands are put back to the stack to be passed as the arguments.
+    ec.stackTop += 2;
+
+    TSymbol* messageSelector = static_cast<TSymbol*>( globals.binaryMessages[operation] );
+    if (! messageSelector) {
+        std::fprintf(stderr, "VM: Selector %s is not found in the image\n",
+            binaryBuiltIns::getOperatorName(static_cast<binaryBuiltIns::Operator>(operation)));
+        std::exit(1);
     }
+
+    doSendMessage(ec, messageSelector, 2);
 }
 
 SmalltalkVM::TExecuteResult SmalltalkVM::doSpecial(hptr<TProcess>& process, TVMExecutionContext& ec)
 {
-    TObjectArray& arguments  = * ec.currentContext->arguments;
+    TObject**     arguments  =   ec.currentContext->getArgumentSlots();
     TSymbolArray& literals   = * ec.currentContext->method->literals;
 
     switch(ec.instruction.getArgument())
     {
         case special::selfReturn: {
+            TContext* finishedContext = ec.currentContext;
             ec.returnedValue  = arguments[0]; // arguments[0] always keep self
-            ec.currentContext = ec.currentContext->previousContext;
+            ec.currentContext = finishedContext->previousContext;
+            recycleContext(finishedContext);
 
             if (ec.currentContext.rawptr() == globals.nilObject) {
-                process->context = ec.currentContext;
-                process->result  = ec.returnedValue;
+                assignPointer(process->context, ec.currentContext);
+                assignPointer(process->result, ec.returnedValue);
                 return returnReturned;
             }
 
@@ -556,12 +1601,14 @@ SmalltalkVM::TExecuteResult SmalltalkVM::doSpecial(hptr<TProcess>& process, TVME
         } break;
 
         case special::stackReturn: {
+            TContext* finishedContext = ec.currentContext;
             ec.returnedValue  = ec.stackPop();
-            ec.currentContext = ec.currentContext->previousContext;
+            ec.currentContext = finishedContext->previousContext;
+            recycleContext(finishedContext);
 
             if (ec.currentContext.rawptr() == globals.nilObject) {
-                process->context = ec.currentContext;
-                process->result  = ec.returnedValue;
+                assignPointer(process->context, ec.currentContext);
+                assignPointer(process->result, ec.returnedValue);
                 return returnReturned;
             }
 
@@ -575,8 +1622,8 @@ SmalltalkVM::TExecuteResult SmalltalkVM::doSpecial(hptr<TProcess>& process, TVME
             ec.currentContext = contextAsBlock->creatingContext->previousContext;
 
             if (ec.currentContext.rawptr() == globals.nilObject) {
-                process->context = ec.currentContext;
-                process->result  = ec.returnedValue;
+                assignPointer(process->context, ec.currentContext);
+                assignPointer(process->result, ec.returnedValue);
                 return returnReturned;
             }
 
@@ -701,11 +1748,13 @@ SmalltalkVM::TExecuteResult SmalltalkVM::doPrimitive(hptr<TProcess>& process, TV
         default:
             // We have executed a primitive. Now we have to reject the current
             // execution context and push the result onto the previous context's stack
-            ec.currentContext = ec.currentContext->previousContext;
+            TContext* finishedContext = ec.currentContext;
+            ec.currentContext = finishedContext->previousContext;
+            recycleContext(finishedContext);
 
             if (ec.currentContext.rawptr() == globals.nilObject) {
-                process->context = ec.currentContext;
-                process->result  = ec.returnedValue;
+                assignPointer(process->context, ec.currentContext);
+                assignPointer(process->result, ec.returnedValue);
                 return returnReturned;
             }
 
@@ -735,12 +1784,83 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
 
         case 254:
             m_memoryManager->collectGarbage();
+            onCollectionOccured();
+            break;
+
+        case primitive::pushRegion: // 42
+            if (m_memoryManager->pushRegion())
+                return globals.trueObject;
+
+            failed = true;
             break;
 
+        case primitive::popRegion: { // 43
+            // Result of the region is kept by the handle, so it is promoted
+            hptr<TObject> result = newPointer(ec.stackPop());
+
+            if (! m_memoryManager->popRegion()) {
+                failed = true;
+                break;
+            }
+
+            // Promoted objects were moved to the parent region
+            onCollectionOccured();
+            return result;
+        }
+
+        case primitive::allocatePinnedByteArray: { // 44
+            TObject* sizeObject = ec.stackPop();
+            hptr<TClass> klass  = newPointer(ec.stackPop<TClass>());
+
+            if (! isValidObjectSize(sizeObject)) {
+                failed = true;
+                break;
+            }
+
+            const uint32_t dataSize = TInteger(sizeObject);
+            void* objectSlot = m_memoryManager->allocateNonMoving(correctPadding(sizeof(TByteObject) + dataSize), &m_lastGCOccured);
+
+            if (m_lastGCOccured)
+                onCollectionOccured();
+
+            if (!objectSlot) {
+                failed = true;
+                break;
+            }
+
+            TByteObject* const instance = new (objectSlot) TByteObject(dataSize, klass);
+            std::memset(instance->getBytes(), 0, dataSize);
+
+            // Array is pinned from the start, so it never moves
+            if (! m_memoryManager->pinObject(instance)) {
+                failed = true;
+                break;
+            }
+            return instance;
+        }
+
+        case primitive::pinObject:   // 45
+        case primitive::unpinObject: { // 46
+            TObject* object = ec.stackPop();
+            const bool pinned = (opcode == primitive::pinObject) ?
+                m_memoryManager->pinObject(object) :
+                m_memoryManager->unpinObject(object);
+
+            if (pinned)
+                return object;
+
+            failed = true;
+        } break;
+
 #if defined(LLVM)
         case primitive::LLVMsendMessage: { //252
-            TObjectArray* args = ec.stackPop<TObjectArray>();
-            TSymbol*  selector = ec.stackPop<TSymbol>();
+            // Operands are kept by the handles, since materialization allocates
+            hptr<TObjectArray> args = newPointer(ec.stackPop<TObjectArray>());
+            hptr<TSymbol>  selector = newPointer(ec.stackPop<TSymbol>());
+
+            // JIT contexts refer the calling ones and are out of our control
+            materializeContextChain(ec.currentContext);
+            markContextEscaped(ec.currentContext);
             try {
                 return sendMessage(ec.currentContext, selector, args, 0);
             } catch(TBlockReturn& blockReturn) {
@@ -753,7 +1873,7 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
                 //context is thrown by LLVM:throwError primitive
                 //that means that it was not caught by LLVM:executeProcess function
                 //so we have to stop execution of the current process and return returnError
-                process->context = errorContext;
+                assignPointer(process->context, errorContext);
                 failed = true;
                 return globals.nilObject;
             }
@@ -761,13 +1881,15 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
 
         case 247: { // Jit once: aBlock
             try {
-                TBlock* const block = ec.stackPop<TBlock>();
+                hptr<TBlock> block = newPointer(ec.stackPop<TBlock>());
+                materializeContextChain(ec.currentContext);
+                markContextEscaped(ec.currentContext);
                 return JITRuntime::Instance()->invokeBlock(block, ec.currentContext, true);
             } catch(TBlockReturn& blockReturn) {
                 ec.currentContext = blockReturn.targetContext;
                 return blockReturn.value;
             } catch(TContext* errorContext) {
-                process->context = errorContext;
+                assignPointer(process->context, errorContext);
                 failed = true;
                 return globals.nilObject;
             }
@@ -823,6 +1945,11 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
             // Taking object's size and class from the stack
             TObject* size  = ec.stackPop();
             TClass*  klass = ec.stackPop<TClass>();
+
+            if (! isValidObjectSize(size)) {
+                failed = true;
+                break;
+            }
             uint32_t fieldsCount = TInteger(size);
 
             // Instantinating the object. Each object has size and class fields
@@ -850,9 +1977,12 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
             for (uint32_t index = argCount - 1, count = argCount; count > 0; index--, count--)
                 (*blockTemps)[argumentLocation + index] = ec.stackPop();
 
-            // Switching execution context to the invoking block
-            block->previousContext = ec.currentContext->previousContext;
+            // Switching execution context to the invoking block.
+            // Context of the #value method is skipped and may be reused.
+            TContext* skippedContext = ec.currentContext;
+            block->previousContext = skippedContext->previousContext;
             ec.currentContext = static_cast<TContext*>(block);
+            recycleContext(skippedContext);
             ec.stackTop = 0; // resetting stack
 
             // Block is bound to the method's bytecodes, so it's
@@ -863,15 +1993,22 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
         } break;
 
         case primitive::throwError: // 19
-            process->context = ec.currentContext;
-            process->result  = ec.returnedValue;
+            materializeContextChain(ec.currentContext);
+            markContextEscaped(ec.currentContext);
+            assignPointer(process->context, ec.currentContext);
+            assignPointer(process->result, ec.returnedValue);
             break;
 
         case primitive::allocateByteArray: { // 20
-            TInteger dataSize = ec.stackPop();
-            TClass* klass     = ec.stackPop<TClass>();
+            TObject* sizeObject = ec.stackPop();
+            TClass* klass       = ec.stackPop<TClass>();
 
-            return newBinaryObject(klass, dataSize);
+            if (! isValidObjectSize(sizeObject)) {
+                failed = true;
+                break;
+            }
+
+            return newBinaryObject(klass, TInteger(sizeObject));
         } break;
 
         case primitive::arrayAt:      // 24
@@ -952,6 +2089,7 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
 
         case primitive::flushCache: // 34
             flushMethodCache();
+            flushDecodedMethods();
             break;
 
         case primitive::bulkReplace: { // 38
@@ -1015,13 +2153,11 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
         case primitive::getSystemTicks:     //253
 
         default: {
+            // Arguments are passed right from the stack
             uint32_t argCount = ec.instruction.getArgument();
-            hptr<TObjectArray> args = newObject<TObjectArray>(argCount);
-
-            uint32_t i = argCount;
-            while (i > 0)
-                args[--i] = ec.stackPop();
+            ec.stackTop -= argCount;
 
+            TObject** args = ec.currentContext->getStackSlots() + ec.stackTop;
             TObject* result = callPrimitive(opcode, args, failed);
             return result;
         }
@@ -1033,8 +2169,14 @@ TObject* SmalltalkVM::performPrimitive(uint8_t opcode, hptr<TProcess>& process,
 void SmalltalkVM::onCollectionOccured()
 {
     // Here we need to handle the GC collection event
-    //printf("VM: GC had just occured. Flushing the method cache.\n");
-    flushMethodCache();
+    //printf("VM: GC had just occured. Purging the method cache.\n");
+    purgeMethodCache();
+
+    // Dynamic methods were moved, so their decoded forms are keyed by stale pointers
+    flushDecodedMethods(true);
+
+    // Free contexts were not preserved by the collector
+    flushContextFreeLists();
 }
 
 bool SmalltalkVM::doBulkReplace( TObject* destination, TObject* destinationStartOffset, TObject* destinationStopOffset, TObject* source, TObject* sourceStartOffset) {
@@ -1090,10 +2232,24 @@ bool SmalltalkVM::doBulkReplace( TObject* destination, TObject* destinationStart
         TObject** sourceFields      = source->getFields();
         TObject** destinationFields = destination->getFields();
 
+        // Every slot is checked by the memory manager, so fields are copied one by one.
         // Primitive may be called on the same object, so memory overlapping may occur.
-        // memmove() works much like the ordinary memcpy() except that it correctly
-        // handles the case with overlapping memory areas
-        std::memmove( & destinationFields[iDestinationStartOffset], & sourceFields[iSourceStartOffset], iCount * sizeof(TObject*) );
+        // Copying direction is chosen just as memmove() does.
+        if (iDestinationStartOffset <= iSourceStartOffset) {
+            for (int32_t index = 0; index < iCount; index++) {
+                TObject*  value = sourceFields[iSourceStartOffset + index];
+                TObject** slot  = & destinationFields[iDestinationStartOffset + index];
+                checkRoot(value, slot);
+                *slot = value;
+            }
+        } else {
+            for (int32_t index = iCount - 1; index >= 0; index--) {
+                TObject*  value = sourceFields[iSourceStartOffset + index];
+                TObject** slot  = & destinationFields[iDestinationStartOffset + index];
+                checkRoot(value, slot);
+                *slot = value;
+            }
+        }
         return true;
     }
 
@@ -1105,4 +2261,21 @@ void SmalltalkVM::printVMStat()
     float hitRatio = 100.0 * m_cacheHits / (m_cacheHits + m_cacheMisses);
     std::printf("%d messages sent, cache hits: %d, misses: %d, hit ratio %.2f %%\n",
         m_messagesSent, m_cacheHits, m_cacheMisses, hitRatio);
+    std::printf("lookup cache: %u entries, %u-way set associative\n",
+        static_cast<uint32_t>(m_lookupCache.size()), static_cast<uint32_t>(LOOKUP_CACHE_WAYS));
+
+    std::size_t decodedMethodsMemory = 0;
+    TDecodedMethodMap::const_iterator iMethod = m_decodedMethods.begin();
+    for (; iMethod != m_decodedMethods.end(); ++iMethod)
+        decodedMethodsMemory += iMethod->second->getMemoryUsage();
+
+    const uint32_t inlineCacheLookups = m_inlineCacheHits + m_inlineCacheMisses;
+    std::printf("inline cache hits: %u, misses: %u, hit ratio %.2f %%\n",
+        m_inlineCacheHits, m_inlineCacheMisses, inlineCacheLookups ? 100.0 * m_inlineCacheHits / inlineCacheLookups : 0.0);
+
+    std::printf("%u decoded methods take %u bytes\n",
+        static_cast<uint32_t>(m_decodedMethods.size()), static_cast<uint32_t>(decodedMethodsMemory));
+
+    std::printf("%u contexts recycled, %u reused\n", m_contextsRecycled, m_contextsReused);
+    std::printf("%u sends replaced by the primitive call\n", m_primitiveShortcuts);
 }
@@ -0,0 +1,736 @@
+#include <gtest/gtest.h>
+#include <memory.h>
+
+#include <cstring>
+#include <csetjmp>
+#include <csignal>
+#include <sys/mman.h>
+
+// Class of the test objects resides in the static heap and never moves
+static TClass* newStaticClass(IMemoryManager& memoryManager)
+{
+    return static_cast<TClass*>( new (memoryManager.staticAllocate(sizeof(TObject))) TObject(0, 0) );
+}
+
+// Initializes the heap of the collector and answers the class of the test objects
+static TClass* initializeTestHeap(IMemoryManager& memoryManager, std::size_t heapSize, std::size_t maxHeapSize = 0)
+{
+    memoryManager.initializeHeap(heapSize, maxHeapSize);
+    memoryManager.initializeStaticHeap(1024);
+    return newStaticClass(memoryManager);
+}
+
+// Builds the same binary tree of objects in the heap of any copying collector
+// and checks that it survives the collection. Collections are timed, so the
+// pause times of different algorithms may be compared on identical heaps.
+template <typename MemoryManager>
+class H_CopyingHeap
+{
+    MemoryManager m_memoryManager;
+    TClass* m_nodeClass;
+    TClass* m_leafClass;
+    object_ptr m_root;
+
+    TObject* newObject(uint32_t fieldsCount, TClass* klass) {
+        bool collectionOccured = false;
+        void* slot = m_memoryManager.allocate(sizeof(TObject) + fieldsCount * sizeof(TObject*), &collectionOccured);
+        EXPECT_FALSE(collectionOccured);
+        return new (slot) TObject(fieldsCount, klass);
+    }
+
+    TObject* newLeaf(uint32_t value) {
+        bool collectionOccured = false;
+        void* slot = m_memoryManager.allocate(correctPadding(sizeof(TByteObject) + sizeof(value)), &collectionOccured);
+        EXPECT_FALSE(collectionOccured);
+        TByteObject* leaf = new (slot) TByteObject(sizeof(value), m_leafClass);
+        std::memcpy(leaf->getBytes(), &value, sizeof(value));
+        return leaf;
+    }
+
+    // Node fields are: left, right, value
+    TObject* buildTree(uint32_t depth, uint32_t& counter) {
+        if (depth == 0)
+            return newLeaf(counter++);
+
+        TObject* left  = buildTree(depth - 1, counter);
+        TObject* right = buildTree(depth - 1, counter);
+
+        TObject* node = newObject(3, m_nodeClass);
+        newObject(2, m_nodeClass); // garbage between the live objects
+
+        node->putField(0, left);
+        node->putField(1, right);
+        node->putField(2, TInteger(counter++));
+        return node;
+    }
+
+    uint64_t checksum(TObject* object) {
+        if (object->getClass() == m_leafClass) {
+            uint32_t value;
+            std::memcpy(&value, static_cast<TByteObject*>(object)->getBytes(), sizeof(value));
+            return value;
+        }
+
+        EXPECT_EQ(m_nodeClass, object->getClass());
+        return checksum(object->getField(0)) + checksum(object->getField(1)) + TInteger(object->getField(2)).getValue();
+    }
+public:
+    H_CopyingHeap(std::size_t heapSize) : m_root() {
+        m_nodeClass = initializeTestHeap(m_memoryManager, heapSize, heapSize);
+        m_leafClass = newStaticClass(m_memoryManager);
+
+        m_memoryManager.registerExternalHeapPointer(m_root);
+    }
+
+    ~H_CopyingHeap() { m_memoryManager.releaseExternalHeapPointer(m_root); }
+
+    uint64_t build(uint32_t depth) {
+        uint32_t counter = 0;
+        m_root.data = buildTree(depth, counter);
+        return checksum(m_root.data);
+    }
+
+    uint64_t checksum() { return checksum(m_root.data); }
+    TObject* root() { return m_root.data; }
+    MemoryManager& memoryManager() { return m_memoryManager; }
+
+    // Returns the collection time in microseconds
+    uint64_t collect() {
+        const uint64_t delayBefore = m_memoryManager.getStat().totalCollectionDelay;
+        m_memoryManager.collectGarbage();
+        return m_memoryManager.getStat().totalCollectionDelay - delayBefore;
+    }
+};
+
+template <typename MemoryManager>
+class T_CopyingCollector : public ::testing::Test {};
+
+typedef ::testing::Types<BakerMemoryManager, CheneyMemoryManager, ParallelMemoryManager, GenerationalMemoryManager, IncrementalMemoryManager> CopyingCollectors;
+TYPED_TEST_CASE(T_CopyingCollector, CopyingCollectors);
+
+TYPED_TEST(T_CopyingCollector, treeSurvivesCollection)
+{
+    H_CopyingHeap<TypeParam> heap(8 * 1024 * 1024);
+    const uint64_t expected = heap.build(12);
+
+    for (int pass = 0; pass < 3; pass++) {
+        TObject* const rootBefore = heap.root();
+        heap.collect();
+
+        EXPECT_NE(rootBefore, heap.root()) << "root object should be moved";
+        EXPECT_EQ(expected, heap.checksum()) << "pass " << pass;
+    }
+}
+
+TYPED_TEST(T_CopyingCollector, identityHashSurvivesCollection)
+{
+    H_CopyingHeap<TypeParam> heap(8 * 1024 * 1024);
+    const uint64_t expected = heap.build(2);
+
+    // Hash of the node and of the binary leaf is taken before they move
+    TObject* const nodeHash = heap.root()->getIdentityHash();
+    TObject* const leafHash = heap.root()->getField(0)->getField(0)->getIdentityHash();
+    EXPECT_NE(nodeHash, leafHash);
+
+    for (int pass = 0; pass < 3; pass++) {
+        heap.collect();
+
+        EXPECT_EQ(nodeHash, heap.root()->getIdentityHash()) << "pass " << pass;
+        EXPECT_EQ(leafHash, heap.root()->getField(0)->getField(0)->getIdentityHash()) << "pass " << pass;
+        EXPECT_EQ(expected, heap.checksum()) << "pass " << pass;
+    }
+}
+
+TYPED_TEST(T_CopyingCollector, hashedObjectsFillTheHeap)
+{
+    TypeParam memoryManager;
+    TClass* const klass = initializeTestHeap(memoryManager, 128 * 1024, 8 * 1024 * 1024);
+
+    // Every object is live and hashed before it is moved, so each
+    // collection happens in a heap full of objects getting the hash slot
+    object_ptr head;
+    memoryManager.registerExternalHeapPointer(head);
+    head.data = TInteger(0);
+
+    const uint32_t objectsCount = 32 * 1024;
+    for (uint32_t index = 0; index < objectsCount; index++) {
+        void* const slot = memoryManager.allocate(sizeof(TObject) + 2 * sizeof(TObject*));
+        ASSERT_TRUE(slot != 0);
+
+        TObject* const object = new (slot) TObject(2, klass);
+        object->putField(0, head.data);
+        object->putField(1, object->getIdentityHash());
+        head.data = object;
+    }
+
+    memoryManager.collectGarbage();
+    EXPECT_LT(0u, memoryManager.getStat().collectionsCount);
+
+    uint32_t count = 0;
+    for (TObject* object = head.data; !isSmallInteger(object); object = object->getField(0), count++)
+        ASSERT_EQ(object->getField(1), object->getIdentityHash());
+    EXPECT_EQ(objectsCount, count);
+
+    memoryManager.releaseExternalHeapPointer(head);
+}
+
+TEST(GenerationalCollector, oldToYoungReference)
+{
+    GenerationalMemoryManager memoryManager(64 * 1024, 2);
+    TClass* const klass = initializeTestHeap(memoryManager, 1024 * 1024, 1024 * 1024);
+
+    object_ptr holder;
+    memoryManager.registerExternalHeapPointer(holder);
+    holder.data = new (memoryManager.allocate(sizeof(TObject) + sizeof(TObject*))) TObject(1, klass);
+    holder.data->putField(0, TInteger(0));
+
+    // Holder gets tenured
+    for (int pass = 0; pass < 3; pass++)
+        memoryManager.collectGarbage();
+
+    // Young object is referred only by the old one
+    const uint32_t value = 42;
+    TByteObject* const leaf = new (memoryManager.allocate(correctPadding(sizeof(TByteObject) + sizeof(value)))) TByteObject(sizeof(value), klass);
+    std::memcpy(leaf->getBytes(), &value, sizeof(value));
+
+    memoryManager.writeBarrier(leaf, & holder.data->getFields()[0]);
+    holder.data->putField(0, leaf);
+
+    // Garbage triggers a number of young collections
+    for (int index = 0; index < 16 * 1024; index++)
+        new (memoryManager.allocate(sizeof(TObject) + 4 * sizeof(TObject*))) TObject(4, klass);
+
+    const TMemoryManagerInfo info = memoryManager.getStat();
+    EXPECT_LT(3u, info.leftToRightCollections);
+    EXPECT_EQ(0u, info.rightToLeftCollections);
+
+    TObject* const survivor = holder.data->getField(0);
+    ASSERT_EQ(klass, survivor->getClass());
+
+    uint32_t survivedValue = 0;
+    std::memcpy(&survivedValue, static_cast<TByteObject*>(survivor)->getBytes(), sizeof(survivedValue));
+    EXPECT_EQ(value, survivedValue);
+
+    memoryManager.releaseExternalHeapPointer(holder);
+}
+
+TEST(GenerationalCollector, largeObjectIsFilledWithoutBarrier)
+{
+    GenerationalMemoryManager memoryManager(64 * 1024, 2);
+    TClass* const klass = initializeTestHeap(memoryManager, 1024 * 1024, 1024 * 1024);
+
+    object_ptr young;
+    memoryManager.registerExternalHeapPointer(young);
+    young.data = new (memoryManager.allocate(sizeof(TObject) + sizeof(TObject*))) TObject(1, klass);
+    young.data->putField(0, TInteger(42));
+
+    // Object that is too large for the nursery is allocated in the old space.
+    // The VM fills new objects right away without calling checkRoot().
+    const uint32_t fieldsCount = 5000;
+    object_ptr holder;
+    memoryManager.registerExternalHeapPointer(holder);
+    holder.data = new (memoryManager.allocate(sizeof(TObject) + fieldsCount * sizeof(TObject*))) TObject(fieldsCount, klass);
+    for (uint32_t index = 0; index < fieldsCount; index++)
+        holder.data->putField(index, young.data);
+
+    for (int pass = 0; pass < 3; pass++)
+        memoryManager.collectGarbage();
+
+    EXPECT_EQ(0u, memoryManager.getStat().rightToLeftCollections);
+    for (uint32_t index = 0; index < fieldsCount; index++)
+        ASSERT_EQ(young.data, holder.data->getField(index));
+    EXPECT_EQ(42, TInteger(young.data->getField(0)).getValue());
+
+    memoryManager.releaseExternalHeapPointer(young);
+    memoryManager.releaseExternalHeapPointer(holder);
+}
+
+TEST(GenerationalCollector, fullCollectionCompactsOldSpace)
+{
+    GenerationalMemoryManager memoryManager(64 * 1024, 2);
+    TClass* const klass = initializeTestHeap(memoryManager, 1024 * 1024, 1024 * 1024);
+
+    // Objects that are too large for the nursery are allocated in the old space
+    const uint32_t fieldsCount = 5000;
+    const std::size_t largeSize = sizeof(TObject) + fieldsCount * sizeof(TObject*);
+
+    TObject* const garbage = new (memoryManager.allocate(largeSize)) TObject(fieldsCount, klass);
+    for (uint32_t index = 0; index < fieldsCount; index++)
+        garbage->putField(index, TInteger(0));
+
+    object_ptr holder;
+    memoryManager.registerExternalHeapPointer(holder);
+    holder.data = new (memoryManager.allocate(largeSize)) TObject(fieldsCount, klass);
+    for (uint32_t index = 0; index < fieldsCount; index++)
+        holder.data->putField(index, TInteger(index));
+
+    TObject* const addressBefore = holder.data;
+    TObject* const hash = holder.data->getIdentityHash();
+
+    // Old space gets exhausted by the large garbage
+    for (int index = 0; index < 64; index++) {
+        TObject* const object = new (memoryManager.allocate(largeSize)) TObject(fieldsCount, klass);
+        for (uint32_t field = 0; field < fieldsCount; field++)
+            object->putField(field, TInteger(0));
+    }
+
+    EXPECT_LT(0u, memoryManager.getStat().rightToLeftCollections);
+
+    // Live object slides down over the garbage and keeps its hash
+    EXPECT_GT(addressBefore, holder.data);
+    EXPECT_EQ(hash, holder.data->getIdentityHash());
+    for (uint32_t index = 0; index < fieldsCount; index++)
+        ASSERT_EQ(static_cast<int32_t>(index), TInteger(holder.data->getField(index)).getValue());
+
+    memoryManager.releaseExternalHeapPointer(holder);
+}
+
+TEST(AllocationBuffer, bufferedObjectsSurviveCollection)
+{
+    GenerationalMemoryManager memoryManager(64 * 1024, 2);
+    TClass* const klass = initializeTestHeap(memoryManager, 1024 * 1024, 1024 * 1024);
+    TObject* const nilObject = new (memoryManager.staticAllocate(sizeof(TObject))) TObject(0, 0);
+
+    // Buffer is filled only when nil is known
+    TObject* const previousNil = globals.nilObject;
+    globals.nilObject = nilObject;
+
+    const std::size_t slotSize = sizeof(TObject) + 2 * sizeof(TObject*);
+
+    object_ptr holder;
+    memoryManager.registerExternalHeapPointer(holder);
+    holder.data = new (memoryManager.allocate(slotSize)) TObject(2, klass);
+    holder.data->putField(0, TInteger(0));
+    holder.data->putField(1, TInteger(0));
+
+    // Fields of the buffered object are already nil
+    void* const slot = memoryManager.allocateInBuffer(slotSize);
+    ASSERT_TRUE(slot != 0);
+
+    TObject* const object = new (slot) TObject(2, klass);
+    EXPECT_EQ(nilObject, object->getField(0));
+    EXPECT_EQ(nilObject, object->getField(1));
+
+    object->putField(0, TInteger(42));
+    holder.data->putField(0, object);
+
+    // Collection retires the buffer
+    memoryManager.collectGarbage();
+    EXPECT_EQ(0, memoryManager.allocateInBuffer(slotSize));
+
+    TObject* const survivor = holder.data->getField(0);
+    ASSERT_EQ(klass, survivor->getClass());
+    EXPECT_EQ(42, TInteger(survivor->getField(0)).getValue());
+    EXPECT_EQ(nilObject, survivor->getField(1));
+
+    globals.nilObject = previousNil;
+    memoryManager.releaseExternalHeapPointer(holder);
+}
+
+TEST(RegionMemoryManager, escapingObjectsArePromoted)
+{
+    RegionMemoryManager memoryManager;
+    TClass* const klass = initializeTestHeap(memoryManager, 1024 * 1024, 1024 * 1024);
+    const std::size_t slotSize = sizeof(TObject) + sizeof(TObject*);
+
+    EXPECT_FALSE(memoryManager.popRegion());
+
+    object_ptr holder;
+    memoryManager.registerExternalHeapPointer(holder);
+    holder.data = new (memoryManager.allocate(slotSize)) TObject(1, klass);
+    holder.data->putField(0, TInteger(0));
+
+    ASSERT_TRUE(memoryManager.pushRegion());
+
+    // Garbage precedes the object that escapes the region
+    TObject* const regionStart = new (memoryManager.allocate(slotSize)) TObject(1, klass);
+    regionStart->putField(0, TInteger(0));
+    for (int index = 0; index < 1024; index++)
+        new (memoryManager.allocate(slotSize)) TObject(1, klass);
+
+    TObject* const escaping = new (memoryManager.allocate(slotSize)) TObject(1, klass);
+    escaping->putField(0, TInteger(42));
+
+    memoryManager.writeBarrier(escaping, & holder.data->getFields()[0]);
+    holder.data->putField(0, escaping);
+
+    ASSERT_TRUE(memoryManager.popRegion());
+
+    // Only the escaping object is left in place of the region
+    TObject* const survivor = holder.data->getField(0);
+    EXPECT_EQ(regionStart, survivor);
+    ASSERT_EQ(klass, survivor->getClass());
+    EXPECT_EQ(42, TInteger(survivor->getField(0)).getValue());
+    EXPECT_EQ(reinterpret_cast<uint8_t*>(survivor) + slotSize, memoryManager.allocate(slotSize));
+
+    memoryManager.releaseExternalHeapPointer(holder);
+}
+
+TEST(HandleStack, outOfOrderRelease)
+{
+    THandleStack handles;
+    TObject* slots[3];
+
+    const std::size_t first  = handles.push(&slots[0]);
+    const std::size_t second = handles.push(&slots[1]);
+    handles.push(&slots[2]);
+
+    // Released slot is cleared until the slots above it are popped
+    handles.pop(second, &slots[1]);
+    EXPECT_EQ(3u, handles.size());
+    EXPECT_EQ(0, handles[second]);
+
+    handles.pop(2, &slots[2]);
+    EXPECT_EQ(1u, handles.size());
+    EXPECT_EQ(&slots[0], handles[first]);
+
+    handles.pop(first, &slots[0]);
+    EXPECT_EQ(0u, handles.size());
+}
+
+TEST(HandleStack, handleOutlivesScope)
+{
+    BakerMemoryManager memoryManager;
+    TClass* const klass = initializeTestHeap(memoryManager, 64 * 1024);
+    const std::size_t slotSize = sizeof(TObject) + sizeof(TObject*);
+
+    hptr<TObject>* stale = 0;
+    {
+        THandleScope scope(&memoryManager);
+        stale = new hptr<TObject>(new (memoryManager.allocate(slotSize)) TObject(1, klass), &memoryManager);
+    }
+
+    // Slot of the stale handle is taken by the newer one
+    hptr<TObject> pointer(new (memoryManager.allocate(slotSize)) TObject(1, klass), &memoryManager);
+    pointer->putField(0, TInteger(42));
+    hptr<TObject> above(pointer);
+
+    delete stale;
+    EXPECT_EQ(2u, memoryManager.getHandles().size());
+    EXPECT_TRUE(memoryManager.getHandles()[0] != 0);
+
+    TObject* const addressBefore = pointer.rawptr();
+    memoryManager.collectGarbage();
+    EXPECT_NE(addressBefore, pointer.rawptr());
+    EXPECT_EQ(above.rawptr(), pointer.rawptr());
+    EXPECT_EQ(42, TInteger(pointer->getField(0)).getValue());
+}
+
+TEST(HandleStack, rootsSurviveCollection)
+{
+    BakerMemoryManager memoryManager;
+    TClass* const klass = initializeTestHeap(memoryManager, 64 * 1024);
+
+    hptr<TObject> pointer(new (memoryManager.allocate(sizeof(TObject) + sizeof(TObject*))) TObject(1, klass), &memoryManager);
+    pointer->putField(0, TInteger(1));
+
+    {
+        THandleScope scope(&memoryManager);
+
+        TObject* raw = new (memoryManager.allocate(sizeof(TObject) + sizeof(TObject*))) TObject(1, klass);
+        raw->putField(0, TInteger(2));
+        scope.protect(raw);
+
+        hptr<TObject> copy(pointer);
+        memoryManager.collectGarbage();
+
+        EXPECT_EQ(pointer.rawptr(), copy.rawptr());
+        EXPECT_EQ(1, TInteger(copy->getField(0)).getValue());
+        EXPECT_EQ(2, TInteger(raw->getField(0)).getValue());
+        EXPECT_EQ(3u, memoryManager.getHandles().size());
+    }
+
+    EXPECT_EQ(1u, memoryManager.getHandles().size());
+    memoryManager.collectGarbage();
+    EXPECT_EQ(1, TInteger(pointer->getField(0)).getValue());
+}
+
+TEST(BakerCollector, heapShrinksWhenSparse)
+{
+    const std::size_t heapSize = 64 * 1024;
+
+    BakerMemoryManager memoryManager;
+    memoryManager.setLargeObjectThreshold(0);
+    TClass* const klass = initializeTestHeap(memoryManager, heapSize, 1024 * 1024);
+
+    // Object larger than the semispace makes the heap grow
+    const uint32_t fieldsCount = 10 * 1024;
+    new (memoryManager.allocate(sizeof(TObject) + fieldsCount * sizeof(TObject*))) TObject(fieldsCount, klass);
+
+    memoryManager.collectGarbage();
+    const uint32_t grownSize = memoryManager.getStat().events.front().heapInfo.totalHeapSize;
+    EXPECT_LT(heapSize, grownSize);
+
+    // Object is not referenced, so the heap stays empty and returns to the initial size
+    for (int i = 0; i < 32; i++)
+        memoryManager.collectGarbage();
+
+    EXPECT_EQ(heapSize, memoryManager.getStat().events.front().heapInfo.totalHeapSize);
+}
+
+TEST(BakerCollector, heapGrowsForLiveObjects)
+{
+    const std::size_t heapSize = 64 * 1024;
+
+    BakerMemoryManager memoryManager;
+    memoryManager.setLargeObjectThreshold(0);
+    TClass* const klass = initializeTestHeap(memoryManager, heapSize, 1024 * 1024);
+
+    // Every object stays reachable, so the semispace fits
+    // them only after the heap grows a number of times
+    object_ptr head;
+    memoryManager.registerExternalHeapPointer(head);
+    head.data = TInteger(0);
+
+    const uint32_t objectsCount = 8 * 1024;
+    for (uint32_t index = 0; index < objectsCount; index++) {
+        void* const slot = memoryManager.allocate(sizeof(TObject) + 2 * sizeof(TObject*));
+        ASSERT_TRUE(slot != 0);
+
+        TObject* const object = new (slot) TObject(2, klass);
+        object->putField(0, head.data);
+        object->putField(1, TInteger(index));
+        head.data = object;
+    }
+
+    EXPECT_LT(heapSize, memoryManager.getStat().events.front().heapInfo.totalHeapSize);
+
+    uint32_t count = 0;
+    for (TObject* object = head.data; !isSmallInteger(object); object = object->getField(0))
+        ASSERT_EQ(static_cast<int32_t>(objectsCount - ++count), TInteger(object->getField(1)).getValue());
+    EXPECT_EQ(objectsCount, count);
+
+    memoryManager.releaseExternalHeapPointer(head);
+}
+
+TEST(IncrementalCollector, treeIsReadDuringCollection)
+{
+    H_CopyingHeap<IncrementalMemoryManager> heap(2 * 1024 * 1024);
+    IncrementalMemoryManager& memoryManager = heap.memoryManager();
+    const uint64_t expected = heap.build(12);
+    TObject* const rootBefore = heap.root();
+    TClass* const klass = rootBefore->getClass();
+
+    // Garbage starts the collection, but only the root is copied
+    while (memoryManager.getStat().pausesCount == 0)
+        new (memoryManager.allocate(sizeof(TObject) + 4 * sizeof(TObject*))) TObject(4, klass);
+
+    EXPECT_NE(rootBefore, heap.root()) << "root object should be moved";
+    EXPECT_EQ(0u, memoryManager.getStat().collectionsCount) << "collection should be in progress";
+
+    // Unscanned objects are scanned on the first access
+    EXPECT_EQ(expected, heap.checksum());
+
+    // The rest is scanned by the slices
+    while (memoryManager.getStat().collectionsCount == 0)
+        new (memoryManager.allocate(sizeof(TObject) + 4 * sizeof(TObject*))) TObject(4, klass);
+
+    EXPECT_EQ(expected, heap.checksum());
+    EXPECT_LT(1u, memoryManager.getStat().pausesCount);
+}
+
+static sigjmp_buf foreignFaultJump;
+static volatile int foreignFaultsCount = 0;
+
+static void foreignFaultHandler(int /*signal*/, siginfo_t* /*info*/, void* /*context*/)
+{
+    foreignFaultsCount++;
+    siglongjmp(foreignFaultJump, 1);
+}
+
+TEST(IncrementalCollector, foreignFaultsArePassedOn)
+{
+    struct sigaction action, previousAction;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = foreignFaultHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    ASSERT_EQ(0, sigaction(SIGSEGV, &action, &previousAction));
+
+    void* const page = mmap(0, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, page);
+    volatile uint8_t* const location = static_cast<uint8_t*>(page);
+
+    {
+        H_CopyingHeap<IncrementalMemoryManager> heap(2 * 1024 * 1024);
+        IncrementalMemoryManager& memoryManager = heap.memoryManager();
+        const uint64_t expected = heap.build(12);
+        TClass* const klass = heap.root()->getClass();
+
+        foreignFaultsCount = 0;
+        if (!sigsetjmp(foreignFaultJump, 1))
+            location[0] = 1;
+        EXPECT_EQ(1, foreignFaultsCount);
+
+        // Handler of the collector stays installed, so the barrier still works
+        while (memoryManager.getStat().pausesCount == 0)
+            new (memoryManager.allocate(sizeof(TObject) + 4 * sizeof(TObject*))) TObject(4, klass);
+        EXPECT_EQ(0u, memoryManager.getStat().collectionsCount) << "collection should be in progress";
+
+        EXPECT_EQ(expected, heap.checksum());
+        EXPECT_EQ(1, foreignFaultsCount);
+    }
+
+    munmap(page, 4096);
+    sigaction(SIGSEGV, &previousAction, 0);
+}
+
+template <typename MemoryManager>
+class T_LargeObjectSpace : public ::testing::Test {};
+
+typedef ::testing::Types<BakerMemoryManager, CheneyMemoryManager, ParallelMemoryManager> LargeObjectCollectors;
+TYPED_TEST_CASE(T_LargeObjectSpace, LargeObjectCollectors);
+
+TYPED_TEST(T_LargeObjectSpace, objectsStayInPlace)
+{
+    TypeParam memoryManager;
+    memoryManager.setLargeObjectThreshold(16 * 1024);
+    TClass* const klass = initializeTestHeap(memoryManager, 256 * 1024, 4 * 1024 * 1024);
+
+    const uint32_t fieldsCount = 8 * 1024;
+    const std::size_t largeSize = sizeof(TObject) + fieldsCount * sizeof(TObject*);
+
+    hptr<TObject> large(new (memoryManager.allocate(largeSize)) TObject(fieldsCount, klass), &memoryManager);
+    new (memoryManager.allocate(largeSize)) TObject(fieldsCount, klass);
+    TObject* const location = large.rawptr();
+
+    // Small object is referred only by the large one
+    TObject* const small = new (memoryManager.allocate(sizeof(TObject) + sizeof(TObject*))) TObject(1, klass);
+    small->putField(0, TInteger(7));
+    large->putField(fieldsCount - 1, small);
+
+    memoryManager.collectGarbage();
+
+    EXPECT_EQ(location, large.rawptr());
+    EXPECT_NE(small, large->getField(fieldsCount - 1));
+    EXPECT_EQ(7, TInteger(large->getField(fieldsCount - 1)->getField(0)).getValue());
+
+    // Unreachable large object is released
+    const TMemoryManagerInfo info = memoryManager.getStat();
+    const TMemoryManagerHeapEvent& largeObjects = info.events.front().heapInfo.heapEvents.back();
+    EXPECT_EQ("Large objects", largeObjects.eventName);
+    EXPECT_EQ(largeObjects.usedHeapSizeBeforeCollect / 2, largeObjects.usedHeapSizeAfterCollect);
+}
+
+TYPED_TEST(T_LargeObjectSpace, pinnedObjectsAreKept)
+{
+    TypeParam memoryManager;
+    TClass* const klass = initializeTestHeap(memoryManager, 256 * 1024, 4 * 1024 * 1024);
+    const std::size_t smallSize = sizeof(TObject) + sizeof(TObject*);
+
+    // Objects of the moving heap may not be pinned
+    TObject* const movable = new (memoryManager.allocate(smallSize)) TObject(1, klass);
+    EXPECT_FALSE(memoryManager.pinObject(movable));
+
+    // Pinned object is the only reference to the small one
+    TObject* const pinned = new (memoryManager.allocateNonMoving(smallSize)) TObject(1, klass);
+    ASSERT_TRUE(memoryManager.pinObject(pinned));
+    ASSERT_TRUE(memoryManager.pinObject(pinned));
+
+    TObject* const small = new (memoryManager.allocate(smallSize)) TObject(1, klass);
+    small->putField(0, TInteger(7));
+    pinned->putField(0, small);
+
+    memoryManager.collectGarbage();
+    EXPECT_NE(small, pinned->getField(0));
+    EXPECT_EQ(7, TInteger(pinned->getField(0)->getField(0)).getValue());
+
+    // Object is released when unpinned as many times as it was pinned
+    EXPECT_TRUE(memoryManager.unpinObject(pinned));
+    memoryManager.collectGarbage();
+
+    const TMemoryManagerHeapEvent& kept = memoryManager.getStat().events.front().heapInfo.heapEvents.back();
+    EXPECT_EQ(kept.usedHeapSizeBeforeCollect, kept.usedHeapSizeAfterCollect);
+
+    EXPECT_TRUE(memoryManager.unpinObject(pinned));
+    EXPECT_FALSE(memoryManager.unpinObject(pinned));
+    memoryManager.collectGarbage();
+
+    const TMemoryManagerHeapEvent& released = memoryManager.getStat().events.front().heapInfo.heapEvents.back();
+    EXPECT_EQ("Large objects", released.eventName);
+    EXPECT_EQ(0u, released.usedHeapSizeAfterCollect);
+}
+
+static THeapSizingPolicy::TSample overloadedHeapSample()
+{
+    // Half of the time is spent in the collection
+    THeapSizingPolicy::TSample sample;
+    sample.heapSize    = 1024 * 1024;
+    sample.usedBefore  = 500 * 1024;
+    sample.usedAfter   = 100 * 1024;
+    sample.pause       = 1000;
+    sample.mutatorTime = 1000;
+    return sample;
+}
+
+TEST(HeapSizingPolicy, gcTimeGoal)
+{
+    THeapSizingGoals goals;
+    goals.gcTimePercent = 5;
+
+    THeapSizingPolicy policy;
+    policy.setGoals(goals);
+    policy.setLimits(64 * 1024, 16 * 1024 * 1024);
+
+    // Heap grows at most twice per collection
+    THeapSizingPolicy::TSample sample = overloadedHeapSample();
+    EXPECT_EQ(2u * 1024 * 1024, policy.getNextHeapSize(sample));
+
+    // Cheap collections make the heap shrink, but live objects still fit
+    sample.usedBefore  = sample.usedAfter + 400 * 1024;
+    sample.pause       = 10;
+    sample.mutatorTime = 1000 * 1000;
+    EXPECT_EQ(512u * 1024, policy.getNextHeapSize(sample));
+
+    sample.heapSize = 256 * 1024;
+    EXPECT_EQ(2u * (100 + 25) * 1024, policy.getNextHeapSize(sample));
+}
+
+TEST(HeapSizingPolicy, pauseGoal)
+{
+    THeapSizingGoals goals;
+    goals.gcTimePercent = 5;
+    goals.maxPause = 500;
+
+    THeapSizingPolicy policy;
+    policy.setGoals(goals);
+    policy.setLimits(64 * 1024, 16 * 1024 * 1024);
+
+    const THeapSizingPolicy::TSample sample = overloadedHeapSample();
+    EXPECT_EQ(sample.heapSize, policy.getNextHeapSize(sample));
+}
+
+// Benchmark is disabled by default, run it with --gtest_also_run_disabled_tests
+TEST(CopyingCollectorBenchmark, DISABLED_pauseTimes)
+{
+    // Live set of several megabytes, that is larger than L2
+    const uint32_t depth = 17;
+    const std::size_t heapSize = 64 * 1024 * 1024;
+    const int collections = 5;
+
+    H_CopyingHeap<BakerMemoryManager> bakerHeap(heapSize);
+    H_CopyingHeap<CheneyMemoryManager> cheneyHeap(heapSize);
+    H_CopyingHeap<ParallelMemoryManager> parallelHeap(heapSize);
+
+    const uint64_t expected = bakerHeap.build(depth);
+    ASSERT_EQ(expected, cheneyHeap.build(depth));
+    ASSERT_EQ(expected, parallelHeap.build(depth));
+
+    uint64_t bakerDelay    = 0;
+    uint64_t cheneyDelay   = 0;
+    uint64_t parallelDelay = 0;
+    for (int pass = 0; pass < collections; pass++) {
+        bakerDelay    += bakerHeap.collect();
+        cheneyDelay   += cheneyHeap.collect();
+        parallelDelay += parallelHeap.collect();
+    }
+
+    EXPECT_EQ(expected, bakerHeap.checksum());
+    EXPECT_EQ(expected, cheneyHeap.checksum());
+    EXPECT_EQ(expected, parallelHeap.checksum());
+
+    // Average pauses in microseconds go to the XML report
+    RecordProperty("bakerPause",    static_cast<int>(bakerDelay / collections));
+    RecordProperty("cheneyPause",   static_cast<int>(cheneyDelay / collections));
+    RecordProperty("parallelPause", static_cast<int>(parallelDelay / collections));
+}
@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include <memory.h>
+
+#include <cstdlib>
+#include <set>
+
+TEST(TPointerSet, matchesStdSet)
+{
+    // Slots are taken from a small array, so collisions
+    // and erasure inside of the probe chains are frequent
+    TObject* slots[512];
+
+    TPointerSet<TObject**> pointerSet;
+    std::set<TObject**> referenceSet;
+
+    std::srand(42);
+    for (int step = 0; step < 100000; step++) {
+        TObject** const slot = &slots[std::rand() % 512];
+
+        if (std::rand() % 3) {
+            EXPECT_EQ(referenceSet.insert(slot).second, pointerSet.insert(slot));
+        } else {
+            EXPECT_EQ(referenceSet.erase(slot) == 1, pointerSet.erase(slot));
+        }
+
+        ASSERT_EQ(referenceSet.size(), pointerSet.size());
+    }
+
+    std::set<TObject**> iterated;
+    for (TPointerSet<TObject**>::iterator iSlot = pointerSet.begin(); iSlot != pointerSet.end(); ++iSlot) {
+        EXPECT_TRUE(referenceSet.count(*iSlot));
+        iterated.insert(*iSlot);
+    }
+    EXPECT_EQ(referenceSet.size(), iterated.size());
+
+    for (std::set<TObject**>::iterator iSlot = referenceSet.begin(); iSlot != referenceSet.end(); ++iSlot)
+        EXPECT_TRUE(pointerSet.contains(*iSlot));
+}
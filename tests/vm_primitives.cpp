@@ -150,9 +150,62 @@ TEST_P(P_InitVM_Image, smallint)
         callPrimitive(primitive::smallIntBitShift, args, primitiveFailed);
         ASSERT_TRUE(primitiveFailed);
     }
+    {
+        SCOPED_TRACE("1<<29");
+        args->putField(0, TInteger(1) );
+        args->putField(1, TInteger(29) );
+        bool primitiveFailed;
+        TInteger result = callPrimitive(primitive::smallIntBitShift, args, primitiveFailed);
+        ASSERT_FALSE(primitiveFailed);
+        ASSERT_EQ(1 << 29, result.getValue());
+    }
+    {
+        SCOPED_TRACE("(2^30-1)+1");
+        args->putField(0, TInteger(0x3FFFFFFF) );
+        args->putField(1, TInteger(1) );
+        bool primitiveFailed;
+        callPrimitive(primitive::smallIntAdd, args, primitiveFailed);
+        ASSERT_TRUE(primitiveFailed);
+    }
+    {
+        SCOPED_TRACE("-(2^30)-1");
+        args->putField(0, TInteger(-0x40000000) );
+        args->putField(1, TInteger(1) );
+        bool primitiveFailed;
+        callPrimitive(primitive::smallIntSub, args, primitiveFailed);
+        ASSERT_TRUE(primitiveFailed);
+    }
+    {
+        SCOPED_TRACE("2^15*2^15");
+        args->putField(0, TInteger(1 << 15) );
+        args->putField(1, TInteger(1 << 15) );
+        bool primitiveFailed;
+        callPrimitive(primitive::smallIntMul, args, primitiveFailed);
+        ASSERT_TRUE(primitiveFailed);
+    }
     m_image->deleteObject(args);
 }
 
+TEST_P(P_InitVM_Image, argumentsOnStack)
+{
+    // Arguments are taken from the pointed area, no array is needed
+    TObject* stack[3] = { TInteger(7), TInteger(2), TInteger(3) };
+    {
+        SCOPED_TRACE("2*3");
+        bool primitiveFailed;
+        TInteger result = callPrimitive(primitive::smallIntMul, &stack[1], primitiveFailed);
+        ASSERT_FALSE(primitiveFailed);
+        ASSERT_EQ(6, result.getValue());
+    }
+    {
+        SCOPED_TRACE("7-2");
+        bool primitiveFailed;
+        TInteger result = callPrimitive(primitive::smallIntSub, &stack[0], primitiveFailed);
+        ASSERT_FALSE(primitiveFailed);
+        ASSERT_EQ(5, result.getValue());
+    }
+}
+
 TEST_P(P_InitVM_Image, stringAt)
 {
     {